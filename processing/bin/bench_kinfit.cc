@@ -0,0 +1,155 @@
+#include "cms_runII_data_proc/processing/interface/file_looper.hh"
+#include "cms_runII_data_proc/processing/interface/kinfitter.hh"
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+
+std::string root_dir = "/eos/home-k/kandroso/cms-it-hh-bbtautau/anaTuples/2020-12-01";
+
+void show_help() {
+    /* Show help for input arguments */
+
+    std::cout << "Times the per-event KinFitter fit(\"ZZ\") + fit(\"ZH\") sequence against the batched fit_block API,\n";
+    std::cout << "and optionally one fit per hypothesis of a scan grid against KinFitter::scan\n";
+    std::cout << "-y : Year\n";
+    std::cout << "-c : Channel\n";
+    std::cout << "-n : # events with a b-jet pair to fit, default = 1000\n";
+    std::cout << "-i : input dir, default " << root_dir << "\n";
+    std::cout << "-g : KinFit scan grid as {mh1},{mh2}, each a mass or first:last:step, default = none (no scan benchmark)\n";
+}
+
+std::map<std::string, std::string> get_options(int argc, char* argv[]) {
+    /*Interpret input arguments*/
+
+    std::map<std::string, std::string> options;
+    options.insert(std::make_pair("-y", "2018")); // Year
+    options.insert(std::make_pair("-c", "tauTau")); // Channel
+    options.insert(std::make_pair("-n", "1000")); // # events
+    options.insert(std::make_pair("-i", root_dir)); // input dir name
+    options.insert(std::make_pair("-g", "")); // Scan grid
+
+    for (int i = 1; i < argc; i = i+2) {
+        std::string option(argv[i]);
+        if (option == "-h" || option == "--help" || i+1 >= argc) {
+            show_help();
+            options.clear();
+            return options;
+        }
+        options[option] = argv[i+1];
+    }
+    return options;
+}
+
+std::vector<KinFitInput> load_inputs(const std::string& fname, const std::string& channel, const long int& n_events) {
+    /* Read KinFit inputs of the first n_events events with a b-jet pair */
+
+    TFile* in_file = TFile::Open(fname.c_str());
+    TTreeReader reader(channel.c_str(), in_file);
+    TTreeReaderValue<bool> rv_has_b_pair(reader, "has_b_pair");
+    std::vector<std::unique_ptr<TTreeReaderValue<float>>> rvs;
+    for (const char* b : {"tau1_pt", "tau1_eta", "tau1_phi", "tau1_m", "tau2_pt", "tau2_eta", "tau2_phi", "tau2_m",
+                          "b1_pt", "b1_eta", "b1_phi", "b1_m", "b2_pt", "b2_eta", "b2_phi", "b2_m",
+                          "MET_pt", "MET_phi", "MET_cov_00", "MET_cov_01", "MET_cov_11"}) {
+        rvs.emplace_back(new TTreeReaderValue<float>(reader, b));
+    }
+
+    std::vector<KinFitInput> inputs;
+    inputs.reserve(n_events);
+    while ((long int)inputs.size() < n_events && reader.Next()) {
+        if (!*rv_has_b_pair) continue;
+        float vals[21];
+        for (unsigned int i = 0; i < 21; i++) vals[i] = **rvs[i];
+        if (channel == "muTau") vals[3] = MU_MASS;  // Fix mass for light leptons
+        if (channel == "eTau")  vals[3] = E_MASS;
+        KinFitInput input;
+        std::memcpy(&input, vals, sizeof(KinFitInput));
+        inputs.push_back(input);
+    }
+    in_file->Close();
+    return inputs;
+}
+
+bool same(const float& a, const float& b) {
+    return (a == b) || (std::isnan(a) && std::isnan(b));
+}
+
+int main(int argc, char *argv[]) {
+    std::map<std::string, std::string> options = get_options(argc, argv); // Parse arguments
+    if (options.size() == 0) return 1;
+
+    std::string fname = options["-i"]+"/"+options["-y"]+"_"+options["-c"]+"_Central.root";
+    std::cout << "Loading events from " << fname << "\n";
+    std::vector<KinFitInput> inputs = load_inputs(fname, options["-c"], std::stol(options["-n"]));
+    unsigned int n = inputs.size();
+    std::cout << "Loaded " << n << " events\n";
+    if (n == 0) return 1;
+
+    // Current per-event sequence
+    std::vector<std::pair<float,float>> ref_ZZ(n), ref_ZH(n);
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < n; i++) {
+        const float* vals = reinterpret_cast<const float*>(&inputs[i]);
+        std::vector<float> kinINinfo(vals, vals+21);
+        KinFitter fitter(kinINinfo);
+        ref_ZZ[i] = fitter.fit("ZZ");
+        ref_ZH[i] = fitter.fit("ZH");
+    }
+    double t_ref = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    // Batched hypotheses on a shared fitter
+    std::vector<std::pair<int,int>> hypos = {KinFitter::get_hypo_masses("ZZ"), KinFitter::get_hypo_masses("ZH"),
+                                             std::pair<int,int>(H_MASS, Z_MASS)};
+    start = std::chrono::steady_clock::now();
+    KinFitBlock block = KinFitter::fit_block(inputs, hypos);
+    double t_block = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    unsigned int n_diff = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        std::pair<float,float> zh = KinFitter::pick_ordering(std::pair<float,float>(block.mass[n+i],   block.chi2[n+i]),
+                                                             std::pair<float,float>(block.mass[2*n+i], block.chi2[2*n+i]));
+        if (!same(ref_ZZ[i].first, block.mass[i]) || !same(ref_ZZ[i].second, block.chi2[i]) ||
+            !same(ref_ZH[i].first, zh.first)      || !same(ref_ZH[i].second, zh.second)) n_diff++;
+    }
+
+    std::cout << "fit(ZZ) + fit(ZH): " << 1e6*t_ref/n   << " us/event\n";
+    std::cout << "fit_block:         " << 1e6*t_block/n << " us/event\n";
+    std::cout << "Speedup:           " << t_ref/t_block << "x\n";
+    std::cout << "Events with differing results: " << n_diff << "\n";
+    if (options["-g"] == "") return n_diff == 0 ? 0 : 1;
+
+    // Scan grid: independent fit per hypothesis against the shared scan
+    KinFitGrid grid = KinFitter::parse_grid(options["-g"]);
+    unsigned int n_hypos = grid.size();
+    std::vector<float> ref_mass(n*n_hypos), ref_chi2(n*n_hypos), scan_mass(n*n_hypos), scan_chi2(n*n_hypos);
+    start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < n; i++) {
+        for (unsigned int h = 0; h < n_hypos; h++) {
+            KinFitter fitter(inputs[i]);
+            std::pair<float,float> result = fitter.fit_hypos({grid.get(h)})[0];
+            ref_mass[i*n_hypos+h] = result.first;
+            ref_chi2[i*n_hypos+h] = result.second;
+        }
+    }
+    double t_naive = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    std::vector<KinFitStatus> status(n_hypos);
+    start = std::chrono::steady_clock::now();
+    KinFitter fitter(inputs[0]);
+    for (unsigned int i = 0; i < n; i++) {
+        fitter.set_input(inputs[i]);
+        fitter.scan(grid, &scan_mass[i*n_hypos], &scan_chi2[i*n_hypos], status.data());
+    }
+    double t_scan = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+
+    unsigned int n_scan_diff = 0;
+    for (unsigned int i = 0; i < n*n_hypos; i++) {
+        if (!same(ref_mass[i], scan_mass[i]) || !same(ref_chi2[i], scan_chi2[i])) n_scan_diff++;
+    }
+    std::cout << "\nScan of " << n_hypos << " hypotheses, " << KinFitter::describe_grid(grid) << "\n";
+    std::cout << "Fit per hypothesis: " << 1e6*t_naive/n << " us/event\n";
+    std::cout << "scan:               " << 1e6*t_scan/n  << " us/event\n";
+    std::cout << "Speedup:            " << t_naive/t_scan << "x\n";
+    std::cout << "Hypotheses with differing results: " << n_scan_diff << "\n";
+    return n_diff == 0 && n_scan_diff == 0 ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include "cms_runII_data_proc/processing/interface/file_looper.hh"
+#include "cms_runII_data_proc/processing/interface/synth_input.hh"
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+
+// Max relative difference of KinBlock vectors from PtEtaPhiM4D, relative to the momentum. Both are within ~2e-7 of the
+// double-precision result for |eta| < 5, so they differ by at most ~4e-7; 1e-6 is about 8 float ulps
+const double KIN_BLOCK_TOLERANCE = 1e-6;
+
+void show_help() {
+    /* Show help for input arguments */
+
+    std::cout << "Microbenchmarks of the processing library on a synthetic input file\n";
+    std::cout << "-y : Year\n";
+    std::cout << "-c : Channel\n";
+    std::cout << "-n : # events to generate and loop over, default = 20000\n";
+    std::cout << "-f : # events to fit in the KinFitter benchmark, default = 500\n";
+    std::cout << "-l : # lookups in the catalog, strat-key and jet-category benchmarks, and / 8 four-vectors converted, default = 10000000\n";
+    std::cout << "-t : # threads for the threaded full loop, default = 4\n";
+    std::cout << "-s : random seed, default = 1\n";
+    std::cout << "-o : working dir for the synthetic input and output, default = .\n";
+    std::cout << "Exits with 1 if the KinBlock four-vectors differ from the PtEtaPhiM4D ones by more than " << KIN_BLOCK_TOLERANCE << "\n";
+}
+
+std::map<std::string, std::string> get_options(int argc, char* argv[]) {
+    /*Interpret input arguments*/
+
+    std::map<std::string, std::string> options;
+    options.insert(std::make_pair("-y", "2018")); // Year
+    options.insert(std::make_pair("-c", "tauTau")); // Channel
+    options.insert(std::make_pair("-n", "20000")); // # events
+    options.insert(std::make_pair("-f", "500")); // # fits
+    options.insert(std::make_pair("-l", "10000000")); // # lookups
+    options.insert(std::make_pair("-t", "4")); // # threads
+    options.insert(std::make_pair("-s", "1")); // Seed
+    options.insert(std::make_pair("-o", ".")); // working dir name
+
+    for (int i = 1; i < argc; i = i+2) {
+        std::string option(argv[i]);
+        if (option == "-h" || option == "--help" || i+1 >= argc) {
+            show_help();
+            options.clear();
+            return options;
+        }
+        options[option] = argv[i+1];
+    }
+    return options;
+}
+
+template<typename F>
+double time_it(const long int& n, F f) {
+    /* Time n calls of f, returning ns per call */
+
+    auto start = std::chrono::steady_clock::now();
+    for (long int i = 0; i < n; i++) f(i);
+    return 1e9*std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count()/n;
+}
+
+void report(const std::string& name, const double& ns, const std::string& unit="call") {
+    std::cout << std::setw(32) << std::left << name << std::right << std::setw(14) << ns << " ns/" << unit << "\n";
+}
+
+int main(int argc, char *argv[]) {
+    std::map<std::string, std::string> options = get_options(argc, argv); // Parse arguments
+    if (options.size() == 0) return 1;
+
+    const std::string channel = options["-c"], year = options["-y"], dir = options["-o"];
+    const long int n_events = std::stol(options["-n"]), n_lookups = std::stol(options["-l"]);
+    const long int n_kin = std::min(n_events, 4096L)/KIN_BLOCK_SIZE*KIN_BLOCK_SIZE;  // Whole blocks of events for the kinematics benchmark
+    volatile unsigned long long int sink = 0;  // Keeps the timed calls from being optimised away
+    bool ok = true;
+
+    // Input
+    SynthConfig config = SynthInput::get_default_config();
+    config.seed = std::stoul(options["-s"]);
+    std::string fname = dir+"/"+year+"_"+channel+"_Central.root";
+    {
+        SynthInput synth(config);
+        synth.write(fname, channel, n_events);
+    }
+    TFile* in_file = TFile::Open(fname.c_str());
+    FileLooper aux_looper;
+    SampleCatalog catalog(aux_looper.build_dataset_id_map(in_file), aux_looper.build_region_id_map(in_file));
+
+    // KinFitter::fit
+    std::vector<std::vector<float>> kinfit_inputs;
+    std::vector<EvtInput> evts;
+    {
+        TTreeReader reader(channel.c_str(), in_file);
+        EvtReader evt_reader(reader);
+        TTreeReaderValue<bool> rv_has_b_pair(reader, "has_b_pair");
+        std::vector<std::unique_ptr<TTreeReaderValue<float>>> rvs;
+        for (const char* b : {"tau1_pt", "tau1_eta", "tau1_phi", "tau1_m", "tau2_pt", "tau2_eta", "tau2_phi", "tau2_m",
+                              "b1_pt", "b1_eta", "b1_phi", "b1_m", "b2_pt", "b2_eta", "b2_phi", "b2_m",
+                              "MET_pt", "MET_phi", "MET_cov_00", "MET_cov_01", "MET_cov_11"}) {
+            rvs.emplace_back(new TTreeReaderValue<float>(reader, b));
+        }
+        while (reader.Next()) {
+            if ((long int)evts.size() < n_kin) {
+                evts.emplace_back();
+                evt_reader.read_meta(evts.back());
+                evt_reader.read_feats(evts.back());
+            }
+            if (!*rv_has_b_pair || (long int)kinfit_inputs.size() >= std::stol(options["-f"])) continue;
+            std::vector<float> vals(21);
+            for (unsigned int i = 0; i < 21; i++) vals[i] = **rvs[i];
+            kinfit_inputs.push_back(vals);
+        }
+    }
+    in_file->Close();
+    if (kinfit_inputs.size() == 0) throw std::runtime_error("No events with a b-jet pair to fit");
+
+    std::cout << "\nMicrobenchmarks\n";
+    report("KinFitter::fit(ZZ) + fit(ZH)", time_it(kinfit_inputs.size(), [&](const long int& i) {
+        KinFitter fitter(kinfit_inputs[i]);
+        sink += fitter.fit("ZZ").first + fitter.fit("ZH").first;
+    }), "event");
+
+    // Four-vector conversion of the eight objects: per event through PtEtaPhiM4D, as the event loop used to, vs a KinBlock
+    using LorentzVectorPEP = ROOT::Math::LorentzVector<ROOT::Math::PtEtaPhiM4D<float>>;
+    using LorentzVector    = ROOT::Math::LorentzVector<ROOT::Math::PxPyPzM4D<float>>;
+    Channel kin_channel = channel == "tauTau" ? tauTau : (channel == "muTau" ? muTau : eTau);
+    const long int n_kin_reps = std::max(1L, n_lookups/(8*n_kin));
+    std::vector<std::vector<LorentzVector>> ref(n_kin, std::vector<LorentzVector>(n_kin_objects)), simd = ref;
+    auto convert_pep = [&](const long int& i) {
+        const EvtInput& e = evts[i%n_kin];
+        std::vector<LorentzVector>& v = ref[i%n_kin];
+        const float l_1_mass = kin_channel == muTau ? MU_MASS : (kin_channel == eTau ? E_MASS : e.l_1_mass);
+        LorentzVectorPEP pep;
+        pep.SetCoordinates(e.svfit_pT, e.svfit_eta, e.svfit_phi, e.svfit_mass);
+        v[obj_svfit].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        pep.SetCoordinates(e.l_1_pT, e.l_1_eta, e.l_1_phi, l_1_mass);
+        v[obj_l_1].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        pep.SetCoordinates(e.l_2_pT, e.l_2_eta, e.l_2_phi, e.l_2_mass);
+        v[obj_l_2].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        pep.SetCoordinates(e.met_pT, 0, e.met_phi, 0);
+        v[obj_met].SetCoordinates(pep.Px(), pep.Py(), 0, 0);
+        pep.SetCoordinates(e.b_1_pT, e.b_1_eta, e.b_1_phi, e.b_1_mass);
+        v[obj_b_1].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        pep.SetCoordinates(e.b_2_pT, e.b_2_eta, e.b_2_phi, e.b_2_mass);
+        v[obj_b_2].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        pep.SetCoordinates(e.vbf_1_pT, e.vbf_1_eta, e.vbf_1_phi, e.vbf_1_mass);
+        v[obj_vbf_1].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        pep.SetCoordinates(e.vbf_2_pT, e.vbf_2_eta, e.vbf_2_phi, e.vbf_2_mass);
+        v[obj_vbf_2].SetCoordinates(pep.Px(), pep.Py(), pep.Pz(), pep.M());
+        sink += v[obj_b_1].Px() > 0;
+    };
+    KinBlock block;
+    auto convert_block = [&](const long int& b) {
+        const unsigned int first = (b*KIN_BLOCK_SIZE)%n_kin;
+        block.load(&evts[first], KIN_BLOCK_SIZE, kin_channel);
+        block.convert();
+        for (unsigned int i = 0; i < KIN_BLOCK_SIZE; i++) {
+            for (unsigned int o = 0; o < n_kin_objects; o++) block.get(KinObject(o), i, simd[first+i][o]);
+        }
+        sink += simd[first][obj_b_1].Px() > 0;
+    };
+    if (n_kin > 0) {
+        report("PtEtaPhiM4D conversion", time_it(n_kin*n_kin_reps, convert_pep), "event");
+        report("KinBlock conversion", KIN_BLOCK_SIZE*time_it(n_kin/KIN_BLOCK_SIZE*n_kin_reps, convert_block), "event");
+        double max_diff = 0;  // Relative to the object's momentum
+        for (long int i = 0; i < n_kin; i++) {
+            for (unsigned int o = 0; o < n_kin_objects; o++) {
+                const LorentzVector& a = ref[i][o];
+                const LorentzVector& b = simd[i][o];
+                double p = std::max(1e-6, std::sqrt((double)a.Px()*a.Px()+a.Py()*a.Py()+a.Pz()*a.Pz()));
+                double m = std::max(1e-6, (double)std::abs(a.M()));
+                max_diff = std::max({max_diff, std::abs((double)a.Px()-b.Px())/p, std::abs((double)a.Py()-b.Py())/p,
+                                     std::abs((double)a.Pz()-b.Pz())/p, std::abs((double)a.M()-b.M())/m});
+            }
+        }
+        std::cout << "  max relative difference of KinBlock vectors: " << max_diff << "\n";
+        if (!(max_diff <= KIN_BLOCK_TOLERANCE)) {
+            std::cout << "  FAILED: KinBlock vectors differ by more than " << KIN_BLOCK_TOLERANCE << "\n";
+            ok = false;
+        }
+    }
+
+    // Sample lookup: dense catalog probe vs resolving the name every time, as the per-event lookup used to
+    std::map<unsigned, std::string> id2dataset;
+    for (const auto& s : config.samples) id2dataset[SynthInput::get_hash(s.first)] = s.first;
+    std::vector<unsigned> ids;
+    std::vector<std::string> names;
+    for (const auto& d : id2dataset) {
+        ids.push_back(d.first);
+        names.push_back(d.second);
+    }
+    report("SampleCatalog::get_sample", time_it(n_lookups, [&](const long int& i) {
+        sink += catalog.get_sample(ids[i%ids.size()]).sample_id;
+    }));
+    report("SampleCatalog::resolve_sample", time_it(n_lookups/100, [&](const long int& i) {
+        sink += SampleCatalog::resolve_sample(names[i%names.size()]).sample_id;
+    }));
+
+    // Strat key & jet category
+    Channel e_channel = channel == "tauTau" ? tauTau : (channel == "muTau" ? muTau : eTau);
+    Year e_year = year == "2016" ? y16 : (year == "2017" ? y17 : y18);
+    report("StratKey::encode", time_it(n_lookups, [&](const long int& i) {
+        sink += StratKey::encode(-(int)(i%28), 1+i%5, e_channel, e_year, i%5);
+    }));
+    report("StratKey::decode", time_it(n_lookups, [&](const long int& i) {
+        sink += StratKey::decode(i & 0xfffff).sample;
+    }));
+    report("FileLooper::jet_cat_lookup", time_it(n_lookups, [&](const long int& i) {
+        sink += FileLooper::jet_cat_lookup(i&1, i&2, i&4, (i>>3)%3, (i>>5)%3);
+    }));
+
+    // Full loop
+    std::cout << "\nFull loop\n";
+    std::vector<std::pair<std::string, unsigned int>> runs = {{"serial", 1}, {"threaded", std::stoul(options["-t"])}};
+    std::vector<double> t_loop;
+    for (const auto& r : runs) {
+        FileLooper file_looper;
+        auto start = std::chrono::steady_clock::now();
+        file_looper.loop_file(dir, dir, channel, year, -1, r.second);
+        t_loop.push_back(std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count());
+    }
+    std::cout << "\n";
+    for (unsigned int i = 0; i < runs.size(); i++) {
+        report("loop_file " + runs[i].first + " (" + std::to_string(runs[i].second) + " threads)", 1e9*t_loop[i]/n_events, "input event");
+    }
+    std::remove((dir+"/"+year+"_"+channel+".root").c_str());
+    std::cout << "(checksum " << sink << ")\n";
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,228 @@
+#include "cms_runII_data_proc/processing/interface/file_looper.hh"
+#include "cms_runII_data_proc/processing/interface/evt_writer.hh"
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <sstream>
+#include <cstdio>
+#ifdef EVT_WRITER_HAS_RNTUPLE
+#include <ROOT/RNTupleReader.hxx>
+#endif
+
+std::string root_dir = "/eos/home-k/kandroso/cms-it-hh-bbtautau/anaTuples/2020-12-01";
+
+void show_help() {
+    /* Show help for input arguments */
+
+    std::cout << "Compares write and read throughput, and file size, of every output format, I/O profile, and storage policy for a processed file\n";
+    std::cout << "-y : Year\n";
+    std::cout << "-c : Channel\n";
+    std::cout << "-n : # events to process, default = -1 (all)\n";
+    std::cout << "-r : # feature columns to read back, default = 5\n";
+    std::cout << "-p : comma-separated I/O profiles to compare, default = all presets\n";
+    std::cout << "-s : semicolon-separated storage policies to compare, default = full;compact;half\n";
+    std::cout << "-i : input dir, default " << root_dir << "\n";
+    std::cout << "-o : out dir, default = .\n";
+}
+
+std::map<std::string, std::string> get_options(int argc, char* argv[]) {
+    /*Interpret input arguments*/
+
+    std::map<std::string, std::string> options;
+    options.insert(std::make_pair("-y", "2018")); // Year
+    options.insert(std::make_pair("-c", "tauTau")); // Channel
+    options.insert(std::make_pair("-n", "-1")); // # events
+    options.insert(std::make_pair("-r", "5")); // # columns to read
+    options.insert(std::make_pair("-p", "")); // I/O profiles
+    options.insert(std::make_pair("-s", "full;compact;half")); // Storage policies
+    options.insert(std::make_pair("-i", root_dir)); // input dir name
+    options.insert(std::make_pair("-o", ".")); // output dir name
+
+    for (int i = 1; i < argc; i = i+2) {
+        std::string option(argv[i]);
+        if (option == "-h" || option == "--help" || i+1 >= argc) {
+            show_help();
+            options.clear();
+            return options;
+        }
+        options[option] = argv[i+1];
+    }
+    return options;
+}
+
+std::vector<std::unique_ptr<RecBuffer>> load_records(const std::string& fname, const std::vector<std::string>& feat_names) {
+    /* Read both folds of a processed TTree file into memory */
+
+    std::vector<std::unique_ptr<RecBuffer>> folds(2);
+    TFile* in_file = TFile::Open(fname.c_str());
+    for (unsigned int f = 0; f < folds.size(); f++) {
+        TTreeReader reader(("data_"+std::to_string(f)).c_str(), in_file);
+        folds[f].reset(new RecBuffer(reader.GetEntries(true), feat_names.size()));
+        std::vector<std::unique_ptr<TTreeReaderValue<float>>> rv_feats;
+        for (const std::string& n : feat_names) rv_feats.emplace_back(new TTreeReaderValue<float>(reader, n.c_str()));
+        TTreeReaderValue<float> rv_weight(reader, "weight");
+        TTreeReaderValue<float> rv_mass_ZZ(reader, "kinfit_mass_ZZ"), rv_chi2_ZZ(reader, "kinfit_chi2_ZZ");
+        TTreeReaderValue<float> rv_mass_ZH(reader, "kinfit_mass_ZH"), rv_chi2_ZH(reader, "kinfit_chi2_ZH");
+        TTreeReaderValue<int> rv_sample(reader, "sample"), rv_region(reader, "region"), rv_jet_cat(reader, "jet_cat");
+        TTreeReaderValue<unsigned int> rv_strat_key(reader, "strat_key"), rv_dataset(reader, "dataset");
+        TTreeReaderValue<unsigned long long int> rv_evt(reader, "evt");
+        TTreeReaderValue<int> rv_tau1_gen_match(reader, "tau1_gen_match"), rv_tau2_gen_match(reader, "tau2_gen_match");
+        TTreeReaderValue<int> rv_b1_hadronFlavour(reader, "b1_hadronFlavour"), rv_b2_hadronFlavour(reader, "b2_hadronFlavour");
+        unsigned int n = 0;
+        while (reader.Next()) {
+            EvtMeta& rec = folds[f]->meta(n);
+            float* feats = folds[f]->feats(n++);
+            for (unsigned int i = 0; i < feat_names.size(); i++) feats[i] = **rv_feats[i];
+            rec.weight           = *rv_weight;
+            rec.sample           = *rv_sample;
+            rec.region           = *rv_region;
+            rec.jet_cat          = *rv_jet_cat;
+            rec.strat_key        = *rv_strat_key;
+            rec.evt              = *rv_evt;
+            rec.dataset_id       = *rv_dataset;
+            rec.kinfit_mass_ZZ   = *rv_mass_ZZ;
+            rec.kinfit_chi2_ZZ   = *rv_chi2_ZZ;
+            rec.kinfit_mass_ZH   = *rv_mass_ZH;
+            rec.kinfit_chi2_ZH   = *rv_chi2_ZH;
+            rec.tau1_gen_match   = *rv_tau1_gen_match;
+            rec.tau2_gen_match   = *rv_tau2_gen_match;
+            rec.b1_hadronFlavour = *rv_b1_hadronFlavour;
+            rec.b2_hadronFlavour = *rv_b2_hadronFlavour;
+        }
+    }
+    in_file->Close();
+    return folds;
+}
+
+double time_write(const OutFormat& format, const IOProfile& profile, const StoragePolicy& storage, const std::string& oname,
+                  const std::vector<std::string>& feat_names, const std::vector<std::unique_ptr<RecBuffer>>& folds) {
+    /* Time writing all records in blocks of EVT_BATCH_SIZE, as the event loop does, including closing the file */
+
+    std::vector<unsigned int> fold_ids(EVT_BATCH_SIZE);
+    auto start = std::chrono::steady_clock::now();
+    EvtWriter* writer = EvtWriter::create(format, oname, feat_names, profile, {2, 0}, KinFitGrid(), storage);
+    for (unsigned int f = 0; f < folds.size(); f++) {
+        std::fill(fold_ids.begin(), fold_ids.end(), f);
+        for (unsigned int i = 0; i < folds[f]->capacity(); i += EVT_BATCH_SIZE) {
+            writer->fill_block(*folds[f], i, std::min(EVT_BATCH_SIZE, folds[f]->capacity()-i), fold_ids.data());
+        }
+    }
+    writer->close();
+    delete writer;
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+double time_read_tree(const std::string& fname, const std::vector<std::string>& columns, double& sum) {
+    /*
+    Time reading the requested columns of both folds. Branches are bound to floats directly, rather than read through
+    TTreeReaderValue<float>, which rejects Float16_t branches
+    */
+
+    auto start = std::chrono::steady_clock::now();
+    TFile* in_file = TFile::Open(fname.c_str());
+    std::vector<float> vals(columns.size());
+    for (unsigned int f = 0; f < 2; f++) {
+        TTree* tree = static_cast<TTree*>(in_file->Get(("data_"+std::to_string(f)).c_str()));
+        tree->SetBranchStatus("*", 0);
+        for (unsigned int c = 0; c < columns.size(); c++) {
+            tree->SetBranchStatus(columns[c].c_str(), 1);
+            tree->SetBranchAddress(columns[c].c_str(), &vals[c]);
+        }
+        for (long int i = 0; i < tree->GetEntries(); i++) {
+            tree->GetEntry(i);
+            for (const float& v : vals) sum += v;
+        }
+    }
+    in_file->Close();
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+
+#ifdef EVT_WRITER_HAS_RNTUPLE
+double time_read_rntuple(const std::string& fname, const std::vector<std::string>& columns, double& sum) {
+    /* Time reading the requested columns of both folds, column by column */
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int f = 0; f < 2; f++) {
+        auto reader = rntuple::RNTupleReader::Open("data_"+std::to_string(f), fname);
+        for (const std::string& c : columns) {
+            auto view = reader->GetView<float>(c);
+            for (auto i : reader->GetEntryRange()) sum += view(i);
+        }
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+}
+#endif
+
+long long int get_file_size(const std::string& fname) {
+    TFile* f = TFile::Open(fname.c_str());
+    long long int size = f->GetSize();
+    f->Close();
+    return size;
+}
+
+int main(int argc, char *argv[]) {
+    std::map<std::string, std::string> options = get_options(argc, argv); // Parse arguments
+    if (options.size() == 0) return 1;
+
+    // Process file once with the current TTree output
+    FileLooper file_looper;
+    file_looper.loop_file(options["-i"], options["-o"], options["-c"], options["-y"], std::stol(options["-n"]));
+    std::string proc_name = options["-o"]+"/"+options["-y"]+"_"+options["-c"]+".root";
+
+    EvtProc evt_proc(true, {}, true);
+    std::vector<std::string> feat_names = evt_proc.get_feats();
+    std::vector<std::unique_ptr<RecBuffer>> folds = load_records(proc_name, feat_names);
+    long int n = folds[0]->capacity()+folds[1]->capacity();
+    std::cout << "Loaded " << n << " processed events with " << feat_names.size() << " features\n";
+    if (n == 0) return 1;
+
+    std::vector<std::string> columns(feat_names.begin(), feat_names.begin()+std::min((size_t)std::stoi(options["-r"]), feat_names.size()));
+    columns.push_back("weight");
+
+    std::vector<std::string> profiles;
+    if (options["-p"] == "") {
+        for (const auto& p : EvtWriter::get_profile_presets()) {
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,20,0)
+            if (p.second.find("zstd") == 0) continue;
+#endif
+            profiles.push_back(p.first);
+        }
+    } else {
+        std::stringstream ss(options["-p"]);
+        std::string p;
+        while (std::getline(ss, p, ',')) profiles.push_back(p);
+    }
+
+    std::vector<std::string> policies;
+    std::stringstream ss(options["-s"]);
+    std::string s;
+    while (std::getline(ss, s, ';')) policies.push_back(s);
+
+    std::vector<std::pair<std::string, OutFormat>> formats = {{"tree", out_tree}, {"tree_async", out_tree_async}};
+#ifdef EVT_WRITER_HAS_RNTUPLE
+    formats.push_back(std::pair<std::string, OutFormat>("rntuple", out_rntuple));
+#else
+    std::cout << "RNTuple requires ROOT >= 6.32, only timing TTree output\n";
+#endif
+
+    std::cout << std::setw(12) << "format" << std::setw(30) << "profile" << std::setw(10) << "storage" << std::setw(14) << "size (MB)" << std::setw(18) << "write (evt/s)"
+              << std::setw(18) << "read (evt/s)" << "\n";
+    for (const auto& f : formats) {
+        for (const std::string& p : profiles) {
+            for (const std::string& s : policies) {
+                std::string oname = options["-o"]+"/bench_writer.root";
+                double t_write = time_write(f.second, EvtWriter::get_profile(p), StoragePolicy(s), oname, feat_names, folds);
+                double sum(0), t_read(0);
+                if (f.second != out_rntuple) t_read = time_read_tree(oname, columns, sum);
+#ifdef EVT_WRITER_HAS_RNTUPLE
+                if (f.second == out_rntuple) t_read = time_read_rntuple(oname, columns, sum);
+#endif
+                std::cout << std::setw(12) << f.first << std::setw(30) << p << std::setw(10) << s << std::setw(14)
+                          << get_file_size(oname)/1e6 << std::setw(18) << n/t_write << std::setw(18) << n/t_read
+                          << "   (checksum " << sum << ")\n";
+            }
+        }
+    }
+    std::remove((options["-o"]+"/bench_writer.root").c_str());
+    return 0;
+}
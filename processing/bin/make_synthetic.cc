@@ -0,0 +1,59 @@
+#include "cms_runII_data_proc/processing/interface/synth_input.hh"
+#include <iostream>
+#include <string>
+
+void show_help() {
+    /* Show help for input arguments */
+
+    std::cout << "Writes a synthetic {year}_{channel}_Central.root input file for benchmarking\n";
+    std::cout << "-y : Year\n";
+    std::cout << "-c : Channel\n";
+    std::cout << "-n : # events, default = 100000\n";
+    std::cout << "-s : random seed, default = 1\n";
+    std::cout << "-m : sample mix as comma-separated dataset:abundance, default = built-in mix\n";
+    std::cout << "-r : region mix as comma-separated region:abundance, default = built-in mix\n";
+    std::cout << "-k : kinematic settings as comma-separated key=value, keys are:";
+    for (const auto& k : SynthInput::get_default_config().kinematics) std::cout << " " << k.first;
+    std::cout << "\n";
+    std::cout << "-o : out dir, default = .\n";
+}
+
+std::map<std::string, std::string> get_options(int argc, char* argv[]) {
+    /*Interpret input arguments*/
+
+    std::map<std::string, std::string> options;
+    options.insert(std::make_pair("-y", "2018")); // Year
+    options.insert(std::make_pair("-c", "tauTau")); // Channel
+    options.insert(std::make_pair("-n", "100000")); // # events
+    options.insert(std::make_pair("-s", "1")); // Seed
+    options.insert(std::make_pair("-m", "")); // Sample mix
+    options.insert(std::make_pair("-r", "")); // Region mix
+    options.insert(std::make_pair("-k", "")); // Kinematic settings
+    options.insert(std::make_pair("-o", ".")); // output dir name
+
+    for (int i = 1; i < argc; i = i+2) {
+        std::string option(argv[i]);
+        if (option == "-h" || option == "--help" || i+1 >= argc) {
+            show_help();
+            options.clear();
+            return options;
+        }
+        options[option] = argv[i+1];
+    }
+    return options;
+}
+
+int main(int argc, char *argv[]) {
+    std::map<std::string, std::string> options = get_options(argc, argv); // Parse arguments
+    if (options.size() == 0) return 1;
+
+    SynthConfig config = SynthInput::get_default_config();
+    config.seed = std::stoul(options["-s"]);
+    if (options["-m"] != "") config.samples = SynthInput::parse_mix(options["-m"]);
+    if (options["-r"] != "") config.regions = SynthInput::parse_mix(options["-r"]);
+    if (options["-k"] != "") SynthInput::parse_kinematics(options["-k"], config);
+
+    SynthInput synth(config);
+    synth.write(options["-o"]+"/"+options["-y"]+"_"+options["-c"]+"_Central.root", options["-c"], std::stol(options["-n"]));
+    return 0;
+}
@@ -1,6 +1,7 @@
 #include "cms_runII_data_proc/processing/interface/file_looper.hh"
 #include <iostream>
 #include <string>
+#include <sstream>
 
 std::string root_dir = "/eos/home-k/kandroso/cms-it-hh-bbtautau/anaTuples/2020-12-01";
 std::string out_dir = "/eos/user/g/gstrong/cms_runII_data_proc/data";
@@ -9,11 +10,29 @@ std::string out_dir = "/eos/user/g/gstrong/cms_runII_data_proc/data";
 void show_help() {
     /* Show help for input arguments */
 
-    std::cout << "-y : Year\n";
-    std::cout << "-c : Channel\n";
+    std::cout << "-y : Year, or comma-separated list of years to run in batch mode\n";
+    std::cout << "-c : Channel, or comma-separated list of channels to run in batch mode\n";
     std::cout << "-n : # events, default = -1 (all)\n";
-    std::cout << "-i : input dir, default " << root_dir << "data/set\n";
+    std::cout << "-t : # worker threads, default = 1 (serial loop)\n";
+    std::cout << "-i : input dir, default = " << root_dir << "\n";
     std::cout << "-o : out dir, default = " << out_dir << "\n";
+    std::cout << "-k : KinFit cache file, default = none\n";
+    std::cout << "-w : output format, tree, tree_async (compression on background threads), rntuple (requires ROOT >= 6.32), or hist (only the histograms of -b), default = tree\n";
+    std::cout << "-b : histograms for hist output as comma-separated column:n_bins:lo:hi over features and metadata, e.g. diH_mass:40:0:800,weight:50:0:2, split by sample, region, and jet_cat; only the columns they need are computed unless -r is given, default = none\n";
+    std::cout << "-p : output I/O profile, a preset (default, zlib, lz4, lz4_big, lzma, zstd, zstd_big) or algorithm:level:basket_size:auto_flush, default = default\n";
+    std::cout << "-z : output storage policy, a preset (full, compact, half) or comma-separated pattern=type rules, type f32, trunc:N, f16:N, i32, i16, or i8, e.g. *=trunc:12,weight=f32,sample=i8, default = full\n";
+    std::cout << "-a : save a checkpoint every # events, resuming interrupted runs from it, default = 0 (off)\n";
+    std::cout << "-m : JSON file for per-stage timing and throughput metrics, updated every 10 s, default = none\n";
+    std::cout << "-f : # output folds, data_0 ... data_{f-1}, default = 2\n";
+    std::cout << "-d : seed for assigning events to folds by a hash of their ID, default = 0 (fold = ID % # folds)\n";
+    std::cout << "-v : log level for diagnostics from the event loop, debug, info, warning, or error, default = info\n";
+    std::cout << "-r : comma-separated list of features and KinFit columns to compute, reading only the inputs they need, default = all\n";
+    std::cout << "-q : KinFit scan grid of (mh1, mh2) hypotheses as {mh1},{mh2}, each a mass or first:last:step in GeV, e.g. 80:200:10,125, written as array branches, default = none\n";
+    std::cout << "-x : shard i/N, process only the i-th of N equal entry ranges into {year}_{channel}.shard_i_of_N.root, default = none\n";
+    std::cout << "-e : entry range first:last, process only input entries [first, last) (last empty = to the end), default = all\n";
+    std::cout << "-g : merge the outputs of N shards (run with -x i/N) into {year}_{channel}.root instead of looping, default = 0 (off)\n";
+    std::cout << "-u : augment the existing output {year}_{channel}.root with the columns of -r and the scan of -q only, written as friend trees to {year}_{channel}.{u}.root, default = none (full processing)\n";
+    std::cout << "-s : batch mode: # entries per chunk, default = 0 (total entries / (4 * # threads))\n";
 }
 
 std::map<std::string, std::string> get_options(int argc, char* argv[]) {
@@ -23,8 +42,26 @@ std::map<std::string, std::string> get_options(int argc, char* argv[]) {
     options.insert(std::make_pair("-y", "")); // Year
     options.insert(std::make_pair("-c", "")); // Channel
     options.insert(std::make_pair("-n", "-1")); // # events
+    options.insert(std::make_pair("-t", "1")); // # threads
     options.insert(std::make_pair("-i", root_dir)); // input dir name
     options.insert(std::make_pair("-o", out_dir)); // output name
+    options.insert(std::make_pair("-k", "")); // KinFit cache
+    options.insert(std::make_pair("-s", "0")); // Batch chunk size
+    options.insert(std::make_pair("-w", "tree")); // Output format
+    options.insert(std::make_pair("-b", "")); // Booked histograms
+    options.insert(std::make_pair("-p", "default")); // Output I/O profile
+    options.insert(std::make_pair("-z", "full")); // Output storage policy
+    options.insert(std::make_pair("-a", "0")); // Checkpoint interval
+    options.insert(std::make_pair("-m", "")); // Metrics file
+    options.insert(std::make_pair("-f", "2")); // # folds
+    options.insert(std::make_pair("-d", "0")); // Fold seed
+    options.insert(std::make_pair("-v", "info")); // Log level
+    options.insert(std::make_pair("-r", "")); // Requested features
+    options.insert(std::make_pair("-q", "")); // KinFit scan grid
+    options.insert(std::make_pair("-x", "")); // Shard
+    options.insert(std::make_pair("-e", "")); // Entry range
+    options.insert(std::make_pair("-g", "0")); // # shards to merge
+    options.insert(std::make_pair("-u", "")); // Augmentation tag
 
     if (argc >= 2) { //Check if help was requested
         std::string option(argv[1]);
@@ -48,12 +85,62 @@ std::map<std::string, std::string> get_options(int argc, char* argv[]) {
     return options;
 }
 
+std::vector<std::string> split_list(const std::string& list) {
+    /* Split comma-separated list */
+
+    std::vector<std::string> items;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item != "") items.push_back(item);
+    }
+    return items;
+}
+
 int main(int argc, char *argv[]) {
     std::map<std::string, std::string> options = get_options(argc, argv); // Parse arguments
     if (options.size() == 0) return 1;
 
-    FileLooper file_looper;
-    bool ok = file_looper.loop_file(options["-i"], options["-o"], options["-c"], options["-y"], std::stoi(options["-n"]));
+    Logger::get().set_level(Logger::get_level(options["-v"]));
+    std::vector<std::string> requested = split_list(options["-r"]);
+    bool augment = options["-u"] != "";
+    bool hists = options["-w"] == "hist";
+    if (hists && requested.size() == 0) requested = HistEvtWriter::get_requested(HistEvtWriter::parse_booking(options["-b"]));
+    FileLooper file_looper(requested.size() == 0 && !augment && !hists, requested, true, true, false, false, true, true, EvtWriter::get_format(options["-w"]));
+    file_looper.set_io_profile(options["-p"]);
+    file_looper.set_storage(options["-z"]);
+    file_looper.set_hists(options["-b"]);
+    file_looper.set_checkpoint(std::stol(options["-a"]));
+    file_looper.set_folds(std::stoul(options["-f"]), std::stoull(options["-d"]));
+    file_looper.set_metrics(options["-m"]);
+    if (options["-k"] != "") file_looper.set_kinfit_cache(options["-k"]);
+    file_looper.set_kinfit_scan(options["-q"]);
+    if (options["-x"] != "") {
+        size_t sep = options["-x"].find('/');
+        if (sep == std::string::npos) throw std::invalid_argument("Shard must be given as i/N, not " + options["-x"]);
+        file_looper.set_shard(std::stoul(options["-x"].substr(0, sep)), std::stoul(options["-x"].substr(sep+1)));
+    }
+    if (options["-e"] != "") {
+        size_t sep = options["-e"].find(':');
+        if (sep == std::string::npos) throw std::invalid_argument("Entry range must be given as first:last, not " + options["-e"]);
+        std::string last = options["-e"].substr(sep+1);
+        file_looper.set_entry_range(std::stol(options["-e"].substr(0, sep)), last == "" ? -1 : std::stol(last));
+    }
+    std::vector<std::string> years = split_list(options["-y"]);
+    std::vector<std::string> channels = split_list(options["-c"]);
+    bool ok = true;
+    if (std::stoul(options["-g"]) > 0) {
+        file_looper.merge_shards(options["-o"], options["-c"], options["-y"], std::stoul(options["-g"]));
+    } else if (augment) {
+        ok = file_looper.augment_file(options["-i"], options["-o"], options["-c"], options["-y"], options["-u"],
+                                      std::stoi(options["-t"]));
+    } else if (years.size() > 1 || channels.size() > 1) {
+        ok = file_looper.loop_files(options["-i"], options["-o"], channels, years, std::stoi(options["-n"]),
+                                    std::stoi(options["-t"]), std::stol(options["-s"]));
+    } else {
+        ok = file_looper.loop_file(options["-i"], options["-o"], options["-c"], options["-y"], std::stoi(options["-n"]),
+                                   std::stoi(options["-t"]));
+    }
     if (ok) std::cout << "File loop ran ok!\n";
     return 0;
 }
\ No newline at end of file
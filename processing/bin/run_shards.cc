@@ -0,0 +1,149 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <spawn.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+
+extern char** environ;
+
+std::string root_dir = "/eos/home-k/kandroso/cms-it-hh-bbtautau/anaTuples/2020-12-01";
+std::string out_dir = "/eos/user/g/gstrong/cms_runII_data_proc/data";
+
+
+void show_help() {
+    /* Show help for input arguments */
+
+    std::cout << "Runs a file as N RunLoop shard processes on this machine, then merges their outputs into {year}_{channel}.root\n";
+    std::cout << "-y : Year\n";
+    std::cout << "-c : Channel\n";
+    std::cout << "-j : # shard processes, default = # cores\n";
+    std::cout << "-l : RunLoop executable, default = RunLoop (from PATH)\n";
+    std::cout << "-i : input dir, default = " << root_dir << "\n";
+    std::cout << "-o : out dir, default = " << out_dir << "\n";
+    std::cout << "-n : # events per shard, passed to RunLoop, default = -1 (all)\n";
+    std::cout << "-w : output format, passed to RunLoop, default = tree\n";
+    std::cout << "-b : histograms for hist output, passed to RunLoop, default = none\n";
+    std::cout << "-k : KinFit cache file shared by the shards, passed to RunLoop, default = none\n";
+    std::cout << "-p : output I/O profile, passed to RunLoop, default = default\n";
+    std::cout << "-z : output storage policy, passed to RunLoop, default = full\n";
+    std::cout << "-a : save a checkpoint every # events, so that rerunning resumes interrupted shards, default = 0 (off)\n";
+    std::cout << "-f : # output folds, default = 2\n";
+    std::cout << "-d : fold seed, default = 0\n";
+    std::cout << "-r : comma-separated list of features and KinFit columns to compute, default = all\n";
+    std::cout << "-q : KinFit scan grid, passed to RunLoop, default = none\n";
+    std::cout << "-v : log level, default = info\n";
+    std::cout << "Shard i logs to {out dir}/{year}_{channel}.shard_i_of_N.log\n";
+}
+
+std::map<std::string, std::string> get_options(int argc, char* argv[]) {
+    /*Interpret input arguments*/
+
+    std::map<std::string, std::string> options;
+    options.insert(std::make_pair("-y", "")); // Year
+    options.insert(std::make_pair("-c", "")); // Channel
+    options.insert(std::make_pair("-j", std::to_string(std::max(1U, std::thread::hardware_concurrency())))); // # shards
+    options.insert(std::make_pair("-l", "RunLoop")); // Executable
+    options.insert(std::make_pair("-i", root_dir)); // input dir name
+    options.insert(std::make_pair("-o", out_dir)); // output name
+    options.insert(std::make_pair("-n", "-1")); // # events per shard
+    options.insert(std::make_pair("-w", "tree")); // Output format
+    options.insert(std::make_pair("-b", "")); // Booked histograms
+    options.insert(std::make_pair("-k", "")); // KinFit cache
+    options.insert(std::make_pair("-p", "default")); // Output I/O profile
+    options.insert(std::make_pair("-z", "full")); // Output storage policy
+    options.insert(std::make_pair("-a", "0")); // Checkpoint interval
+    options.insert(std::make_pair("-f", "2")); // # folds
+    options.insert(std::make_pair("-d", "0")); // Fold seed
+    options.insert(std::make_pair("-r", "")); // Requested features
+    options.insert(std::make_pair("-q", "")); // KinFit scan grid
+    options.insert(std::make_pair("-v", "info")); // Log level
+
+    for (int i = 1; i < argc; i = i+2) {
+        std::string option(argv[i]);
+        if (option == "-h" || option == "--help" || i+1 >= argc) {
+            show_help();
+            options.clear();
+            return options;
+        }
+        options[option] = argv[i+1];
+    }
+    return options;
+}
+
+pid_t spawn(const std::vector<std::string>& args, const std::string& log_name) {
+    /* Start args as a child process with its stdout and stderr written to log_name */
+
+    std::vector<char*> argv;
+    for (const std::string& a : args) argv.push_back(const_cast<char*>(a.c_str()));
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, STDOUT_FILENO, log_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    posix_spawn_file_actions_adddup2(&actions, STDOUT_FILENO, STDERR_FILENO);
+    pid_t pid;
+    int err = posix_spawnp(&pid, argv[0], &actions, nullptr, argv.data(), environ);
+    posix_spawn_file_actions_destroy(&actions);
+    if (err != 0) throw std::runtime_error("Unable to start " + args[0] + ": " + std::to_string(err));
+    return pid;
+}
+
+bool wait_all(const std::vector<pid_t>& pids, const std::vector<std::string>& names) {
+    /* Wait for every process, reporting how each ended; returns whether all exited with status 0 */
+
+    bool ok = true;
+    for (unsigned int i = 0; i < pids.size(); i++) {
+        int status;
+        if (waitpid(pids[i], &status, 0) < 0) throw std::runtime_error("Lost track of " + names[i]);
+        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+            std::cout << names[i] << " done\n";
+        } else {
+            ok = false;
+            std::cout << names[i] << (WIFSIGNALED(status) ? " killed by signal " + std::to_string(WTERMSIG(status))
+                                                          : " failed with status " + std::to_string(WEXITSTATUS(status))) << "\n";
+        }
+    }
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    std::map<std::string, std::string> options = get_options(argc, argv); // Parse arguments
+    if (options.size() == 0) return 1;
+
+    unsigned int n_shards = std::stoul(options["-j"]);
+    std::string base = options["-o"]+"/"+options["-y"]+"_"+options["-c"];
+    std::vector<std::string> common = {"-y", options["-y"], "-c", options["-c"], "-i", options["-i"], "-o", options["-o"],
+                                       "-p", options["-p"], "-z", options["-z"], "-f", options["-f"], "-d", options["-d"], "-v", options["-v"],
+                                       "-w", options["-w"]};
+    if (options["-r"] != "") common.insert(common.end(), {"-r", options["-r"]});
+    if (options["-q"] != "") common.insert(common.end(), {"-q", options["-q"]});
+    if (options["-b"] != "") common.insert(common.end(), {"-b", options["-b"]});
+
+    std::cout << "Launching " << n_shards << " shards of " << base << "\n";
+    std::vector<pid_t> pids;
+    std::vector<std::string> names;
+    for (unsigned int i = 0; i < n_shards; i++) {
+        std::string shard = std::to_string(i)+"_of_"+std::to_string(n_shards);
+        std::vector<std::string> args = {options["-l"], "-x", std::to_string(i)+"/"+std::to_string(n_shards), "-t", "1",
+                                         "-a", options["-a"], "-n", options["-n"]};
+        if (options["-k"] != "") args.insert(args.end(), {"-k", options["-k"]});
+        args.insert(args.end(), common.begin(), common.end());
+        pids.push_back(spawn(args, base+".shard_"+shard+".log"));
+        names.push_back("Shard " + shard);
+    }
+    if (!wait_all(pids, names)) {
+        std::cout << "Not merging, since some shards failed; rerun to retry them\n";
+        return 1;
+    }
+
+    std::vector<std::string> args = {options["-l"], "-g", std::to_string(n_shards)};
+    args.insert(args.end(), common.begin(), common.end());
+    if (!wait_all({spawn(args, base+".merge.log")}, {"Merge"})) return 1;
+    std::cout << "Shards merged into " << base << ".root\n";
+    return 0;
+}
@@ -0,0 +1,59 @@
+#ifndef CUTFLOW_HH_
+#define CUTFLOW_HH_
+
+// C++
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <map>
+#include <array>
+#include <stdexcept>
+
+// ROOT
+#include <TDirectory.h>
+#include <TTree.h>
+
+// Cuts of FileLooper::_accept_evt, in the order they are applied; events are counted under the first cut they fail
+enum CutReason{cut_klambda, cut_data, cut_region, cut_jet_cat, cut_exp_jet_cat, cut_non_sm_vbf, cut_sample, cut_pass, n_cut_reasons};
+
+class Cutflow {
+	/*
+    Accounting of the selection, filled by the selection pass so that no second pass over the input is needed: the number of
+    events and summed weights rejected by each cut, and passing all of them, plus the number, sum of weights, and sum of
+    squared weights of all and of selected events per (sample, region, jet_cat, class_id). Each thread or chunk fills its
+    own instance; instances are merged at the end of the loop. Stored in the output as the cutflow and sumw trees.
+    */
+
+private:
+    struct Sums {
+        long long int n;
+        double sumw, sumw2;
+        Sums() : n(0), sumw(0), sumw2(0) {}
+        void add(const double& w) { n++; sumw += w; sumw2 += w*w; }
+        void merge(const Sums& other) { n += other.n; sumw += other.sumw; sumw2 += other.sumw2; }
+    };
+    struct CatSums {
+        Sums all, selected;
+    };
+    using CatKey = std::array<int, 4>;  // sample, region, jet_cat, class_id
+
+	// Variables
+    std::array<Sums, n_cut_reasons> _cuts;
+    std::map<CatKey, CatSums> _cats;
+
+public:
+    // Methods
+    Cutflow();
+    ~Cutflow();
+    void add(const CutReason& reason, const float& weight, const int& sample, const int& region, const int& jet_cat,
+             const int& class_id);
+    void merge(const Cutflow& other);
+    void clear();
+    bool empty() const { return _cats.empty(); }
+    void print_summary() const;
+    void write(TDirectory* dir) const;
+    static Cutflow read(TDirectory* dir);
+    static std::string get_reason_name(const CutReason& reason);
+};
+
+#endif /* CUTFLOW_HH_ */
@@ -0,0 +1,82 @@
+#ifndef EVT_READER_HH_
+#define EVT_READER_HH_
+
+// C++
+#include <string>
+#include <vector>
+#include <memory>
+
+// ROOT
+#include <TTreeReader.h>
+#include <TTreeReaderValue.h>
+
+// Local
+#include "cms_runII_data_proc/processing/interface/evt_record.hh"
+#include "cms_runII_data_proc/processing/interface/feat_deps.hh"
+
+class EvtReader {
+	/*
+    Binds the input branches of a channel tree and copies their values for the current entry into an EvtInput.
+    Only the input groups in the mask given are bound and read; the fields of the other groups are left untouched.
+    */
+
+private:
+	// Meta
+    TTreeReaderValue<unsigned long long> _rv_evt;
+    TTreeReaderValue<float> _rv_weight;
+    TTreeReaderValue<UInt_t> _rv_dataset_id;
+    TTreeReaderValue<UInt_t> _rv_region_id;
+
+    // Gen Info
+    TTreeReaderValue<int> _rv_tau1_gen_match, _rv_tau2_gen_match, _rv_b1_hadronFlavour, _rv_b2_hadronFlavour;
+
+    // Selection
+    TTreeReaderValue<bool> _rv_is_boosted, _rv_has_b_pair, _rv_has_vbf_pair;
+    TTreeReaderValue<int> _rv_num_btag_loose, _rv_num_btag_medium;
+
+    // Input groups, bound only if requested
+    unsigned int _groups;
+    using ValuePtr = std::unique_ptr<TTreeReaderValue<float>>;
+
+    // HL feats
+    ValuePtr _rv_kinfit_mass, _rv_kinfit_chi2, _rv_mt2;
+
+    // Tagging
+    ValuePtr _rv_b_1_csv, _rv_b_2_csv;
+    ValuePtr _rv_b_1_hhbtag, _rv_b_1_cvsl, _rv_b_1_cvsb, _rv_b_2_hhbtag, _rv_b_2_cvsl, _rv_b_2_cvsb;
+    ValuePtr _rv_vbf_1_hhbtag, _rv_vbf_1_cvsl, _rv_vbf_1_cvsb, _rv_vbf_2_hhbtag, _rv_vbf_2_cvsl, _rv_vbf_2_cvsb;
+
+    // SVFit feats
+    ValuePtr _rv_svfit_pT, _rv_svfit_eta, _rv_svfit_phi, _rv_svfit_mass;
+
+    // l1 & l2 feats
+    ValuePtr _rv_l_1_pT, _rv_l_1_eta, _rv_l_1_phi, _rv_l_1_mass;
+    ValuePtr _rv_l_2_pT, _rv_l_2_eta, _rv_l_2_phi, _rv_l_2_mass;
+
+    // MET feats
+    ValuePtr _rv_met_pT, _rv_met_phi, _rv_met_cov_00, _rv_met_cov_01, _rv_met_cov_11;
+
+    // b1 & b2 feats
+    ValuePtr _rv_b_1_pT, _rv_b_1_eta, _rv_b_1_phi, _rv_b_1_mass;
+    ValuePtr _rv_b_2_pT, _rv_b_2_eta, _rv_b_2_phi, _rv_b_2_mass;
+
+    // vbf1 & vbf2 feats
+    ValuePtr _rv_vbf_1_pT, _rv_vbf_1_eta, _rv_vbf_1_phi, _rv_vbf_1_mass;
+    ValuePtr _rv_vbf_2_pT, _rv_vbf_2_eta, _rv_vbf_2_phi, _rv_vbf_2_mass;
+
+	// Methods
+    bool _has(const InputGroup& group) const { return _groups & 1U << group; }
+    void _bind(TTreeReader& reader, const InputGroup& group, const std::vector<ValuePtr*>& values);
+
+public:
+    // Methods
+    EvtReader(TTreeReader& reader, const unsigned int& groups=ALL_INPUT_GROUPS);
+    ~EvtReader();
+    void read_meta(EvtInput& evt);
+    void read_feats(EvtInput& evt);
+    static std::vector<std::string> get_meta_branches();
+    static std::vector<std::string> get_group_branches(const InputGroup& group);
+    static std::vector<std::string> get_branch_names(const unsigned int& groups=ALL_INPUT_GROUPS);
+};
+
+#endif /* EVT_READER_HH_ */
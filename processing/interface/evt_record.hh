@@ -0,0 +1,125 @@
+#ifndef EVT_RECORD_HH_
+#define EVT_RECORD_HH_
+
+// C++
+#include <vector>
+#include <memory>
+#include <new>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+// Plugins
+#include "cms_hh_proc_interface/processing/interface/feat_comp.hh"
+
+struct EvtInput {
+    /* Raw branch values for a single input event, plus the meta info derived from them by the reader stage */
+
+    // Meta
+    long long int entry;
+    unsigned long long int evt;
+    float weight;
+    unsigned int dataset_id, region_id;
+    int sample, region, jet_cat, class_id;
+    Spin spin;
+    float klambda, res_mass, cv, c2v, c3;
+    unsigned int strat_key;
+
+    // Gen info
+    int tau1_gen_match, tau2_gen_match, b1_hadronFlavour, b2_hadronFlavour;
+
+    // HL feats
+    float kinfit_mass, kinfit_chi2, mt2;
+
+    // Tagging
+    float b_1_csv, b_2_csv;
+    bool is_boosted, has_vbf_pair, has_b_pair;
+    int num_btag_loose, num_btag_medium;
+    float b_1_hhbtag, b_1_cvsl, b_1_cvsb;
+    float b_2_hhbtag, b_2_cvsl, b_2_cvsb;
+    float vbf_1_hhbtag, vbf_1_cvsl, vbf_1_cvsb;
+    float vbf_2_hhbtag, vbf_2_cvsl, vbf_2_cvsb;
+
+    // Vectors
+    float svfit_pT, svfit_eta, svfit_phi, svfit_mass;
+    float l_1_pT, l_1_eta, l_1_phi, l_1_mass;
+    float l_2_pT, l_2_eta, l_2_phi, l_2_mass;
+    float met_pT, met_phi, met_cov_00, met_cov_01, met_cov_11;
+    float b_1_pT, b_1_eta, b_1_phi, b_1_mass;
+    float b_2_pT, b_2_eta, b_2_phi, b_2_mass;
+    float vbf_1_pT, vbf_1_eta, vbf_1_phi, vbf_1_mass;
+    float vbf_2_pT, vbf_2_eta, vbf_2_phi, vbf_2_mass;
+};
+
+struct EvtMeta {
+    /* Everything written to the output trees for a single event except its features */
+
+    long long int entry;
+    unsigned long long int evt;
+    unsigned int dataset_id;
+    float weight;
+    int sample, region, jet_cat, class_id;
+    unsigned int strat_key;
+    float kinfit_mass_ZZ, kinfit_chi2_ZZ, kinfit_mass_ZH, kinfit_chi2_ZH;
+    int tau1_gen_match, tau2_gen_match, b1_hadronFlavour, b2_hadronFlavour;
+};
+
+class RecBuffer {
+	/*
+    Output records of up to capacity events in one cache-line aligned allocation. Each record is its EvtMeta followed directly
+    by its features, padded to a multiple of 8 bytes, so a record spans a few consecutive cache lines, can be copied with one
+    memcpy, and output columns can be bound to fixed offsets within it. If a KinFit scan of n_scan hypotheses is run, its
+    masses and then its chi2s follow the features.
+    */
+
+private:
+	// Variables
+    unsigned int _capacity, _n_feats, _n_scan;
+    size_t _stride;
+    char* _data;
+
+public:
+    // Methods
+    RecBuffer(const unsigned int& capacity, const unsigned int& n_feats, const unsigned int& n_scan=0)
+        : _capacity(capacity), _n_feats(n_feats), _n_scan(n_scan) {
+        _stride = (sizeof(EvtMeta)+(n_feats+2*n_scan)*sizeof(float)+7)/8*8;
+        size_t size = (std::max(1U, capacity)*_stride+63)/64*64;  // aligned_alloc requires a multiple of the alignment
+        _data = static_cast<char*>(std::aligned_alloc(64, size));
+        if (_data == nullptr) throw std::bad_alloc();
+        std::memset(_data, 0, size);
+    }
+    ~RecBuffer() { std::free(_data); }
+    RecBuffer(const RecBuffer&) = delete;
+    RecBuffer& operator=(const RecBuffer&) = delete;
+
+    unsigned int capacity() const { return _capacity; }
+    unsigned int n_feats() const { return _n_feats; }
+    unsigned int n_scan() const { return _n_scan; }
+    size_t stride() const { return _stride; }
+    EvtMeta& meta(const unsigned int& i) { return *reinterpret_cast<EvtMeta*>(_data+i*_stride); }
+    const EvtMeta& meta(const unsigned int& i) const { return *reinterpret_cast<const EvtMeta*>(_data+i*_stride); }
+    float* feats(const unsigned int& i) { return reinterpret_cast<float*>(_data+i*_stride+sizeof(EvtMeta)); }
+    const float* feats(const unsigned int& i) const { return reinterpret_cast<const float*>(_data+i*_stride+sizeof(EvtMeta)); }
+    float* scan_mass(const unsigned int& i) { return feats(i)+_n_feats; }
+    const float* scan_mass(const unsigned int& i) const { return feats(i)+_n_feats; }
+    float* scan_chi2(const unsigned int& i) { return feats(i)+_n_feats+_n_scan; }
+    const float* scan_chi2(const unsigned int& i) const { return feats(i)+_n_feats+_n_scan; }
+    void copy(const unsigned int& i, const RecBuffer& other, const unsigned int& j) {
+        /* Copy record j of other, which must have the same features and scan, into record i */
+        std::memcpy(_data+i*_stride, other._data+j*other._stride, _stride);
+    }
+};
+
+struct EvtBatch {
+    /* Block of consecutive accepted events passed between the stages of the threaded loop */
+
+    unsigned long int seq;
+    unsigned int n;
+    std::vector<EvtInput> inputs;
+    RecBuffer records;
+
+    EvtBatch(unsigned int size, unsigned int n_feats, unsigned int n_scan=0)
+        : seq(0), n(0), inputs(size), records(size, n_feats, n_scan) {}
+};
+
+#endif /* EVT_RECORD_HH_ */
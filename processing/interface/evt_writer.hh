@@ -0,0 +1,326 @@
+#ifndef EVT_WRITER_HH_
+#define EVT_WRITER_HH_
+
+// C++
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <exception>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+
+// ROOT
+#include <RVersion.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TDirectory.h>
+#include <TKey.h>
+#include <TROOT.h>
+#include <TSystem.h>
+#include <TParameter.h>
+#include <TNamed.h>
+#include <TH1D.h>
+#include <ROOT/TBufferMerger.hxx>
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,32,0)
+#define EVT_WRITER_HAS_RNTUPLE
+#include <ROOT/RNTupleModel.hxx>
+#include <ROOT/RNTupleWriter.hxx>
+#endif
+
+// Local
+#include "cms_runII_data_proc/processing/interface/evt_record.hh"
+#include "cms_runII_data_proc/processing/interface/work_queue.hh"
+#include "cms_runII_data_proc/processing/interface/strat_key.hh"
+#include "cms_runII_data_proc/processing/interface/kinfitter.hh"
+#include "cms_runII_data_proc/processing/interface/storage_policy.hh"
+
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,24,0)
+namespace bufmerger = ROOT;
+#else
+namespace bufmerger = ROOT::Experimental;
+#endif
+
+const unsigned int WRITE_BLOCK_SIZE = 256;  // Records per unit of work passed to the background writers
+
+enum OutFormat{out_tree, out_tree_async, out_rntuple, out_hist};
+
+struct IOProfile {
+    /* Output I/O settings. auto_flush follows TTree::SetAutoFlush: > 0 is a number of entries, < 0 a number of bytes */
+
+    std::string name;
+    int compression;  // 100*algorithm + level
+    int basket_size;
+    long long int auto_flush;
+};
+
+struct LoopState {
+    /* Progress of a loop, stored in the output file with each checkpoint */
+
+    long long int last_entry;                // Input entry of the last event written, -1 if none
+    std::vector<long long int> n_saved;      // Events written to each fold
+};
+
+struct FoldSpec {
+    /* Assignment of events to the output folds: evt % n_folds if seed is 0, otherwise a seeded splitmix64 hash of evt % n_folds */
+
+    unsigned int n_folds;
+    unsigned long long int seed;
+
+    unsigned int get_fold(const unsigned long long int& evt) const {
+        if (seed == 0) return evt%n_folds;
+        unsigned long long int h = evt+seed*0x9e3779b97f4a7c15ULL;
+        h = (h ^ (h >> 30))*0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27))*0x94d049bb133111ebULL;
+        h ^= h >> 31;
+        return h%n_folds;
+    }
+};
+
+class EvtWriter {
+	/*
+    Writes processed events to the folds data_0 ... data_{k-1} of an output file. Events are assigned to folds by the caller,
+    following a FoldSpec; the default of two unhashed folds puts even event IDs in data_0 and odd in data_1.
+    Every backend writes the same columns: one per feature, followed by the meta data, and the strat_index tree.
+    Records are passed in blocks: records first ... first+n-1 of a RecBuffer, each with its own fold.
+    If a KinFit scan grid is given, its masses and chi2s are written as the fixed-size arrays kinfit_scan_mass and
+    kinfit_scan_chi2, in grid order, and the grid is recorded alongside them. The StoragePolicy sets the precision each
+    column is stored with.
+    */
+
+public:
+    // Methods
+    virtual ~EvtWriter() {}
+    virtual void fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) = 0;
+    void fill(const RecBuffer& recs, const unsigned int& i, const unsigned int& fold) { this->fill_block(recs, i, 1, &fold); }
+    virtual void close() = 0;
+    virtual void checkpoint(const LoopState& state);
+    virtual void resume(const std::string& ckpt_name, const LoopState& state);
+    static bool read_state(const std::string& fname, LoopState& state);
+    static EvtWriter* create(const OutFormat& format, const std::string& oname, const std::vector<std::string>& feat_names,
+                             const IOProfile& profile=EvtWriter::get_profile("default"), const FoldSpec& folds={2, 0},
+                             const KinFitGrid& scan=KinFitGrid(), const StoragePolicy& storage=StoragePolicy());
+    static OutFormat get_format(const std::string& format);
+    static OutFormat detect_format(TDirectory* dir);
+    static IOProfile get_profile(const std::string& profile);
+    static const std::map<std::string, std::string>& get_profile_presets();
+    static std::string get_tree_title(const unsigned int& fold, const FoldSpec& folds);
+    static void prep_tree(TTree* tree, RecBuffer& rec, PackedColumns& packed, const std::vector<std::string>& feat_names,
+                          const IOProfile& profile, const KinFitGrid& scan=KinFitGrid(), const StoragePolicy& storage=StoragePolicy());
+};
+
+class TreeEvtWriter : public EvtWriter {
+	/* One TTree per fold, with one branch per column, filled serially by the calling thread */
+
+private:
+	// Variables
+    TFile* _file;
+    std::vector<TTree*> _trees;
+    RecBuffer _rec;  // Single record the branches are bound to
+    std::vector<std::unique_ptr<PackedColumns>> _packed;  // Per fold
+    bool _checkpointed;
+    StratIndex _index;
+
+public:
+    // Methods
+    TreeEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const IOProfile& profile,
+                  const FoldSpec& folds, const KinFitGrid& scan=KinFitGrid(), const StoragePolicy& storage=StoragePolicy());
+    ~TreeEvtWriter();
+    void fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) override;
+    void close() override;
+    void checkpoint(const LoopState& state) override;
+    void resume(const std::string& ckpt_name, const LoopState& state) override;
+};
+
+using EvtId = std::pair<unsigned long long int, unsigned int>;  // evt, dataset
+
+class FriendTreeEvtWriter : public EvtWriter {
+	/*
+    Friend trees augmenting an existing output: one TTree per fold holding only the added columns, i.e. the features given,
+    the KinFit columns named in meta_columns, and the scan arrays, plus evt and dataset. Entries are written in the same
+    order as those of the base trees. If the (evt, dataset) of the base entries are set, every record is checked against the
+    base entry it is aligned with. The trees are indexed by (evt, dataset) on closing, so they can be matched to the base
+    trees by index rather than only by position. Not made by create, since the columns differ
+    */
+
+private:
+	// Variables
+    TFile* _file;
+    std::vector<TTree*> _trees;
+    RecBuffer _rec;  // Single record the branches are bound to
+    std::vector<std::unique_ptr<PackedColumns>> _packed;  // Per fold
+    std::vector<std::vector<EvtId>> _base_ids;  // Per fold, empty if not checked
+    std::vector<long long int> _n_filled;
+
+	// Methods
+    void _prep_tree(TTree* tree, PackedColumns& packed, const std::vector<std::string>& feat_names,
+                    const std::vector<std::string>& meta_columns, const IOProfile& profile, const KinFitGrid& scan,
+                    const StoragePolicy& storage);
+
+public:
+    // Methods
+    FriendTreeEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names,
+                        const std::vector<std::string>& meta_columns, const IOProfile& profile, const FoldSpec& folds,
+                        const KinFitGrid& scan=KinFitGrid(), const StoragePolicy& storage=StoragePolicy());
+    ~FriendTreeEvtWriter();
+    void set_base_ids(std::vector<std::vector<EvtId>> base_ids);
+    void fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) override;
+    void close() override;
+};
+
+struct HistSpec {
+    /* Histogram booked over a column: n_bins equal bins over [lo, hi), plus under- and overflow */
+
+    std::string column;
+    unsigned int n_bins;
+    float lo, hi;
+};
+
+class HistEvtWriter : public EvtWriter {
+	/*
+    Histogram-only output, with no trees: the booked histograms of feature and metadata columns, weighted by the event weight
+    and split by (sample, region, jet_cat), each category a directory sample_{s}_region_{r}_jet_cat_{j} of TH1Ds named after
+    their columns. Blocks are binned one column at a time, with vectorised gather and bin-index loops, into plain sumw and
+    sumw2 arrays, which become the histograms on closing. Each writer accumulates on its own, and the outputs of chunks and
+    shards are added by the merger. Folds are ignored. Not made by create, since it needs the booking
+    */
+
+private:
+    struct Column {
+        HistSpec spec;
+        size_t offset;  // Byte offset of the column in a record
+        bool is_int;
+        size_t first_bin;  // Offset of the column's bins in the arrays of a category
+    };
+    struct Category {
+        int sample, region, jet_cat;
+        long long int n;
+        std::vector<double> sumw, sumw2;  // n_bins+2 bins per column, including under- and overflow
+    };
+
+	// Variables
+    TFile* _file;
+    std::vector<Column> _columns;
+    size_t _n_bins;
+    std::vector<Category> _cats;
+    std::map<unsigned int, unsigned int> _cat_idx;  // By strat key, which fixes (sample, region, jet_cat) within a file
+    std::vector<double> _vals;
+    std::vector<float> _weights;
+    std::vector<int> _bins;
+    std::vector<unsigned int> _block_cats;
+
+	// Methods
+    unsigned int _get_cat(const EvtMeta& meta);
+
+public:
+    // Methods
+    HistEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const std::vector<HistSpec>& hists,
+                  const IOProfile& profile);
+    ~HistEvtWriter();
+    void fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) override;
+    void close() override;
+    static std::vector<HistSpec> parse_booking(const std::string& spec);
+    static std::vector<std::string> get_requested(const std::vector<HistSpec>& hists);
+    static const std::map<std::string, std::pair<size_t, bool>>& get_meta_columns();
+};
+
+class AsyncTreeEvtWriter : public EvtWriter {
+	/*
+    One TTree per fold, each filled, serialised, and compressed on its own thread inside a TBufferMergerFile.
+    Whenever a fold reaches the profile's AutoFlush size, its compressed baskets are handed to the TBufferMerger,
+    which appends them to the output file on yet another thread without recompressing them.
+    Entries of each fold are written in the order they were passed to fill.
+    */
+
+private:
+    struct RecBlock {
+        unsigned int n;
+        RecBuffer recs;
+        RecBlock(unsigned int n_feats, unsigned int n_scan) : n(0), recs(WRITE_BLOCK_SIZE, n_feats, n_scan) {}
+    };
+    struct Fold {
+        std::unique_ptr<RecBlock> block;  // Block currently filled by the calling thread
+        WorkQueue<std::unique_ptr<RecBlock>> free_blocks, todo_blocks;
+        std::thread thread;
+        Fold(unsigned int n_blocks) : free_blocks(n_blocks), todo_blocks(n_blocks) {}
+    };
+
+	// Variables
+    std::vector<std::string> _feat_names;
+    IOProfile _profile;
+    FoldSpec _fold_spec;
+    KinFitGrid _scan;
+    StoragePolicy _storage;
+    std::unique_ptr<bufmerger::TBufferMerger> _merger;
+    std::vector<std::unique_ptr<Fold>> _folds;
+    StratIndex _index;
+    std::exception_ptr _error;
+    std::mutex _error_mutex;
+
+	// Methods
+    void _write_fold(const unsigned int& fold);
+    void _fail();
+
+public:
+    // Methods
+    AsyncTreeEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const IOProfile& profile,
+                       const FoldSpec& folds, const KinFitGrid& scan=KinFitGrid(), const StoragePolicy& storage=StoragePolicy());
+    ~AsyncTreeEvtWriter();
+    void fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) override;
+    void close() override;
+};
+
+#ifdef EVT_WRITER_HAS_RNTUPLE
+#if ROOT_VERSION_CODE >= ROOT_VERSION(6,36,0)
+namespace rntuple = ROOT;
+#else
+namespace rntuple = ROOT::Experimental;
+#endif
+
+class NTupleEvtWriter : public EvtWriter {
+	/*
+    One RNTuple per fold, appended to a single TFile, with one field per column. A scan grid is stored as kinfit_scan_grid.
+    Reduced-precision floats of the storage policy are written as truncated floats; integers keep 32 bits, since RNTuple's
+    split, zigzag-encoded integer columns already compress small values to about their significant bytes
+    */
+
+private:
+    struct Fields {
+        std::vector<std::shared_ptr<float>> feats;
+        std::shared_ptr<float> weight, kinfit_mass_ZZ, kinfit_chi2_ZZ, kinfit_mass_ZH, kinfit_chi2_ZH;
+        std::shared_ptr<int> sample, region, jet_cat, tau1_gen_match, tau2_gen_match, b1_hadronFlavour, b2_hadronFlavour;
+        std::shared_ptr<unsigned int> strat_key, dataset;
+        std::shared_ptr<unsigned long long int> evt;
+        std::shared_ptr<std::vector<float>> scan_mass, scan_chi2;
+    };
+
+	// Variables
+    std::unique_ptr<TFile> _file;
+    std::vector<Fields> _fields;
+    std::vector<std::unique_ptr<rntuple::RNTupleWriter>> _writers;
+    StratIndex _index;
+    KinFitGrid _scan;
+    std::vector<unsigned int> _feat_bits;  // Mantissa bits kept per column
+    unsigned int _weight_bits, _kinfit_bits[4], _scan_bits[2];
+
+	// Methods
+    std::unique_ptr<rntuple::RNTupleModel> _prep_model(Fields& fields, const std::vector<std::string>& feat_names);
+
+public:
+    // Methods
+    NTupleEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const IOProfile& profile,
+                    const FoldSpec& folds, const KinFitGrid& scan=KinFitGrid(), const StoragePolicy& storage=StoragePolicy());
+    ~NTupleEvtWriter();
+    void fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) override;
+    void close() override;
+};
+#endif
+
+#endif /* EVT_WRITER_HH_ */
@@ -0,0 +1,53 @@
+#ifndef FEAT_DEPS_HH_
+#define FEAT_DEPS_HH_
+
+// C++
+#include <string>
+#include <vector>
+#include <functional>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+// ROOT
+#include <TRandom3.h>
+
+// Local
+#include "cms_runII_data_proc/processing/interface/evt_record.hh"
+
+// Groups of input branches which are read, and turned into vectors, together. Meta and gen branches are always read
+enum InputGroup{grp_hl_kinfit, grp_mt2, grp_csv, grp_jet_tags, grp_svfit, grp_l_1, grp_l_2, grp_met, grp_met_cov,
+                grp_b_1, grp_b_2, grp_vbf_1, grp_vbf_2, n_input_groups};
+
+const unsigned int ALL_INPUT_GROUPS = (1U << n_input_groups)-1;
+const unsigned int KINFIT_INPUT_GROUPS = 1U << grp_l_1 | 1U << grp_l_2 | 1U << grp_b_1 | 1U << grp_b_2 | 1U << grp_met |
+                                         1U << grp_met_cov;  // Inputs of the ZZ/ZH KinFit stage
+const unsigned int FEAT_DEPS_TRIALS = 36;  // Random events probed per dependency map, four per channel and year
+
+class FeatDeps {
+	/*
+    Dependency map from output columns to input groups and processing stages. EvtProc does not expose which inputs each of
+    its features uses, so the map of the features is measured: each input group is redrawn in turn for a set of random
+    events, and a feature depends on the group if its value changes. A feature which cannot be probed is given every group.
+    Only the ZZ/ZH KinFit stage feeds the metadata columns.
+    */
+
+private:
+	// Methods
+    static void _draw_group(EvtInput& evt, const InputGroup& group, TRandom3& rng);
+    static void _draw_vector(float& pT, float& eta, float& phi, float& mass, const double& mean_pT, const double& max_mass,
+                             TRandom3& rng);
+
+public:
+    using Evaluator = std::function<void(const EvtInput& evt, const unsigned int& trial, std::vector<float>& feats)>;
+
+    // Methods
+    static std::vector<unsigned int> probe(const unsigned int& n_feats, const Evaluator& eval, std::vector<bool>& unprobed,
+                                           const unsigned int& n_trials=FEAT_DEPS_TRIALS);
+    static bool split_requested(const std::vector<std::string>& requested, std::vector<std::string>& feats);
+    static std::vector<std::string> get_kinfit_columns();
+    static std::string get_group_name(const InputGroup& group);
+    static std::string describe(const unsigned int& groups);
+};
+
+#endif /* FEAT_DEPS_HH_ */
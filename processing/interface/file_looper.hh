@@ -3,11 +3,21 @@
 
 // C++
 #include <iostream>
+#include <iomanip>
 #include <string>
 #include <map>
 #include <vector>
 #include <set>
 #include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+#include <limits>
+#include <cstdio>
 
 // ROOT
 #include <Math/VectorUtil.h>
@@ -18,55 +28,170 @@
 #include <TTree.h>
 #include <TTreeReader.h>
 #include <TTreeReaderValue.h>
+#include <TEntryList.h>
+#include <TFileMerger.h>
+#include <TROOT.h>
 
 // Plugins
 #include "cms_hh_proc_interface/processing/interface/feat_comp.hh"
 #include "cms_hh_proc_interface/processing/interface/evt_proc.hh"
 
-const double E_MASS  = 0.0005109989; //GeV
-const double MU_MASS = 0.1056583715; //GeV
+// Local
+#include "cms_runII_data_proc/processing/interface/evt_record.hh"
+#include "cms_runII_data_proc/processing/interface/evt_reader.hh"
+#include "cms_runII_data_proc/processing/interface/feat_deps.hh"
+#include "cms_runII_data_proc/processing/interface/kin_block.hh"
+#include "cms_runII_data_proc/processing/interface/evt_writer.hh"
+#include "cms_runII_data_proc/processing/interface/work_queue.hh"
+#include "cms_runII_data_proc/processing/interface/kinfitter.hh"
+#include "cms_runII_data_proc/processing/interface/kinfit_cache.hh"
+#include "cms_runII_data_proc/processing/interface/kinfit_stats.hh"
+#include "cms_runII_data_proc/processing/interface/sample_catalog.hh"
+#include "cms_runII_data_proc/processing/interface/loop_metrics.hh"
+#include "cms_runII_data_proc/processing/interface/strat_key.hh"
+#include "cms_runII_data_proc/processing/interface/cutflow.hh"
+#include "cms_runII_data_proc/processing/interface/logger.hh"
+
+const unsigned int EVT_BATCH_SIZE = KIN_BLOCK_SIZE;  // Accepted events per unit of work, converted as one KinBlock
+
+struct LoopFile {
+    /* Bookkeeping for one input file in batch mode */
+
+    std::string year, channel, fname, oname;
+    long int n_entries, n_selected, n_saved;
+    double busy_time;                // Summed thread time spent on the file's chunks (s)
+    std::vector<std::string> parts;  // Output files of the chunks, in entry order
+    KinFitStats kinfit_stats;
+    Cutflow cutflow;
+};
+
+struct LoopChunk {
+    /* Entry range [first, last) of one input file, processed as an independent unit of work in batch mode */
+
+    unsigned int file_idx, part;
+    long int first, last;
+};
 
 class FileLooper {
 	/* Class for processing data in a ROOT file event by event */
 
 private:
 	// Names
-	using LorentzVectorPEP = ROOT::Math::LorentzVector<ROOT::Math::PtEtaPhiM4D<float>>;
-	using LorentzVector    = ROOT::Math::LorentzVector<ROOT::Math::PxPyPzM4D<float>>;
+	using LorentzVector = ROOT::Math::LorentzVector<ROOT::Math::PxPyPzM4D<float>>;
+    struct EvtKernel {
+        /*
+        Per-event stages instantiated for the channel and year of a file, which are constant for the whole loop, so that the
+        lepton masses and strat key fields they depend on are compile-time constants. Chosen once per file by _get_kernel
+        */
+        bool (FileLooper::*read_evt)(EvtReader&, EvtInput&, const SampleCatalog&, StageCounters*);
+        void (FileLooper::*process_batch)(EvtBatch&, KinBlock&, KinFitter&, EvtProc*, std::vector<std::unique_ptr<float>>&,
+                                          KinFitStats&, StageCounters*);
+        void (FileLooper::*compute_feats)(const EvtInput&, const KinBlock&, const unsigned int&, EvtProc*,
+                                          std::vector<std::unique_ptr<float>>&);
+    };
 
 	// Variables
-    bool _all, _use_deep_csv, _inc_other_regions, _inc_all_jets, _inc_data, _only_kl1, _only_sm_vbf;
-    std::set<std::string> _requested;
+    bool _all, _use_deep_csv, _inc_other_regions, _inc_all_jets, _inc_data, _only_kl1, _only_sm_vbf, _run_kinfit;
+    std::vector<std::string> _requested, _proc_requested;
+    unsigned int _input_groups, _kin_objects;
     unsigned int _n_feats;
     std::vector<std::string> _feat_names;
     EvtProc* _evt_proc;
+    KinFitCache* _kinfit_cache;
+    KinFitGrid _kinfit_scan;
+    KinFitStats _kinfit_stats;
+    OutFormat _out_format;
+    IOProfile _io_profile;
+    StoragePolicy _storage;
+    std::vector<HistSpec> _hist_specs;
+    FoldSpec _fold_spec;
+    long int _checkpoint_every;
+    unsigned int _shard, _n_shards;
+    long int _range_first, _range_last;
+    std::string _metrics_fname;
+    double _metrics_interval;
 
 	// Methods
-    inline int _get_split(const unsigned long int&);
-    void _prep_file(TTree* tree, const std::vector<std::unique_ptr<float>>& feat_vals, float* weight, int* sample, int* region, int* jet_cat,
-                    int* class_id, unsigned long long int* strat_key,
-                    float* kinfit_mass_ZZ, float* kinfit_chi2_ZZ, float* kinfit_mass_ZH, float* kinfit_chi2_ZH,
-                    int* tau1_gen_match, int* tau2_gen_match, int* b1_hadronFlavour, int* b2_hadronFlavour);
+    inline unsigned int _get_split(const unsigned long long int& evt);
+    CutReason _select_evt(EvtInput& evt, const SampleCatalog& catalog);
+    TEntryList* _build_entry_list(TTree* tree, const SampleCatalog& catalog, const long int& n_events, const long int& first=0,
+                                  const long int& last=-1, Cutflow* cutflow=nullptr, const long int& enter_from=0);
+    void _write_cutflow(const std::string& oname, const Cutflow& cutflow);
+    EvtWriter* _create_writer(const std::string& oname);
+    void _set_input_groups();
+    void _enable_branches(TTree* tree);
+    void _report_bytes_read(TFile* in_file, TTree* tree);
+    template <Channel C, Year Y>
+    bool _read_evt(EvtReader& evt_reader, EvtInput& evt, const SampleCatalog& catalog, StageCounters* counters);
+    template <Channel C, Year Y>
+    void _process_batch(EvtBatch& batch, KinBlock& block, KinFitter& fitter, EvtProc* evt_proc,
+                        std::vector<std::unique_ptr<float>>& feat_vals, KinFitStats& kinfit_stats, StageCounters* counters);
+    template <Channel C, Year Y>
+    void _process_evt(const EvtInput& evt, const KinBlock& block, KinFitter& fitter, const unsigned int& i, RecBuffer& recs,
+                      EvtProc* evt_proc, std::vector<std::unique_ptr<float>>& feat_vals, KinFitStats& kinfit_stats,
+                      StageCounters* counters);
+    template <Channel C, Year Y>
+    void _compute_feats(const EvtInput& evt, const KinBlock& block, const unsigned int& i, EvtProc* evt_proc,
+                        std::vector<std::unique_ptr<float>>& feat_vals);
+    template <Channel C>
+    static float _get_l_1_mass(const EvtInput& evt) {
+        /* Fix mass for light leptons */
+        if constexpr (C == muTau) return MU_MASS;
+        if constexpr (C == eTau) return E_MASS;
+        return evt.l_1_mass;
+    }
+    template <Channel C>
+    EvtKernel _get_kernel(const Year& year);
+    EvtKernel _get_kernel(const Channel& channel, const Year& year);
+    void _fit_kinfit(KinFitter& fitter, const KinFitInput& input, const int& sample, KinFitStats& kinfit_stats,
+                     std::pair<float,float>& kinfit_ZZ, std::pair<float,float>& kinfit_ZH);
+    long int _loop_serial(TTreeReader& reader, EvtReader& evt_reader, const SampleCatalog& catalog, const EvtKernel& kernel,
+                          EvtWriter* writer, const long int& n_events, EvtProc* evt_proc,
+                          KinFitStats& kinfit_stats, LoopState* state=nullptr, LoopMetrics* metrics=nullptr,
+                          const bool& verbose=true);
+    long int _loop_chunk(const LoopFile& file, const LoopChunk& chunk, EvtProc* evt_proc, KinFitStats& kinfit_stats,
+                         Cutflow& cutflow, long int& n_selected, const long int& n_events, LoopMetrics* metrics);
+    void _merge_parts(const std::vector<std::string>& parts, const std::string& oname);
+    long int _loop_threaded(TTreeReader& reader, EvtReader& evt_reader, const SampleCatalog& catalog, const EvtKernel& kernel,
+                            EvtWriter* writer, const long int& n_events, const unsigned int& n_threads,
+                            LoopState* state=nullptr, LoopMetrics* metrics=nullptr);
+    void _write_batch(EvtWriter* writer, const RecBuffer& recs, const unsigned int& n, LoopState* state, StageCounters* counters);
     Channel _get_channel(std::string);
     Year _get_year(std::string);
-    unsigned long long int _get_strat_key(const int& sample, const int& jet_cat, const Channel& channel, const Year& year, const int& region);
     std::vector<std::string> _get_evt_names(const std::map<unsigned long, std::string>&, const std::vector<unsigned long>&);
-    int _jet_cat_lookup(const bool has_b_pair, const bool has_vbf_pair, const bool is_boosted, const int num_btag_loose, const int num_btag_medium);
-    int _region_lookup(const std::string&);
-    void _sample_lookup(std::string& sample, int& sample_id, Spin& spin, float& klambda, float& res_mass, float& cv, float& c2v, float& c3);
-    int _sample2class_lookup(const int&);
-    bool _accept_evt(const int& region, const int& jet_cat, const int& class_id, const float& klambda,
-                     const float& cv, const float& c2v, const float& c3);
+    CutReason _accept_evt(const int& region, const int& jet_cat, const int& class_id, const float& klambda,
+                          const float& cv, const float& c2v, const float& c3);
 
 public:
     // Methods
 	FileLooper(bool return_all=true, std::vector<std::string> requested={}, bool use_deep_bjet_wps=true,
                bool inc_all_jets=true, bool inc_other_regions=false, bool inc_data=false,
-               bool only_kl1=true, bool only_sm_vbf=true);
+               bool only_kl1=true, bool only_sm_vbf=true, OutFormat out_format=out_tree);
 	~FileLooper();
-	bool loop_file(const std::string&, const std::string&, const std::string&, const std::string&, const long int&);
+	bool loop_file(const std::string&, const std::string&, const std::string&, const std::string&, const long int&,
+                   const unsigned int& n_threads=1);
+    bool loop_files(const std::string& in_dir, const std::string& out_dir, const std::vector<std::string>& channels,
+                    const std::vector<std::string>& years, const long int& n_events, const unsigned int& n_threads=1,
+                    const long int& chunk_size=0);
+    bool augment_file(const std::string& in_dir, const std::string& out_dir, const std::string& channel, const std::string& year,
+                      const std::string& tag, const unsigned int& n_threads=1);
     std::map<unsigned, std::string> build_dataset_id_map(TFile* in_file);
     std::map<unsigned, std::string> build_region_id_map(TFile* in_file);
+    void set_kinfit_cache(const std::string& fname);
+    void set_kinfit_scan(const std::string& spec);
+    void set_io_profile(const std::string& profile);
+    void set_storage(const std::string& policy);
+    void set_hists(const std::string& spec);
+    void set_checkpoint(const long int& n_events);
+    void set_folds(const unsigned int& n_folds, const unsigned long long int& seed=0);
+    void set_metrics(const std::string& fname, const double& interval=10);
+    void set_shard(const unsigned int& shard, const unsigned int& n_shards);
+    void set_entry_range(const long int& first, const long int& last);
+    void merge_shards(const std::string& out_dir, const std::string& channel, const std::string& year, const unsigned int& n_shards);
+    static std::string get_shard_name(const std::string& out_dir, const std::string& channel, const std::string& year,
+                                      const unsigned int& shard, const unsigned int& n_shards);
+    static int jet_cat_lookup(const bool has_b_pair, const bool has_vbf_pair, const bool is_boosted, const int num_btag_loose,
+                              const int num_btag_medium);
 };
 
 #endif /* FILE_LOOPER_HH_ */
@@ -0,0 +1,108 @@
+#ifndef KIN_BLOCK_HH_
+#define KIN_BLOCK_HH_
+
+// C++
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+
+// ROOT
+#include <Math/LorentzVector.h>
+#include <Math/PxPyPzM4D.h>
+
+// Plugins
+#include "cms_hh_proc_interface/processing/interface/feat_comp.hh"
+
+// Local
+#include "cms_runII_data_proc/processing/interface/evt_record.hh"
+
+constexpr double E_MASS  = 0.0005109989; //GeV
+constexpr double MU_MASS = 0.1056583715; //GeV
+
+const unsigned int KIN_BLOCK_SIZE = 64;  // Events per block, a multiple of the widest SIMD width
+
+enum KinObject{obj_svfit, obj_l_1, obj_l_2, obj_met, obj_b_1, obj_b_2, obj_vbf_1, obj_vbf_2, n_kin_objects};
+const unsigned int ALL_KIN_OBJECTS = (1U << n_kin_objects)-1;
+const float KIN_SINCOS_MAX = 1e4f;  // Largest |x| given to kin_sincos
+const float KIN_SINH_MAX   = 87.f;  // Largest |x| given to kin_sinh
+
+/*
+Branch-free single-precision sin/cos and sinh (Cephes polynomials), written so that loops over them vectorise; the libm calls
+do not. Accurate to a few ulp for |x| <= KIN_SINCOS_MAX (sincos) and |x| <= KIN_SINH_MAX (sinh). Arguments must be finite and
+within these ranges, since their float to int casts are undefined otherwise; callers mask other values and use libm for them.
+*/
+inline void kin_sincos(const float& x, float& s, float& c) {
+    const float k = (float)(int)(x*0.63661977236758134f + (x >= 0 ? 0.5f : -0.5f));  // Nearest multiple of pi/2
+    const float r = ((x-k*1.5703125f)-k*4.837512969970703125e-4f)-k*7.54978995489188216e-8f;
+    const float z = r*r;
+    const float sr = r+r*z*(-1.6666654611e-1f+z*(8.3321608736e-3f+z*-1.9515295891e-4f));
+    const float cr = 1.f-0.5f*z+z*z*(4.166664568298827e-2f+z*(-1.388731625493765e-3f+z*2.443315711809948e-5f));
+    const int q = (int)k & 3;
+    const float sq = (q & 1) ? cr : sr;
+    const float cq = (q & 1) ? sr : cr;
+    s = (q & 2) ? -sq : sq;
+    c = ((q+1) & 2) ? -cq : cq;
+}
+
+inline float kin_exp(const float& v) {
+    float x = v > 87.f ? 87.f : v;
+    x = x < -87.f ? -87.f : x;
+    const float n = (float)((int)(x*1.44269504088896341f + 128.5f)-128);  // Nearest integer to x/ln(2), offset to round down
+    const float r = (x-n*0.693359375f)+n*2.12194440e-4f;
+    const float p = ((((((1.9875691500e-4f*r+1.3981999507e-3f)*r+8.3333820098e-3f)*r+4.1665795894e-2f)*r+
+                        1.6666665459e-1f)*r+5.0000001201e-1f)*r*r+r+1.f);
+    const int bits = ((int)n+127) << 23;  // 2^n
+    float scale;
+    std::memcpy(&scale, &bits, sizeof(scale));
+    return p*scale;
+}
+
+inline float kin_sinh(const float& x) {
+    const float z = x*x;
+    const float small = ((2.03721912945e-4f*z+8.33028376239e-3f)*z+1.66667160211e-1f)*z*x+x;  // |x| <= 1
+    const float e = kin_exp(x);
+    const float big = 0.5f*(e-1.f/e);
+    return z <= 1.f ? small : big;
+}
+
+class KinBlock {
+	/*
+    Structure-of-arrays kinematics for a block of events: the (pT, eta, phi, m) of the eight physics objects are gathered
+    into one array per coordinate and object, and converted to (px, py, pz, m) in a single vectorised pass, rather than
+    through a PtEtaPhiM4D vector per object and event. The light-lepton mass of l_1 is fixed by channel when loading; the
+    channel is a template parameter in the event loop, where it is constant for the whole file.
+    The vectorised sin, cos, and sinh are not libm's, so the vectors differ from the PtEtaPhiM4D ones by up to ~4e-7 of
+    their momentum, and every feature computed from them can differ from outputs of the libm path in the last float bits.
+    */
+
+private:
+	// Names
+	using LorentzVector = ROOT::Math::LorentzVector<ROOT::Math::PxPyPzM4D<float>>;
+
+	// Variables
+    unsigned int _n;
+    alignas(64) float _pt[n_kin_objects][KIN_BLOCK_SIZE];
+    alignas(64) float _eta[n_kin_objects][KIN_BLOCK_SIZE];
+    alignas(64) float _phi[n_kin_objects][KIN_BLOCK_SIZE];
+    alignas(64) float _m[n_kin_objects][KIN_BLOCK_SIZE];
+    alignas(64) float _px[n_kin_objects][KIN_BLOCK_SIZE];
+    alignas(64) float _py[n_kin_objects][KIN_BLOCK_SIZE];
+    alignas(64) float _pz[n_kin_objects][KIN_BLOCK_SIZE];
+
+public:
+    // Methods
+    KinBlock();
+    ~KinBlock();
+    template <Channel C>
+    void load(const EvtInput* evts, const unsigned int& n);
+    void load(const EvtInput* evts, const unsigned int& n, const Channel& channel);
+    void convert(const unsigned int& objects=ALL_KIN_OBJECTS);
+    unsigned int size() const { return _n; }
+    void get(const KinObject& obj, const unsigned int& i, LorentzVector& v) const {
+        v.SetCoordinates(_px[obj][i], _py[obj][i], _pz[obj][i], _m[obj][i]);
+    }
+};
+
+#endif /* KIN_BLOCK_HH_ */
@@ -0,0 +1,61 @@
+#ifndef KINFIT_CACHE_HH_
+#define KINFIT_CACHE_HH_
+
+// C++
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <utility>
+#include <mutex>
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+
+// ROOT
+#include <TFile.h>
+#include <TTree.h>
+#include <TSystem.h>
+
+// Local
+#include "cms_runII_data_proc/processing/interface/kinfitter.hh"
+
+// Version of the fit results, stored with the cache; bump whenever a change to KinFitter or HHKinFit2 may change any result
+const std::string KINFIT_CACHE_VERSION = "2";  // 2: inputs failing the MET covariance and visible-mass checks give NaN
+
+class KinFitCache {
+	/*
+    Persistent store of KinFit results keyed by a 64-bit hash of the 21 fit inputs and the (mh1, mh2) hypothesis.
+    Results are loaded from a sidecar ROOT file on construction and written back, including new entries, by save(). A
+    sidecar of another version of the fit is discarded. Lookups and insertions are thread safe, and processes sharing a
+    sidecar serialise their saves on a lock file, each merging in the results the others saved first.
+    */
+
+private:
+	// Variables
+    std::string _fname;
+    std::unordered_map<unsigned long long int, std::pair<float,float>> _results;
+    unsigned long int _n_loaded;
+    std::atomic<unsigned long int> _n_hits, _n_misses;
+    std::mutex _mutex;
+
+	// Methods
+    unsigned long int _read(const bool& verbose);
+    void _write();
+    static std::string _get_title();
+
+public:
+    // Methods
+    KinFitCache(const std::string& fname);
+    ~KinFitCache();
+    static unsigned long long int get_key(const KinFitInput& input, const int& mh1, const int& mh2);
+    bool get(const unsigned long long int& key, std::pair<float,float>& result);
+    void add(const unsigned long long int& key, const std::pair<float,float>& result);
+    void save();
+    void print_summary();
+};
+
+#endif /* KINFIT_CACHE_HH_ */
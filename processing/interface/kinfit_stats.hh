@@ -0,0 +1,30 @@
+#ifndef KINFIT_STATS_HH_
+#define KINFIT_STATS_HH_
+
+// C++
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <array>
+
+// Local
+#include "cms_runII_data_proc/processing/interface/kinfitter.hh"
+
+class KinFitStats {
+	/* Counts of KinFit outcomes per sample. Each thread fills its own instance; instances are merged at the end of the loop. */
+
+private:
+	// Variables
+    std::map<int, std::array<unsigned long int, n_kinfit_status>> _counts;
+
+public:
+    // Methods
+    KinFitStats();
+    ~KinFitStats();
+    void add(const int& sample, const KinFitStatus& status);
+    void merge(const KinFitStats& other);
+    void clear();
+    void print_summary() const;
+};
+
+#endif /* KINFIT_STATS_HH_ */
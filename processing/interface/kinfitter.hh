@@ -9,6 +9,9 @@
 #include <set>
 #include <stdexcept>
 #include <utility>
+#include <algorithm>
+#include <cmath>
+#include <sstream>
 
 // ROOT
 #include <Math/VectorUtil.h>
@@ -22,9 +25,39 @@
 #include <TLorentzVector.h>
 #include <TMatrixD.h>
 
+// Local
+#include "cms_runII_data_proc/processing/interface/logger.hh"
+
 const int Z_MASS  = 91;  //GeV
 const int H_MASS  = 125; //GeV
 
+enum KinFitStatus{kinfit_ok, kinfit_bad_input, kinfit_degenerate_cov, kinfit_vis_mass, kinfit_inv_mass_exc, kinfit_energy_range_exc,
+                  kinfit_energy_constraint_exc, n_kinfit_status};
+
+struct KinFitInput {
+    // Fixed-size inputs to KinFit, laid out in the same order as kinINinfo: (pT, eta, phi, mass) of l1, l2, b1, b2, then MET and its covariance
+    float l_1_pT, l_1_eta, l_1_phi, l_1_mass;
+    float l_2_pT, l_2_eta, l_2_phi, l_2_mass;
+    float b_1_pT, b_1_eta, b_1_phi, b_1_mass;
+    float b_2_pT, b_2_eta, b_2_phi, b_2_mass;
+    float met_pT, met_phi, met_cov_00, met_cov_01, met_cov_11;
+};
+static_assert(sizeof(KinFitInput) == 21*sizeof(float), "KinFitInput must be 21 packed floats");
+
+struct KinFitBlock {
+    // Results of fitting a block of events to a list of hypotheses, stored hypothesis-major: [i_hypo*n_evts + i_evt]
+    unsigned int n_evts, n_hypos;
+    std::vector<float> mass, chi2;
+};
+
+struct KinFitGrid {
+    // Hypotheses of a KinFit scan: every (mh1, mh2) combination of the two mass lists, in mh1-major order
+    std::vector<int> mh1, mh2;
+
+    unsigned int size() const { return mh1.size()*mh2.size(); }
+    std::pair<int,int> get(const unsigned int& i) const { return std::pair<int,int>(mh1[i/mh2.size()], mh2[i%mh2.size()]); }
+};
+
 class KinFitter {
     // class to calculate KinFit mass of a particle given a mass hypothesis and its decay products
 private:
@@ -38,11 +71,29 @@ private:
     TMatrixD metcov = TMatrixD(2,2);
 
     std::pair<float,float> _fit(int mh1_hp, int mh2_hp);
+    std::pair<float,float> _fit(int mh1_hp, int mh2_hp, KinFitStatus& status);
+    KinFitStatus _prevalidate(int mh1_hp, int mh2_hp);
+    KinFitStatus _prevalidate_input();
+    void _scan_run(const KinFitGrid& grid, const std::vector<unsigned int>& hypos, const unsigned int& first, const unsigned int& last,
+                   float* mass, float* chi2, KinFitStatus* status);
+    std::string _describe() const;
 
 public:
+    KinFitter();
     KinFitter(std::vector<float> kinINinfo);
+    KinFitter(const KinFitInput& input);
     ~KinFitter();
+    void set_input(const KinFitInput& input);
     std::pair<float,float> fit(std::string sgnHp);
+    std::vector<std::pair<float,float>> fit_hypos(const std::vector<std::pair<int,int>>& hypos);
+    std::vector<std::pair<float,float>> fit_hypos(const std::vector<std::pair<int,int>>& hypos, std::vector<KinFitStatus>& status);
+    void scan(const KinFitGrid& grid, float* mass, float* chi2, KinFitStatus* status);
+    static KinFitBlock fit_block(const std::vector<KinFitInput>& inputs, const std::vector<std::pair<int,int>>& hypos);
+    static std::pair<int,int> get_hypo_masses(const std::string& sgnHp);
+    static KinFitGrid parse_grid(const std::string& spec);
+    static std::string describe_grid(const KinFitGrid& grid);
+    static std::string get_status_name(const KinFitStatus& status);
+    static std::pair<float,float> pick_ordering(const std::pair<float,float>& right_fit, const std::pair<float,float>& left_fit);
 };
 
 #endif /* KINFITTER_H_ */
\ No newline at end of file
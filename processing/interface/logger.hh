@@ -0,0 +1,115 @@
+#ifndef LOGGER_HH_
+#define LOGGER_HH_
+
+// C++
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <cstring>
+#include <algorithm>
+#include <stdexcept>
+
+enum LogLevel{log_debug, log_info, log_warning, log_error, n_log_levels};
+
+const unsigned int LOG_BUFFER_SIZE = 4096;  // Slots in the ring buffer, must be a power of two
+const unsigned int LOG_MSG_SIZE    = 512;   // Longer messages are truncated
+
+struct LogSlot {
+    std::atomic<unsigned long long int> seq;
+    LogLevel level;
+    char msg[LOG_MSG_SIZE];
+};
+
+class LogLimit {
+	/*
+    Per-message rate limit: allows at most max_per_s messages in each one-second window and counts the rest, so that the next
+    allowed message can report how many were suppressed. Lock free; small races at the window edge only shift a message or two
+    */
+
+private:
+	// Variables
+    unsigned int _max_per_s;
+    std::atomic<long long int> _window;
+    std::atomic<unsigned int> _count;
+    std::atomic<unsigned long int> _suppressed;
+
+public:
+    // Methods
+    LogLimit(const unsigned int& max_per_s) : _max_per_s(max_per_s), _window(-1), _count(0), _suppressed(0) {}
+    bool allow(unsigned long int& n_suppressed) {
+        long long int now = std::chrono::duration_cast<std::chrono::seconds>(
+                                std::chrono::steady_clock::now().time_since_epoch()).count();
+        long long int window = _window.load(std::memory_order_relaxed);
+        if (window != now && _window.compare_exchange_strong(window, now, std::memory_order_relaxed)) {
+            _count.store(0, std::memory_order_relaxed);
+        }
+        if (_count.fetch_add(1, std::memory_order_relaxed) < _max_per_s) {
+            n_suppressed = _suppressed.exchange(0, std::memory_order_relaxed);
+            return true;
+        }
+        _suppressed.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+};
+
+class Logger {
+	/*
+    Process-wide diagnostic log. Messages are copied into a bounded lock-free ring buffer (multi-producer, single-consumer) and
+    written to stdout by a background thread, so logging from the event loop never blocks on terminal or file I/O. If the buffer
+    is full the message is dropped and counted instead of waiting.
+    */
+
+private:
+	// Variables
+    std::array<LogSlot, LOG_BUFFER_SIZE> _slots;
+    std::atomic<unsigned long long int> _head, _n_written, _n_dropped;
+    unsigned long long int _tail;
+    std::atomic<int> _level;
+    std::atomic<bool> _stop;
+    std::thread _thread;
+
+	// Methods
+    Logger();
+    ~Logger();
+    void _run();
+    bool _drain();
+
+public:
+    // Methods
+    static Logger& get();
+    bool is_enabled(const LogLevel& level) const { return level >= _level.load(std::memory_order_relaxed); }
+    void set_level(const LogLevel& level);
+    void log(const LogLevel& level, const std::string& msg);
+    void flush();
+    static LogLevel get_level(const std::string& level);
+    static std::string get_level_name(const LogLevel& level);
+};
+
+// Stream msg into the log if level is enabled; nothing, including the formatting, is evaluated otherwise
+#define LOG_MSG(level, msg) do { \
+    if (Logger::get().is_enabled(level)) { \
+        std::ostringstream log_ss_; \
+        log_ss_ << msg; \
+        Logger::get().log(level, log_ss_.str()); \
+    } \
+} while (false)
+
+// As LOG_MSG, but each call site logs at most max_per_s messages per second
+#define LOG_LIMITED(level, max_per_s, msg) do { \
+    if (Logger::get().is_enabled(level)) { \
+        static LogLimit log_limit_(max_per_s); \
+        unsigned long int log_n_suppressed_; \
+        if (log_limit_.allow(log_n_suppressed_)) { \
+            std::ostringstream log_ss_; \
+            log_ss_ << msg; \
+            if (log_n_suppressed_ > 0) log_ss_ << " (" << log_n_suppressed_ << " similar messages suppressed)"; \
+            Logger::get().log(level, log_ss_.str()); \
+        } \
+    } \
+} while (false)
+
+#endif /* LOGGER_HH_ */
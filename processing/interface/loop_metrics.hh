@@ -0,0 +1,109 @@
+#ifndef LOOP_METRICS_HH_
+#define LOOP_METRICS_HH_
+
+// C++
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <array>
+#include <memory>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <stdexcept>
+
+enum LoopStage{stage_select_pass, stage_read_meta, stage_select, stage_read_feats, stage_convert, stage_kinfit, stage_process, stage_write,
+                n_loop_stages};
+
+struct StageCounters {
+    /*
+    Time, calls, and records handled per stage for one thread; a call may handle several records, e.g. a batch written as
+    one block. Only the owning thread adds to them, so relaxed loads and stores are enough for the metrics thread to read
+    them without a lock
+    */
+
+    std::array<std::atomic<unsigned long long int>, n_loop_stages> ns, calls, records;
+
+    StageCounters() {
+        for (unsigned int s = 0; s < n_loop_stages; s++) {
+            ns[s].store(0, std::memory_order_relaxed);
+            calls[s].store(0, std::memory_order_relaxed);
+            records[s].store(0, std::memory_order_relaxed);
+        }
+    }
+    void add(const LoopStage& stage, const unsigned long long int& dt, const unsigned long long int& n=1) {
+        ns[stage].store(ns[stage].load(std::memory_order_relaxed)+dt, std::memory_order_relaxed);
+        calls[stage].store(calls[stage].load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+        records[stage].store(records[stage].load(std::memory_order_relaxed)+n, std::memory_order_relaxed);
+    }
+};
+
+class StageTimer {
+	/*
+    Adds the time between construction and destruction to a stage, as one call handling n records. Does nothing, not even
+    reading the clock, if counters is null
+    */
+
+private:
+	// Variables
+    StageCounters* _counters;
+    LoopStage _stage;
+    unsigned long long int _n;
+    std::chrono::steady_clock::time_point _start;
+
+public:
+    // Methods
+    StageTimer(StageCounters* counters, const LoopStage& stage, const unsigned long long int& n=1)
+        : _counters(counters), _stage(stage), _n(n) {
+        if (_counters != nullptr) _start = std::chrono::steady_clock::now();
+    }
+    ~StageTimer() {
+        if (_counters != nullptr) {
+            _counters->add(_stage, std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now()-_start).count(),
+                           _n);
+        }
+    }
+};
+
+class LoopMetrics {
+	/*
+    Collects the stage counters of every thread of a loop, together with the bytes read and written, and writes them as JSON
+    to a file every interval seconds from a background thread, and once more at the end with "final": true
+    */
+
+private:
+	// Variables
+    std::string _fname, _label;
+    double _interval;
+    std::chrono::steady_clock::time_point _start;
+    std::vector<std::unique_ptr<StageCounters>> _counters;
+    std::atomic<long long int> _bytes_read, _bytes_written;
+    long long int _bytes_read_0, _bytes_written_0;
+    std::mutex _mutex;
+    std::condition_variable _cv;
+    bool _stop;
+    std::thread _thread;
+
+	// Methods
+    void _run();
+    void _write(const bool& final);
+    std::string _to_json(const bool& final);
+
+public:
+    // Methods
+    LoopMetrics(const std::string& fname, const std::string& label, const double& interval,
+                const long long int& bytes_read, const long long int& bytes_written);
+    ~LoopMetrics();
+    StageCounters* new_counters();
+    void set_bytes(const long long int& bytes_read, const long long int& bytes_written);
+    void finish();
+    static std::string get_stage_name(const LoopStage& stage);
+};
+
+#endif /* LOOP_METRICS_HH_ */
@@ -0,0 +1,63 @@
+#ifndef SAMPLE_CATALOG_HH_
+#define SAMPLE_CATALOG_HH_
+
+// C++
+#include <string>
+#include <map>
+#include <vector>
+#include <unordered_map>
+#include <stdexcept>
+
+// Plugins
+#include "cms_hh_proc_interface/processing/interface/feat_comp.hh"
+
+extern int use_kl;
+
+enum SampleParam{no_param, kl_param, res_mass_param, vbf_coupling_param};
+
+struct SampleRule {
+    /* Dataset names containing all of the required substrings are assigned the rule's sample ID; the first matching rule wins */
+
+    std::vector<std::string> required;
+    int sample_id;
+    Spin spin;
+    SampleParam param;               // Parameters to parse from the dataset name
+    std::vector<int> mass_bin_ids;   // For resonant samples: IDs for res_mass <= 400, <= 600, and > 600 GeV
+};
+
+struct SampleInfo {
+    /* Everything derived from a dataset name */
+
+    int sample_id, class_id;
+    Spin spin;
+    float klambda, res_mass, cv, c2v, c3;
+    std::string error;  // Non-empty if the name could not be resolved
+};
+
+class SampleCatalog {
+	/*
+    Resolves every dataset and region hash listed in the aux tree once, so that the per-event lookup is a single
+    hash-table probe into dense tables. Names which cannot be resolved only raise an error if an event uses them.
+    */
+
+private:
+	// Variables
+    std::vector<SampleInfo> _samples;
+    std::vector<int> _regions;
+    std::vector<std::string> _region_errors;
+    std::unordered_map<unsigned, unsigned> _dataset_idx, _region_idx;
+
+public:
+    // Methods
+    SampleCatalog();
+    SampleCatalog(const std::map<unsigned, std::string>& id2dataset, const std::map<unsigned, std::string>& id2region);
+    ~SampleCatalog();
+    const SampleInfo& get_sample(const unsigned& dataset_id) const;
+    int get_region(const unsigned& region_id) const;
+    static SampleInfo resolve_sample(const std::string& sample);
+    static int resolve_region(const std::string& region);
+    static int get_class_id(const int& sample_id);
+    static const std::vector<SampleRule>& get_rules();
+};
+
+#endif /* SAMPLE_CATALOG_HH_ */
@@ -0,0 +1,106 @@
+#ifndef STORAGE_POLICY_HH_
+#define STORAGE_POLICY_HH_
+
+// C++
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <fnmatch.h>
+
+enum ColumnType{col_f32, col_trunc, col_f16, col_i32, col_i16, col_i8};
+
+struct ColumnStorage {
+    /* How one output column is stored. bits is the number of mantissa bits kept by col_trunc and col_f16 */
+
+    ColumnType type;
+    unsigned int bits;
+};
+
+inline float truncate_mantissa(const float& x, const unsigned int& bits) {
+    /* Round x to the nearest float with only the top bits of its 23 mantissa bits set, ties to even */
+
+    if (bits >= 23) return x;
+    uint32_t u;
+    std::memcpy(&u, &x, sizeof(u));
+    if ((u & 0x7f800000U) == 0x7f800000U) return x;  // Inf and NaN
+    const uint32_t drop = 23-bits;
+    u += (1U << (drop-1))-1+((u >> drop) & 1U);
+    u &= ~((1U << drop)-1);
+    float r;
+    std::memcpy(&r, &u, sizeof(r));
+    return r;
+}
+
+class StoragePolicy {
+	/*
+    Per-column storage of the output: a list of pattern=type rules, matched against column names with shell wildcards, where
+    the last matching rule wins. Float columns may be f32 (default), trunc:N, stored as floats rounded to N mantissa bits so
+    that they compress better, or f16:N, ROOT's Float16_t with N mantissa bits (3 bytes). Integer columns may be i32 (default),
+    i16, or i8. Wildcard rules only apply to columns of their kind; a rule naming a column of the other kind is an error.
+    */
+
+private:
+    struct Rule {
+        std::string pattern;
+        ColumnStorage storage;
+    };
+
+	// Variables
+    std::string _spec;
+    std::vector<Rule> _rules;
+
+	// Methods
+    ColumnStorage _get(const std::string& column, const bool& is_float) const;
+
+public:
+    // Methods
+    StoragePolicy(const std::string& spec="full");
+    ColumnStorage get_float(const std::string& column) const { return StoragePolicy::_get(column, true); }
+    ColumnStorage get_int(const std::string& column) const { return StoragePolicy::_get(column, false); }
+    bool is_full() const { return _rules.empty(); }
+    const std::string& get_spec() const { return _spec; }
+    static std::string get_leaflist(const std::string& column, const ColumnStorage& storage, const unsigned int& size=0);
+    static const std::map<std::string, std::string>& get_presets();
+    static const std::vector<std::string>& get_int_columns();
+};
+
+class PackedColumns {
+	/*
+    Columns of a record bound to a tree which are stored narrower than in the record: float columns are rounded in place, and
+    integer columns are copied to 8- or 16-bit fields, which their branches are bound to instead. pack() is called before
+    each fill
+    */
+
+private:
+    struct Trunc {
+        float* vals;
+        unsigned int n, bits;
+    };
+    struct Narrow {
+        const int* val;
+        ColumnType type;
+        std::string name;
+        int8_t i8;
+        int16_t i16;
+    };
+
+	// Variables
+    std::vector<Trunc> _trunc;
+    std::deque<Narrow> _narrow;  // Stable addresses, since branches are bound to them
+
+public:
+    // Methods
+    PackedColumns() {}
+    PackedColumns(const PackedColumns&) = delete;
+    PackedColumns& operator=(const PackedColumns&) = delete;
+    void add_trunc(float* vals, const unsigned int& n, const unsigned int& bits) { _trunc.push_back({vals, n, bits}); }
+    void* add_narrow(const int* val, const ColumnType& type, const std::string& name);
+    void pack();
+};
+
+#endif /* STORAGE_POLICY_HH_ */
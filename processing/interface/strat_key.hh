@@ -0,0 +1,92 @@
+#ifndef STRAT_KEY_HH_
+#define STRAT_KEY_HH_
+
+// C++
+#include <string>
+#include <vector>
+#include <map>
+#include <stdexcept>
+
+// ROOT
+#include <TDirectory.h>
+#include <TTree.h>
+
+// Plugins
+#include "cms_hh_proc_interface/processing/interface/feat_comp.hh"
+
+// Bit layout of the stratification key, from the least significant bit: sample, jet_cat, channel, year, region
+const unsigned int STRAT_SAMPLE_BITS  = 8;
+const unsigned int STRAT_JET_CAT_BITS = 4;
+const unsigned int STRAT_CHANNEL_BITS = 2;
+const unsigned int STRAT_YEAR_BITS    = 2;
+const unsigned int STRAT_REGION_BITS  = 4;
+const int STRAT_SAMPLE_OFFSET = 1 << (STRAT_SAMPLE_BITS-1);  // Sample IDs are negative for signal
+static_assert(STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS+STRAT_CHANNEL_BITS+STRAT_YEAR_BITS+STRAT_REGION_BITS <= 32,
+              "Strat key must fit in 32 bits");
+
+struct StratKey {
+    /* Decoded stratification key. Each field occupies its own bits of the key, so encoding is exact and cannot overflow */
+
+    int sample, jet_cat;
+    Channel channel;
+    Year year;
+    int region;
+
+    static unsigned int encode(const int& sample, const int& jet_cat, const Channel& channel, const Year& year, const int& region) {
+        unsigned int s = sample+STRAT_SAMPLE_OFFSET;
+        if (s >= (1U << STRAT_SAMPLE_BITS) || (unsigned int)jet_cat >= (1U << STRAT_JET_CAT_BITS) ||
+            (unsigned int)region >= (1U << STRAT_REGION_BITS)) {
+            throw std::out_of_range("Strat key field out of range: sample " + std::to_string(sample) + " jet_cat " +
+                                    std::to_string(jet_cat) + " region " + std::to_string(region));
+        }
+        return s |
+               (unsigned int)jet_cat << STRAT_SAMPLE_BITS |
+               (unsigned int)channel << (STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS) |
+               (unsigned int)year    << (STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS+STRAT_CHANNEL_BITS) |
+               (unsigned int)region  << (STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS+STRAT_CHANNEL_BITS+STRAT_YEAR_BITS);
+    }
+
+    static StratKey decode(const unsigned int& key) {
+        auto field = [&key](const unsigned int& shift, const unsigned int& bits) { return (key >> shift) & ((1U << bits)-1); };
+        StratKey k;
+        k.sample  = (int)field(0, STRAT_SAMPLE_BITS)-STRAT_SAMPLE_OFFSET;
+        k.jet_cat = field(STRAT_SAMPLE_BITS, STRAT_JET_CAT_BITS);
+        k.channel = Channel(field(STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS, STRAT_CHANNEL_BITS));
+        k.year    = Year(field(STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS+STRAT_CHANNEL_BITS, STRAT_YEAR_BITS));
+        k.region  = field(STRAT_SAMPLE_BITS+STRAT_JET_CAT_BITS+STRAT_CHANNEL_BITS+STRAT_YEAR_BITS, STRAT_REGION_BITS);
+        return k;
+    }
+};
+
+class StratIndex {
+	/*
+    Entry ranges of every stratum in each fold of an output, built as entries are written, so that stratified samplers can draw
+    from a stratum without scanning the file. Consecutive entries of the same stratum are merged into a single range.
+    Stored as the strat_index tree: one entry per (fold, strat_key), with the decoded key, the number of entries, and the
+    ranges as range_first/range_n arrays.
+    */
+
+private:
+    struct Ranges {
+        long long int n_entries;
+        std::vector<long long int> first, n;
+    };
+
+	// Variables
+    std::vector<long long int> _n_filled;
+    std::vector<std::map<unsigned int, Ranges>> _folds;
+
+	// Methods
+    void _add_range(const unsigned int& fold, const unsigned int& key, const long long int& first, const long long int& n);
+
+public:
+    // Methods
+    StratIndex(const unsigned int& n_folds=2);
+    ~StratIndex();
+    void add(const unsigned int& fold, const unsigned int& key) { _add_range(fold, key, _n_filled[fold]++, 1); }
+    void append(const StratIndex& other);
+    TTree* make_tree() const;
+    static StratIndex read(TDirectory* dir);
+};
+
+#endif /* STRAT_KEY_HH_ */
@@ -0,0 +1,66 @@
+#ifndef SYNTH_INPUT_HH_
+#define SYNTH_INPUT_HH_
+
+// C++
+#include <iostream>
+#include <string>
+#include <map>
+#include <vector>
+#include <utility>
+#include <sstream>
+#include <stdexcept>
+#include <cmath>
+
+// ROOT
+#include <Math/LorentzVector.h>
+#include <Math/PtEtaPhiM4D.h>
+#include <TFile.h>
+#include <TTree.h>
+#include <TRandom3.h>
+
+// Local
+#include "cms_runII_data_proc/processing/interface/evt_reader.hh"
+#include "cms_runII_data_proc/processing/interface/sample_catalog.hh"
+
+struct SynthConfig {
+    /* Sample mix and kinematic settings of a synthetic input file */
+
+    std::vector<std::pair<std::string, double>> samples;  // Dataset name and relative abundance
+    std::vector<std::pair<std::string, double>> regions;  // Region name and relative abundance
+    std::map<std::string, double> kinematics;             // See SynthInput::get_default_config for the keys
+    unsigned int seed;
+};
+
+class SynthInput {
+	/*
+    Writes a {year}_{channel}_Central.root-like file for benchmarking without access to the anaTuples: the channel tree
+    with every branch bound by EvtReader, in the same types, and the aux tree listing the dataset and region hashes.
+    Kinematics are drawn from simple parametric shapes above the channel trigger thresholds; they are realistic enough
+    to exercise KinFit, SVfit-based features and the selection, not to reproduce physics distributions.
+    */
+
+private:
+	// Names
+	using LorentzVectorPEP = ROOT::Math::LorentzVector<ROOT::Math::PtEtaPhiM4D<float>>;
+
+	// Variables
+    SynthConfig _config;
+    TRandom3 _rng;
+
+	// Methods
+    unsigned int _pick(const std::vector<std::pair<std::string, double>>& mix);
+    LorentzVectorPEP _draw_object(const float& pt_min, const float& pt_mean, const float& eta_max, const float& mass,
+                                  const float& mass_width);
+
+public:
+    // Methods
+    SynthInput(const SynthConfig& config);
+    ~SynthInput();
+    void write(const std::string& fname, const std::string& channel, const long int& n_events);
+    static SynthConfig get_default_config();
+    static std::vector<std::pair<std::string, double>> parse_mix(const std::string& mix);
+    static void parse_kinematics(const std::string& settings, SynthConfig& config);
+    static unsigned get_hash(const std::string& name);
+};
+
+#endif /* SYNTH_INPUT_HH_ */
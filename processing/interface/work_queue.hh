@@ -0,0 +1,58 @@
+#ifndef WORK_QUEUE_HH_
+#define WORK_QUEUE_HH_
+
+// C++
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+
+template <typename T>
+class WorkQueue {
+	/* Bounded blocking FIFO used to pass work between threads. Once closed, pushes fail and pops drain what is left. */
+
+private:
+	// Variables
+    std::deque<T> _items;
+    size_t _capacity;
+    bool _closed;
+    std::mutex _mutex;
+    std::condition_variable _not_empty, _not_full;
+
+public:
+    // Methods
+    WorkQueue(size_t capacity) : _capacity(capacity), _closed(false) {}
+
+    bool push(T item) {
+        /* Blocks while the queue is full, returns false if the queue was closed */
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+        if (_closed) return false;
+        _items.push_back(std::move(item));
+        lock.unlock();
+        _not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        /* Blocks while the queue is empty, returns false once closed and drained */
+
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+        if (_items.empty()) return false;
+        item = std::move(_items.front());
+        _items.pop_front();
+        lock.unlock();
+        _not_full.notify_one();
+        return true;
+    }
+
+    void close() {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+};
+
+#endif /* WORK_QUEUE_HH_ */
@@ -0,0 +1,174 @@
+#include "cms_runII_data_proc/processing/interface/cutflow.hh"
+
+Cutflow::Cutflow() {}
+
+Cutflow::~Cutflow() {}
+
+void Cutflow::add(const CutReason& reason, const float& weight, const int& sample, const int& region, const int& jet_cat,
+                  const int& class_id) {
+    _cuts[reason].add(weight);
+    CatSums& cat = _cats[{sample, region, jet_cat, class_id}];
+    cat.all.add(weight);
+    if (reason == cut_pass) cat.selected.add(weight);
+}
+
+void Cutflow::merge(const Cutflow& other) {
+    for (unsigned int r = 0; r < n_cut_reasons; r++) _cuts[r].merge(other._cuts[r]);
+    for (const auto& c : other._cats) {
+        CatSums& cat = _cats[c.first];
+        cat.all.merge(c.second.all);
+        cat.selected.merge(c.second.selected);
+    }
+}
+
+void Cutflow::clear() {
+    _cuts.fill(Sums());
+    _cats.clear();
+}
+
+void Cutflow::print_summary() const {
+    /* Events remaining after each cut, and the number and summed weight removed by it */
+
+    if (Cutflow::empty()) return;
+    long long int n_left(0);
+    double sumw_left(0);
+    for (const Sums& s : _cuts) {
+        n_left += s.n;
+        sumw_left += s.sumw;
+    }
+    std::cout << "Cutflow:\n";
+    std::cout << std::setw(16) << "cut" << std::setw(14) << "removed" << std::setw(16) << "sumw removed" << std::setw(14) << "remaining"
+              << std::setw(16) << "sumw remaining" << "\n";
+    std::cout << std::setw(16) << "all" << std::setw(14) << "" << std::setw(16) << "" << std::setw(14) << n_left
+              << std::setw(16) << sumw_left << "\n";
+    for (unsigned int r = 0; r < cut_pass; r++) {
+        n_left -= _cuts[r].n;
+        sumw_left -= _cuts[r].sumw;
+        std::cout << std::setw(16) << Cutflow::get_reason_name(CutReason(r)) << std::setw(14) << _cuts[r].n
+                  << std::setw(16) << _cuts[r].sumw << std::setw(14) << n_left << std::setw(16) << sumw_left << "\n";
+    }
+}
+
+void Cutflow::write(TDirectory* dir) const {
+    /*
+    Write the cutflow tree, one entry per cut in order plus the passing events, and the sumw tree, one entry per
+    (sample, region, jet_cat, class_id), to dir, replacing any existing ones
+    */
+
+    TDirectory::TContext ctx(dir);
+    {
+        TTree* tree = new TTree("cutflow", "Events rejected by each selection cut, in order, and passing all cuts");
+        std::string cut;
+        int step;
+        long long int n;
+        double sumw, sumw2;
+        tree->Branch("cut",   &cut);
+        tree->Branch("step",  &step);
+        tree->Branch("n",     &n);
+        tree->Branch("sumw",  &sumw);
+        tree->Branch("sumw2", &sumw2);
+        for (step = 0; step < n_cut_reasons; step++) {
+            cut   = Cutflow::get_reason_name(CutReason(step));
+            n     = _cuts[step].n;
+            sumw  = _cuts[step].sumw;
+            sumw2 = _cuts[step].sumw2;
+            tree->Fill();
+        }
+        tree->Write("", TObject::kOverwrite);
+        delete tree;
+    }
+    {
+        TTree* tree = new TTree("sumw", "Number and sums of weights of all and selected events per category");
+        int sample, region, jet_cat, class_id;
+        long long int n_all, n_sel;
+        double sumw_all, sumw2_all, sumw_sel, sumw2_sel;
+        tree->Branch("sample",    &sample);
+        tree->Branch("region",    &region);
+        tree->Branch("jet_cat",   &jet_cat);
+        tree->Branch("class_id",  &class_id);
+        tree->Branch("n_all",     &n_all);
+        tree->Branch("sumw_all",  &sumw_all);
+        tree->Branch("sumw2_all", &sumw2_all);
+        tree->Branch("n_sel",     &n_sel);
+        tree->Branch("sumw_sel",  &sumw_sel);
+        tree->Branch("sumw2_sel", &sumw2_sel);
+        for (const auto& c : _cats) {
+            sample    = c.first[0];
+            region    = c.first[1];
+            jet_cat   = c.first[2];
+            class_id  = c.first[3];
+            n_all     = c.second.all.n;
+            sumw_all  = c.second.all.sumw;
+            sumw2_all = c.second.all.sumw2;
+            n_sel     = c.second.selected.n;
+            sumw_sel  = c.second.selected.sumw;
+            sumw2_sel = c.second.selected.sumw2;
+            tree->Fill();
+        }
+        tree->Write("", TObject::kOverwrite);
+        delete tree;
+    }
+}
+
+Cutflow Cutflow::read(TDirectory* dir) {
+    /* Load the cutflow and sumw trees of dir */
+
+    Cutflow cutflow;
+    TTree* tree = nullptr;
+    dir->GetObject("cutflow", tree);
+    if (tree == nullptr) throw std::runtime_error("No cutflow tree in " + std::string(dir->GetName()));
+    int step;
+    long long int n;
+    double sumw, sumw2;
+    tree->SetBranchAddress("step",  &step);
+    tree->SetBranchAddress("n",     &n);
+    tree->SetBranchAddress("sumw",  &sumw);
+    tree->SetBranchAddress("sumw2", &sumw2);
+    for (long long int i = 0; i < tree->GetEntries(); i++) {
+        tree->GetEntry(i);
+        if (step < 0 || step >= n_cut_reasons) throw std::runtime_error("Invalid cutflow step " + std::to_string(step));
+        Sums& s = cutflow._cuts[step];
+        s.n     += n;
+        s.sumw  += sumw;
+        s.sumw2 += sumw2;
+    }
+    delete tree;
+
+    tree = nullptr;
+    dir->GetObject("sumw", tree);
+    if (tree == nullptr) throw std::runtime_error("No sumw tree in " + std::string(dir->GetName()));
+    CatKey key;
+    Sums all, selected;
+    tree->SetBranchAddress("sample",    &key[0]);
+    tree->SetBranchAddress("region",    &key[1]);
+    tree->SetBranchAddress("jet_cat",   &key[2]);
+    tree->SetBranchAddress("class_id",  &key[3]);
+    tree->SetBranchAddress("n_all",     &all.n);
+    tree->SetBranchAddress("sumw_all",  &all.sumw);
+    tree->SetBranchAddress("sumw2_all", &all.sumw2);
+    tree->SetBranchAddress("n_sel",     &selected.n);
+    tree->SetBranchAddress("sumw_sel",  &selected.sumw);
+    tree->SetBranchAddress("sumw2_sel", &selected.sumw2);
+    for (long long int i = 0; i < tree->GetEntries(); i++) {
+        tree->GetEntry(i);
+        CatSums& cat = cutflow._cats[key];
+        cat.all.merge(all);
+        cat.selected.merge(selected);
+    }
+    delete tree;
+    return cutflow;
+}
+
+std::string Cutflow::get_reason_name(const CutReason& reason) {
+    switch (reason) {
+        case cut_klambda:     return "klambda";
+        case cut_data:        return "data";
+        case cut_region:      return "region";
+        case cut_jet_cat:     return "jet_cat";
+        case cut_exp_jet_cat: return "exp_jet_cat";
+        case cut_non_sm_vbf:  return "non_sm_vbf";
+        case cut_sample:      return "sample";
+        case cut_pass:        return "pass";
+        default:              throw std::invalid_argument("Invalid cut " + std::to_string(reason));
+    }
+}
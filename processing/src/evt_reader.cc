@@ -0,0 +1,189 @@
+#include "cms_runII_data_proc/processing/interface/evt_reader.hh"
+
+EvtReader::EvtReader(TTreeReader& reader, const unsigned int& groups) :
+    _rv_evt(reader, "evt"),
+    _rv_weight(reader, "weight"),
+    _rv_dataset_id(reader, "dataset"),
+    _rv_region_id(reader, "event_region"),
+    _rv_tau1_gen_match(reader, "tau1_gen_match"),
+    _rv_tau2_gen_match(reader, "tau2_gen_match"),
+    _rv_b1_hadronFlavour(reader, "b1_hadronFlavour"),
+    _rv_b2_hadronFlavour(reader, "b2_hadronFlavour"),
+    _rv_is_boosted(reader, "is_boosted"),
+    _rv_has_b_pair(reader, "has_b_pair"),
+    _rv_has_vbf_pair(reader, "has_VBF_pair"),
+    _rv_num_btag_loose(reader, "num_btag_Loose"),
+    _rv_num_btag_medium(reader, "num_btag_Medium"),
+    _groups(groups) {
+    EvtReader::_bind(reader, grp_hl_kinfit, {&_rv_kinfit_mass, &_rv_kinfit_chi2});
+    EvtReader::_bind(reader, grp_mt2,       {&_rv_mt2});
+    EvtReader::_bind(reader, grp_csv,       {&_rv_b_1_csv, &_rv_b_2_csv});
+    EvtReader::_bind(reader, grp_jet_tags,  {&_rv_b_1_hhbtag, &_rv_b_1_cvsl, &_rv_b_1_cvsb, &_rv_b_2_hhbtag, &_rv_b_2_cvsl,
+                                             &_rv_b_2_cvsb, &_rv_vbf_1_hhbtag, &_rv_vbf_1_cvsl, &_rv_vbf_1_cvsb,
+                                             &_rv_vbf_2_hhbtag, &_rv_vbf_2_cvsl, &_rv_vbf_2_cvsb});
+    EvtReader::_bind(reader, grp_svfit,     {&_rv_svfit_pT, &_rv_svfit_eta, &_rv_svfit_phi, &_rv_svfit_mass});
+    EvtReader::_bind(reader, grp_l_1,       {&_rv_l_1_pT, &_rv_l_1_eta, &_rv_l_1_phi, &_rv_l_1_mass});
+    EvtReader::_bind(reader, grp_l_2,       {&_rv_l_2_pT, &_rv_l_2_eta, &_rv_l_2_phi, &_rv_l_2_mass});
+    EvtReader::_bind(reader, grp_met,       {&_rv_met_pT, &_rv_met_phi});
+    EvtReader::_bind(reader, grp_met_cov,   {&_rv_met_cov_00, &_rv_met_cov_01, &_rv_met_cov_11});
+    EvtReader::_bind(reader, grp_b_1,       {&_rv_b_1_pT, &_rv_b_1_eta, &_rv_b_1_phi, &_rv_b_1_mass});
+    EvtReader::_bind(reader, grp_b_2,       {&_rv_b_2_pT, &_rv_b_2_eta, &_rv_b_2_phi, &_rv_b_2_mass});
+    EvtReader::_bind(reader, grp_vbf_1,     {&_rv_vbf_1_pT, &_rv_vbf_1_eta, &_rv_vbf_1_phi, &_rv_vbf_1_mass});
+    EvtReader::_bind(reader, grp_vbf_2,     {&_rv_vbf_2_pT, &_rv_vbf_2_eta, &_rv_vbf_2_phi, &_rv_vbf_2_mass});
+}
+
+EvtReader::~EvtReader() {}
+
+void EvtReader::_bind(TTreeReader& reader, const InputGroup& group, const std::vector<ValuePtr*>& values) {
+    /* Bind values to the branches of the group, in the order of get_group_branches, if the group is read */
+
+    if (!EvtReader::_has(group)) return;
+    std::vector<std::string> names = EvtReader::get_group_branches(group);
+    for (unsigned int i = 0; i < values.size(); i++) values[i]->reset(new TTreeReaderValue<float>(reader, names[i].c_str()));
+}
+
+void EvtReader::read_meta(EvtInput& evt) {
+    /* Load only the branches needed to decide whether the event is accepted */
+
+    evt.weight          = *_rv_weight;
+    evt.evt             = *_rv_evt;
+    evt.dataset_id      = *_rv_dataset_id;
+    evt.region_id       = *_rv_region_id;
+    evt.is_boosted      = *_rv_is_boosted;
+    evt.has_vbf_pair    = *_rv_has_vbf_pair;
+    evt.has_b_pair      = *_rv_has_b_pair;
+    evt.num_btag_loose  = *_rv_num_btag_loose;
+    evt.num_btag_medium = *_rv_num_btag_medium;
+}
+
+void EvtReader::read_feats(EvtInput& evt) {
+    /* Load the remaining branches of an accepted event */
+
+    // Gen info
+    evt.tau1_gen_match   = *_rv_tau1_gen_match;
+    evt.tau2_gen_match   = *_rv_tau2_gen_match;
+    evt.b1_hadronFlavour = *_rv_b1_hadronFlavour;
+    evt.b2_hadronFlavour = *_rv_b2_hadronFlavour;
+
+    // HL feats
+    if (EvtReader::_has(grp_hl_kinfit)) {
+        evt.kinfit_mass = **_rv_kinfit_mass;
+        evt.kinfit_chi2 = **_rv_kinfit_chi2;
+    }
+    if (EvtReader::_has(grp_mt2)) evt.mt2 = **_rv_mt2;
+    if (EvtReader::_has(grp_jet_tags)) {
+        evt.b_1_hhbtag   = **_rv_b_1_hhbtag;
+        evt.b_2_hhbtag   = **_rv_b_2_hhbtag;
+        evt.vbf_1_hhbtag = **_rv_vbf_1_hhbtag;
+        evt.vbf_2_hhbtag = **_rv_vbf_2_hhbtag;
+        evt.b_1_cvsl     = **_rv_b_1_cvsl;
+        evt.b_2_cvsl     = **_rv_b_2_cvsl;
+        evt.vbf_1_cvsl   = **_rv_vbf_1_cvsl;
+        evt.vbf_2_cvsl   = **_rv_vbf_2_cvsl;
+        evt.b_1_cvsb     = **_rv_b_1_cvsb;
+        evt.b_2_cvsb     = **_rv_b_2_cvsb;
+        evt.vbf_1_cvsb   = **_rv_vbf_1_cvsb;
+        evt.vbf_2_cvsb   = **_rv_vbf_2_cvsb;
+    }
+
+    // Tagging
+    if (EvtReader::_has(grp_csv)) {
+        evt.b_1_csv = **_rv_b_1_csv;
+        evt.b_2_csv = **_rv_b_2_csv;
+    }
+
+    // Vectors
+    if (EvtReader::_has(grp_svfit)) {
+        evt.svfit_pT   = **_rv_svfit_pT;
+        evt.svfit_eta  = **_rv_svfit_eta;
+        evt.svfit_phi  = **_rv_svfit_phi;
+        evt.svfit_mass = **_rv_svfit_mass;
+    }
+    if (EvtReader::_has(grp_l_1)) {
+        evt.l_1_pT   = **_rv_l_1_pT;
+        evt.l_1_eta  = **_rv_l_1_eta;
+        evt.l_1_phi  = **_rv_l_1_phi;
+        evt.l_1_mass = **_rv_l_1_mass;
+    }
+    if (EvtReader::_has(grp_l_2)) {
+        evt.l_2_pT   = **_rv_l_2_pT;
+        evt.l_2_eta  = **_rv_l_2_eta;
+        evt.l_2_phi  = **_rv_l_2_phi;
+        evt.l_2_mass = **_rv_l_2_mass;
+    }
+    if (EvtReader::_has(grp_met)) {
+        evt.met_pT  = **_rv_met_pT;
+        evt.met_phi = **_rv_met_phi;
+    }
+    if (EvtReader::_has(grp_met_cov)) {
+        evt.met_cov_00 = **_rv_met_cov_00;
+        evt.met_cov_01 = **_rv_met_cov_01;
+        evt.met_cov_11 = **_rv_met_cov_11;
+    }
+    if (EvtReader::_has(grp_b_1)) {
+        evt.b_1_pT   = **_rv_b_1_pT;
+        evt.b_1_eta  = **_rv_b_1_eta;
+        evt.b_1_phi  = **_rv_b_1_phi;
+        evt.b_1_mass = **_rv_b_1_mass;
+    }
+    if (EvtReader::_has(grp_b_2)) {
+        evt.b_2_pT   = **_rv_b_2_pT;
+        evt.b_2_eta  = **_rv_b_2_eta;
+        evt.b_2_phi  = **_rv_b_2_phi;
+        evt.b_2_mass = **_rv_b_2_mass;
+    }
+    if (EvtReader::_has(grp_vbf_1)) {
+        evt.vbf_1_pT   = **_rv_vbf_1_pT;
+        evt.vbf_1_eta  = **_rv_vbf_1_eta;
+        evt.vbf_1_phi  = **_rv_vbf_1_phi;
+        evt.vbf_1_mass = **_rv_vbf_1_mass;
+    }
+    if (EvtReader::_has(grp_vbf_2)) {
+        evt.vbf_2_pT   = **_rv_vbf_2_pT;
+        evt.vbf_2_eta  = **_rv_vbf_2_eta;
+        evt.vbf_2_phi  = **_rv_vbf_2_phi;
+        evt.vbf_2_mass = **_rv_vbf_2_mass;
+    }
+}
+
+std::vector<std::string> EvtReader::get_meta_branches() {
+    /* Branches needed by FileLooper to decide whether an event is accepted */
+
+    return {"dataset", "event_region", "has_b_pair", "has_VBF_pair", "is_boosted", "num_btag_Loose", "num_btag_Medium"};
+}
+
+std::vector<std::string> EvtReader::get_group_branches(const InputGroup& group) {
+    /* Branches of an input group */
+
+    switch (group) {
+        case grp_hl_kinfit: return {"kinFit_m", "kinFit_chi2"};
+        case grp_mt2:       return {"MT2"};
+        case grp_csv:       return {"b1_DeepFlavour", "b2_DeepFlavour"};
+        case grp_jet_tags:  return {"b1_HHbtag", "b1_DeepFlavour_CvsL", "b1_DeepFlavour_CvsB",
+                                    "b2_HHbtag", "b2_DeepFlavour_CvsL", "b2_DeepFlavour_CvsB",
+                                    "VBF1_HHbtag", "VBF1_DeepFlavour_CvsL", "VBF1_DeepFlavour_CvsB",
+                                    "VBF2_HHbtag", "VBF2_DeepFlavour_CvsL", "VBF2_DeepFlavour_CvsB"};
+        case grp_svfit:     return {"SVfit_pt", "SVfit_eta", "SVfit_phi", "SVfit_m"};
+        case grp_l_1:       return {"tau1_pt", "tau1_eta", "tau1_phi", "tau1_m"};
+        case grp_l_2:       return {"tau2_pt", "tau2_eta", "tau2_phi", "tau2_m"};
+        case grp_met:       return {"MET_pt", "MET_phi"};
+        case grp_met_cov:   return {"MET_cov_00", "MET_cov_01", "MET_cov_11"};
+        case grp_b_1:       return {"b1_pt", "b1_eta", "b1_phi", "b1_m"};
+        case grp_b_2:       return {"b2_pt", "b2_eta", "b2_phi", "b2_m"};
+        case grp_vbf_1:     return {"VBF1_pt", "VBF1_eta", "VBF1_phi", "VBF1_m"};
+        case grp_vbf_2:     return {"VBF2_pt", "VBF2_eta", "VBF2_phi", "VBF2_m"};
+        default:            throw std::invalid_argument("Invalid input group " + std::to_string(group));
+    }
+}
+
+std::vector<std::string> EvtReader::get_branch_names(const unsigned int& groups) {
+    /* All branches bound by a reader of the input groups in the mask */
+
+    std::vector<std::string> names = {"evt", "weight", "tau1_gen_match", "tau2_gen_match", "b1_hadronFlavour", "b2_hadronFlavour"};
+    for (const std::string& b : EvtReader::get_meta_branches()) names.push_back(b);
+    for (int g = 0; g < n_input_groups; g++) {
+        if (!(groups & 1U << g)) continue;
+        for (const std::string& b : EvtReader::get_group_branches(InputGroup(g))) names.push_back(b);
+    }
+    return names;
+}
@@ -0,0 +1,768 @@
+#include "cms_runII_data_proc/processing/interface/evt_writer.hh"
+
+EvtWriter* EvtWriter::create(const OutFormat& format, const std::string& oname, const std::vector<std::string>& feat_names,
+                             const IOProfile& profile, const FoldSpec& folds, const KinFitGrid& scan, const StoragePolicy& storage) {
+    if (folds.n_folds < 1) throw std::invalid_argument("Output must have at least one fold");
+    if (format == out_tree)       return new TreeEvtWriter(oname, feat_names, profile, folds, scan, storage);
+    if (format == out_tree_async) return new AsyncTreeEvtWriter(oname, feat_names, profile, folds, scan, storage);
+#ifdef EVT_WRITER_HAS_RNTUPLE
+    if (format == out_rntuple) return new NTupleEvtWriter(oname, feat_names, profile, folds, scan, storage);
+#else
+    if (format == out_rntuple) throw std::invalid_argument("RNTuple output requires ROOT 6.32 or later");
+#endif
+    if (format == out_hist) throw std::invalid_argument("Histogram output needs a booking, see HistEvtWriter");
+    throw std::invalid_argument("Unrecognised output format");
+}
+
+OutFormat EvtWriter::get_format(const std::string& format) {
+    /* Convert format name to enum */
+
+    if (format == "tree")       return OutFormat(out_tree);
+    if (format == "tree_async") return OutFormat(out_tree_async);
+    if (format == "rntuple")    return OutFormat(out_rntuple);
+    if (format == "hist")       return OutFormat(out_hist);
+    throw std::invalid_argument("Invalid output format: options are tree, tree_async, rntuple, hist");
+    return OutFormat(out_tree);
+}
+
+OutFormat EvtWriter::detect_format(TDirectory* dir) {
+    /*
+    Format of an output from what it holds as data_0: a TTree, from either TTree writer, an RNTuple, or nothing for
+    histogram outputs. Both TTree formats are reported as out_tree
+    */
+
+    TKey* key = dir->GetKey("data_0");
+    if (key == nullptr) return OutFormat(out_hist);
+    std::string cls = key->GetClassName();
+    if (cls == "TTree") return OutFormat(out_tree);
+    if (cls.find("RNTuple") != std::string::npos) return OutFormat(out_rntuple);
+    throw std::runtime_error("data_0 of " + std::string(dir->GetName()) + " is a " + cls + " rather than an output");
+}
+
+const std::map<std::string, std::string>& EvtWriter::get_profile_presets() {
+    /* Named I/O profiles as algorithm:level:basket_size:auto_flush. default matches ROOT's own defaults */
+
+    static const std::map<std::string, std::string> presets = {
+        {"default",  "zlib:1:32000:-30000000"},
+        {"zlib",     "zlib:6:32000:-30000000"},
+        {"lz4",      "lz4:4:32000:-30000000"},
+        {"lz4_big",  "lz4:4:256000:-60000000"},
+        {"lzma",     "lzma:8:32000:-30000000"},
+        {"zstd",     "zstd:5:32000:-30000000"},
+        {"zstd_big", "zstd:5:256000:-60000000"},
+    };
+    return presets;
+}
+
+IOProfile EvtWriter::get_profile(const std::string& profile) {
+    /* Look up a named profile, or parse a custom one given as algorithm:level:basket_size:auto_flush */
+
+    const std::map<std::string, std::string>& presets = EvtWriter::get_profile_presets();
+    std::string spec = presets.count(profile) ? presets.at(profile) : profile;
+
+    std::vector<std::string> parts;
+    size_t start = 0, end;
+    while ((end = spec.find(':', start)) != std::string::npos) {
+        parts.push_back(spec.substr(start, end-start));
+        start = end+1;
+    }
+    parts.push_back(spec.substr(start));
+    if (parts.size() != 4) throw std::invalid_argument("Invalid I/O profile " + profile + ": expected a preset or algorithm:level:basket_size:auto_flush");
+
+    int algorithm;
+    if (parts[0] == "zlib") {
+        algorithm = 1;
+    } else if (parts[0] == "lzma") {
+        algorithm = 2;
+    } else if (parts[0] == "lz4") {
+        algorithm = 4;
+    } else if (parts[0] == "zstd") {
+#if ROOT_VERSION_CODE < ROOT_VERSION(6,20,0)
+        throw std::invalid_argument("ZSTD compression requires ROOT 6.20 or later");
+#endif
+        algorithm = 5;
+    } else {
+        throw std::invalid_argument("Invalid compression algorithm " + parts[0] + ": options are zlib, lzma, lz4, zstd");
+    }
+
+    IOProfile io;
+    io.name = profile;
+    try {
+        io.compression = 100*algorithm+std::stoi(parts[1]);
+        io.basket_size = std::stoi(parts[2]);
+        io.auto_flush  = std::stoll(parts[3]);
+    } catch (const std::logic_error& e) {
+        throw std::invalid_argument("Invalid I/O profile " + profile + ": unable to parse numbers");
+    }
+    if (io.compression%100 > 9 || io.basket_size <= 0 || io.auto_flush == 0) {
+        throw std::invalid_argument("Invalid I/O profile " + profile + ": level must be 0-9, basket_size > 0, and auto_flush != 0");
+    }
+    return io;
+}
+
+void EvtWriter::checkpoint(const LoopState& state) {
+    throw std::runtime_error("Checkpoints are only supported for tree output");
+}
+
+void EvtWriter::resume(const std::string& ckpt_name, const LoopState& state) {
+    throw std::runtime_error("Checkpoints are only supported for tree output");
+}
+
+bool EvtWriter::read_state(const std::string& fname, LoopState& state) {
+    /* Load the loop state of the last checkpoint in fname, returning false if the file or state does not exist */
+
+    if (gSystem->AccessPathName(fname.c_str())) return false;  // Returns true if file is not accessible
+    TFile* in_file = TFile::Open(fname.c_str());
+    if (in_file == nullptr) return false;
+    bool ok = false;
+    if (!in_file->IsZombie()) {
+        TParameter<Long64_t>* last_entry(nullptr);
+        in_file->GetObject("ckpt_last_entry", last_entry);
+        std::vector<long long int> n_saved;
+        while (true) {  // One count per fold
+            TParameter<Long64_t>* n(nullptr);
+            in_file->GetObject(("ckpt_n_saved_"+std::to_string(n_saved.size())).c_str(), n);
+            if (n == nullptr) break;
+            n_saved.push_back(n->GetVal());
+        }
+        ok = last_entry != nullptr && n_saved.size() > 0;
+        if (ok) {
+            state.last_entry = last_entry->GetVal();
+            state.n_saved = n_saved;
+        }
+        in_file->Close();
+    }
+    delete in_file;
+    return ok;
+}
+
+std::string EvtWriter::get_tree_title(const unsigned int& fold, const FoldSpec& folds) {
+    if (folds.n_folds == 2 && folds.seed == 0) return fold == 0 ? "Even id data" : "Odd id data";
+    std::string title = "Fold " + std::to_string(fold) + " of " + std::to_string(folds.n_folds);
+    return folds.seed == 0 ? title + " by id" : title + " by id hash, seed " + std::to_string(folds.seed);
+}
+
+void EvtWriter::prep_tree(TTree* tree, RecBuffer& rec, PackedColumns& packed, const std::vector<std::string>& feat_names,
+                          const IOProfile& profile, const KinFitGrid& scan, const StoragePolicy& storage) {
+    /*
+    Add branches to tree, bound to the offsets of their columns in the first record of rec, and apply the basket and
+    AutoFlush sizes of the profile. Columns stored narrower than in the record are registered with packed, which must be
+    packed before each fill. The scan arrays are titled with their grid. evt and dataset identify each entry, so that friend
+    trees can be matched to it
+    */
+
+    if (rec.n_scan() != scan.size()) throw std::invalid_argument("Record buffer does not match the KinFit scan grid");
+    auto add_float = [&](const std::string& name, float* val, const unsigned int& size) {
+        ColumnStorage s = storage.get_float(name);
+        if (s.type == col_trunc) packed.add_trunc(val, std::max(1U, size), s.bits);
+        return tree->Branch(name.c_str(), val, StoragePolicy::get_leaflist(name, s, size).c_str());
+    };
+    auto add_int = [&](const std::string& name, int* val) {
+        ColumnStorage s = storage.get_int(name);
+        void* addr = s.type == col_i32 ? static_cast<void*>(val) : packed.add_narrow(val, s.type, name);
+        tree->Branch(name.c_str(), addr, StoragePolicy::get_leaflist(name, s).c_str());
+    };
+
+    float* feats = rec.feats(0);
+    EvtMeta& meta = rec.meta(0);
+    for (unsigned int i = 0; i < feat_names.size(); i++) add_float(feat_names[i], &feats[i], 0);
+    add_float("weight", &meta.weight, 0);
+    add_int("sample",  &meta.sample);
+    add_int("region",  &meta.region);
+    add_int("jet_cat", &meta.jet_cat);
+    tree->Branch("strat_key",   &meta.strat_key);
+    tree->Branch("evt",         &meta.evt,        "evt/l");
+    tree->Branch("dataset",     &meta.dataset_id, "dataset/i");
+    add_float("kinfit_mass_ZZ", &meta.kinfit_mass_ZZ, 0);
+    add_float("kinfit_chi2_ZZ", &meta.kinfit_chi2_ZZ, 0);
+    add_float("kinfit_mass_ZH", &meta.kinfit_mass_ZH, 0);
+    add_float("kinfit_chi2_ZH", &meta.kinfit_chi2_ZH, 0);
+    add_int("tau1_gen_match",   &meta.tau1_gen_match);
+    add_int("tau2_gen_match",   &meta.tau2_gen_match);
+    add_int("b1_hadronFlavour", &meta.b1_hadronFlavour);
+    add_int("b2_hadronFlavour", &meta.b2_hadronFlavour);
+    if (scan.size() > 0) {
+        std::string grid = KinFitter::describe_grid(scan);
+        add_float("kinfit_scan_mass", rec.scan_mass(0), scan.size())->SetTitle(("KinFit mass, "+grid).c_str());
+        add_float("kinfit_scan_chi2", rec.scan_chi2(0), scan.size())->SetTitle(("KinFit chi2, "+grid).c_str());
+    }
+    tree->SetBasketSize("*", profile.basket_size);
+    tree->SetAutoFlush(profile.auto_flush);
+}
+
+TreeEvtWriter::TreeEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const IOProfile& profile,
+                             const FoldSpec& folds, const KinFitGrid& scan, const StoragePolicy& storage)
+    : _rec(1, feat_names.size(), scan.size()), _index(folds.n_folds) {
+    _file = new TFile(oname.c_str(), "recreate", "", profile.compression);
+    _checkpointed = false;
+    for (unsigned int i = 0; i < folds.n_folds; i++) {
+        _trees.push_back(new TTree(("data_"+std::to_string(i)).c_str(), EvtWriter::get_tree_title(i, folds).c_str()));
+        _packed.emplace_back(new PackedColumns());
+        EvtWriter::prep_tree(_trees[i], _rec, *_packed[i], feat_names, profile, scan, storage);
+    }
+}
+
+TreeEvtWriter::~TreeEvtWriter() {
+    TreeEvtWriter::close();
+}
+
+void TreeEvtWriter::fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) {
+    for (unsigned int i = 0; i < n; i++) {
+        _rec.copy(0, recs, first+i);
+        _packed[folds[i]]->pack();
+        _trees[folds[i]]->Fill();
+        _index.add(folds[i], _rec.meta(0).strat_key);
+    }
+}
+
+void TreeEvtWriter::checkpoint(const LoopState& state) {
+    /* AutoSave both trees, then record the loop state, so that the state never claims more events than the saved trees hold */
+
+    for (TTree* t : _trees) t->AutoSave("SaveSelf");
+    TDirectory::TContext ctx(_file);
+    TParameter<Long64_t>("ckpt_last_entry", state.last_entry).Write("", TObject::kOverwrite);
+    for (unsigned int i = 0; i < state.n_saved.size(); i++) {
+        std::string name = "ckpt_n_saved_"+std::to_string(i);
+        TParameter<Long64_t>(name.c_str(), state.n_saved[i]).Write("", TObject::kOverwrite);
+    }
+    _file->SaveSelf();
+    _file->Flush();
+    _checkpointed = true;
+}
+
+void TreeEvtWriter::resume(const std::string& ckpt_name, const LoopState& state) {
+    /* Copy the events recorded by the checkpoint state from an interrupted output into the new trees */
+
+    TFile* in_file = TFile::Open(ckpt_name.c_str());
+    if (in_file == nullptr || in_file->IsZombie()) throw std::runtime_error("Unable to read checkpoint " + ckpt_name);
+    if (state.n_saved.size() != _trees.size()) {
+        throw std::runtime_error("Checkpoint " + ckpt_name + " has " + std::to_string(state.n_saved.size()) + " folds, expected " +
+                                 std::to_string(_trees.size()));
+    }
+    for (unsigned int i = 0; i < _trees.size(); i++) {
+        TTree* in_tree = nullptr;
+        in_file->GetObject(("data_"+std::to_string(i)).c_str(), in_tree);
+        if (in_tree == nullptr || in_tree->GetEntries() < state.n_saved[i]) {
+            throw std::runtime_error("Checkpoint " + ckpt_name + " holds fewer events than its state records");
+        }
+        _trees[i]->CopyAddresses(in_tree);
+        for (long long int j = 0; j < state.n_saved[i]; j++) {
+            in_tree->GetEntry(j);
+            _trees[i]->Fill();
+            _index.add(i, _rec.meta(0).strat_key);
+        }
+        _trees[i]->CopyAddresses(in_tree, true);
+    }
+    in_file->Close();
+    delete in_file;
+}
+
+void TreeEvtWriter::close() {
+    /* Write trees and the strat index, replacing any checkpointed versions, and remove the checkpoint state */
+
+    if (_file == nullptr) return;
+    for (TTree* t : _trees) {
+        t->Write("", _checkpointed ? TObject::kOverwrite : 0);
+        delete t;
+    }
+    {
+        TDirectory::TContext ctx(_file);
+        TTree* index = _index.make_tree();
+        index->Write();
+        delete index;
+    }
+    if (_checkpointed) {
+        _file->Delete("ckpt_last_entry;*");
+        for (unsigned int i = 0; i < _trees.size(); i++) _file->Delete(("ckpt_n_saved_"+std::to_string(i)+";*").c_str());
+    }
+    _trees.clear();
+    _file->Close();
+    delete _file;
+    _file = nullptr;
+}
+
+FriendTreeEvtWriter::FriendTreeEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names,
+                                         const std::vector<std::string>& meta_columns, const IOProfile& profile,
+                                         const FoldSpec& folds, const KinFitGrid& scan, const StoragePolicy& storage)
+    : _rec(1, feat_names.size(), scan.size()), _n_filled(folds.n_folds, 0) {
+    _file = new TFile(oname.c_str(), "recreate", "", profile.compression);
+    for (unsigned int i = 0; i < folds.n_folds; i++) {
+        _trees.push_back(new TTree(("data_"+std::to_string(i)).c_str(), EvtWriter::get_tree_title(i, folds).c_str()));
+        _packed.emplace_back(new PackedColumns());
+        FriendTreeEvtWriter::_prep_tree(_trees[i], *_packed[i], feat_names, meta_columns, profile, scan, storage);
+    }
+}
+
+FriendTreeEvtWriter::~FriendTreeEvtWriter() {
+    FriendTreeEvtWriter::close();
+}
+
+void FriendTreeEvtWriter::_prep_tree(TTree* tree, PackedColumns& packed, const std::vector<std::string>& feat_names,
+                                     const std::vector<std::string>& meta_columns, const IOProfile& profile,
+                                     const KinFitGrid& scan, const StoragePolicy& storage) {
+    /* Add the evt and dataset branches and those of the added columns, bound to the record as in prep_tree */
+
+    auto add_float = [&](const std::string& name, float* val, const unsigned int& size) {
+        ColumnStorage s = storage.get_float(name);
+        if (s.type == col_trunc) packed.add_trunc(val, std::max(1U, size), s.bits);
+        return tree->Branch(name.c_str(), val, StoragePolicy::get_leaflist(name, s, size).c_str());
+    };
+
+    float* feats = _rec.feats(0);
+    EvtMeta& meta = _rec.meta(0);
+    const std::map<std::string, float*> meta_vals = {{"kinfit_mass_ZZ", &meta.kinfit_mass_ZZ}, {"kinfit_chi2_ZZ", &meta.kinfit_chi2_ZZ},
+                                                     {"kinfit_mass_ZH", &meta.kinfit_mass_ZH}, {"kinfit_chi2_ZH", &meta.kinfit_chi2_ZH}};
+    tree->Branch("evt",     &meta.evt,        "evt/l");
+    tree->Branch("dataset", &meta.dataset_id, "dataset/i");
+    for (unsigned int i = 0; i < feat_names.size(); i++) add_float(feat_names[i], &feats[i], 0);
+    for (const std::string& c : meta_columns) {
+        if (meta_vals.count(c) == 0) throw std::invalid_argument("Column " + c + " cannot be added to an existing output");
+        add_float(c, meta_vals.at(c), 0);
+    }
+    if (scan.size() > 0) {
+        std::string grid = KinFitter::describe_grid(scan);
+        add_float("kinfit_scan_mass", _rec.scan_mass(0), scan.size())->SetTitle(("KinFit mass, "+grid).c_str());
+        add_float("kinfit_scan_chi2", _rec.scan_chi2(0), scan.size())->SetTitle(("KinFit chi2, "+grid).c_str());
+    }
+    tree->SetBasketSize("*", profile.basket_size);
+    tree->SetAutoFlush(profile.auto_flush);
+}
+
+void FriendTreeEvtWriter::set_base_ids(std::vector<std::vector<EvtId>> base_ids) {
+    /* Check every record written against the (evt, dataset) of the base entry it is aligned with, given per fold */
+
+    if (base_ids.size() != _trees.size()) {
+        throw std::invalid_argument("Base output has " + std::to_string(base_ids.size()) + " folds, expected " +
+                                    std::to_string(_trees.size()));
+    }
+    _base_ids = std::move(base_ids);
+}
+
+void FriendTreeEvtWriter::fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) {
+    for (unsigned int i = 0; i < n; i++) {
+        _rec.copy(0, recs, first+i);
+        const EvtMeta& meta = _rec.meta(0);
+        const unsigned int f = folds[i];
+        if (_base_ids.size() > 0) {
+            if (_n_filled[f] >= (long long int)_base_ids[f].size() || _base_ids[f][_n_filled[f]] != EvtId(meta.evt, meta.dataset_id)) {
+                throw std::runtime_error("Event " + std::to_string(meta.evt) + " of dataset " + std::to_string(meta.dataset_id) +
+                                         " does not match entry " + std::to_string(_n_filled[f]) + " of base fold " +
+                                         std::to_string(f) + ": the base output was made with a different selection or input");
+            }
+        }
+        _packed[f]->pack();
+        _trees[f]->Fill();
+        _n_filled[f]++;
+    }
+}
+
+void FriendTreeEvtWriter::close() {
+    /* Index each tree by (evt, dataset) and write it */
+
+    if (_file == nullptr) return;
+    for (TTree* t : _trees) {
+        if (t->GetEntries() > 0) t->BuildIndex("evt", "dataset");
+        t->Write();
+        delete t;
+    }
+    _trees.clear();
+    _file->Close();
+    delete _file;
+    _file = nullptr;
+}
+
+HistEvtWriter::HistEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const std::vector<HistSpec>& hists,
+                             const IOProfile& profile) {
+    if (hists.size() == 0) throw std::invalid_argument("Histogram output needs at least one booked histogram");
+    const std::map<std::string, std::pair<size_t, bool>>& meta_columns = HistEvtWriter::get_meta_columns();
+    _n_bins = 0;
+    for (const HistSpec& h : hists) {
+        Column col;
+        col.spec = h;
+        col.first_bin = _n_bins;
+        _n_bins += h.n_bins+2;
+        auto feat = std::find(feat_names.begin(), feat_names.end(), h.column);
+        if (feat != feat_names.end()) {
+            col.offset = sizeof(EvtMeta)+(feat-feat_names.begin())*sizeof(float);
+            col.is_int = false;
+        } else if (meta_columns.count(h.column)) {
+            col.offset = meta_columns.at(h.column).first;
+            col.is_int = meta_columns.at(h.column).second;
+        } else {
+            throw std::invalid_argument("Cannot book " + h.column + ": not a computed feature or metadata column");
+        }
+        _columns.push_back(col);
+    }
+    _file = new TFile(oname.c_str(), "recreate", "", profile.compression);
+}
+
+HistEvtWriter::~HistEvtWriter() {
+    HistEvtWriter::close();
+}
+
+const std::map<std::string, std::pair<size_t, bool>>& HistEvtWriter::get_meta_columns() {
+    /* Metadata columns which can be booked: their offset in a record and whether they are integers */
+
+    static const std::map<std::string, std::pair<size_t, bool>> columns = {
+        {"weight",           {offsetof(EvtMeta, weight),           false}},
+        {"kinfit_mass_ZZ",   {offsetof(EvtMeta, kinfit_mass_ZZ),   false}},
+        {"kinfit_chi2_ZZ",   {offsetof(EvtMeta, kinfit_chi2_ZZ),   false}},
+        {"kinfit_mass_ZH",   {offsetof(EvtMeta, kinfit_mass_ZH),   false}},
+        {"kinfit_chi2_ZH",   {offsetof(EvtMeta, kinfit_chi2_ZH),   false}},
+        {"sample",           {offsetof(EvtMeta, sample),           true}},
+        {"region",           {offsetof(EvtMeta, region),           true}},
+        {"jet_cat",          {offsetof(EvtMeta, jet_cat),          true}},
+        {"class_id",         {offsetof(EvtMeta, class_id),         true}},
+        {"tau1_gen_match",   {offsetof(EvtMeta, tau1_gen_match),   true}},
+        {"tau2_gen_match",   {offsetof(EvtMeta, tau2_gen_match),   true}},
+        {"b1_hadronFlavour", {offsetof(EvtMeta, b1_hadronFlavour), true}},
+        {"b2_hadronFlavour", {offsetof(EvtMeta, b2_hadronFlavour), true}},
+    };
+    return columns;
+}
+
+std::vector<HistSpec> HistEvtWriter::parse_booking(const std::string& spec) {
+    /* Parse comma-separated column:n_bins:lo:hi histograms, e.g. diH_mass:40:0:800,weight:50:0:2 */
+
+    std::vector<HistSpec> hists;
+    std::stringstream ss(spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item == "") continue;
+        std::vector<std::string> parts;
+        std::stringstream ps(item);
+        std::string p;
+        while (std::getline(ps, p, ':')) parts.push_back(p);
+        if (parts.size() != 4) throw std::invalid_argument("Invalid histogram " + item + ": expected column:n_bins:lo:hi");
+        HistSpec h;
+        h.column = parts[0];
+        try {
+            int n_bins = std::stoi(parts[1]);
+            h.lo = std::stof(parts[2]);
+            h.hi = std::stof(parts[3]);
+            if (n_bins < 1 || !(h.hi > h.lo)) throw std::invalid_argument(item);
+            h.n_bins = n_bins;
+        } catch (const std::logic_error& e) {
+            throw std::invalid_argument("Invalid histogram " + item + ": n_bins must be positive and hi > lo");
+        }
+        hists.push_back(h);
+    }
+    return hists;
+}
+
+std::vector<std::string> HistEvtWriter::get_requested(const std::vector<HistSpec>& hists) {
+    /* Columns the loop must compute for a booking: its features and KinFit columns, in the form of FileLooper's requested list */
+
+    const std::map<std::string, std::pair<size_t, bool>>& meta_columns = HistEvtWriter::get_meta_columns();
+    std::vector<std::string> requested;
+    for (const HistSpec& h : hists) {
+        bool computed = meta_columns.count(h.column) == 0 || h.column.rfind("kinfit_", 0) == 0;
+        if (computed && std::find(requested.begin(), requested.end(), h.column) == requested.end()) requested.push_back(h.column);
+    }
+    return requested;
+}
+
+unsigned int HistEvtWriter::_get_cat(const EvtMeta& meta) {
+    auto it = _cat_idx.find(meta.strat_key);
+    if (it != _cat_idx.end()) return it->second;
+    Category cat;
+    cat.sample  = meta.sample;
+    cat.region  = meta.region;
+    cat.jet_cat = meta.jet_cat;
+    cat.n       = 0;
+    cat.sumw.assign(_n_bins, 0);
+    cat.sumw2.assign(_n_bins, 0);
+    _cats.push_back(std::move(cat));
+    _cat_idx[meta.strat_key] = _cats.size()-1;
+    return _cats.size()-1;
+}
+
+void HistEvtWriter::fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) {
+    /*
+    Bin records first ... first+n-1 of recs one column at a time: gather the column into a contiguous array, compute the
+    bins of all records in one branch-free loop, then add the weights to the bins of each record's category. Bins are
+    computed in double with the same expression and edge tests as TAxis::FindFixBin, so that a value lands in the bin
+    that TH1::Fill would put it in, including values at or within rounding of a bin edge.
+    */
+
+    if (n == 0) return;
+    _vals.resize(n);
+    _weights.resize(n);
+    _bins.resize(n);
+    _block_cats.resize(n);
+    for (unsigned int i = 0; i < n; i++) {
+        const EvtMeta& meta = recs.meta(first+i);
+        _weights[i] = meta.weight;
+        _block_cats[i] = HistEvtWriter::_get_cat(meta);
+        _cats[_block_cats[i]].n++;
+    }
+
+    const char* base = reinterpret_cast<const char*>(&recs.meta(first));
+    const size_t stride = recs.stride();
+    double* vals = _vals.data();
+    int* bins = _bins.data();
+    for (const Column& col : _columns) {
+        if (col.is_int) {
+            for (unsigned int i = 0; i < n; i++) vals[i] = *reinterpret_cast<const int*>(base+i*stride+col.offset);
+        } else {
+            for (unsigned int i = 0; i < n; i++) vals[i] = *reinterpret_cast<const float*>(base+i*stride+col.offset);
+        }
+        const double lo(col.spec.lo), hi(col.spec.hi), top(col.spec.n_bins);
+        #pragma omp simd
+        for (unsigned int i = 0; i < n; i++) {
+            double x = top*(vals[i]-lo)/(hi-lo);
+            x = vals[i] < hi ? x : top;   // Overflow, and NaN
+            x = vals[i] < lo ? -1. : x;   // Underflow
+            bins[i] = 1+(int)x;
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            Category& cat = _cats[_block_cats[i]];
+            const size_t b = col.first_bin+bins[i];
+            cat.sumw[b]  += _weights[i];
+            cat.sumw2[b] += _weights[i]*_weights[i];
+        }
+    }
+}
+
+void HistEvtWriter::close() {
+    /* Turn the bin sums of each category into its directory of histograms */
+
+    if (_file == nullptr) return;
+    for (const Category& cat : _cats) {
+        std::string name = "sample_"+std::to_string(cat.sample)+"_region_"+std::to_string(cat.region)+"_jet_cat_"+
+                           std::to_string(cat.jet_cat);
+        TDirectory* dir = _file->mkdir(name.c_str());
+        TDirectory::TContext ctx(dir);
+        for (const Column& col : _columns) {
+            const HistSpec& s = col.spec;
+            TH1D* h = new TH1D(s.column.c_str(), (s.column+";"+s.column+";Weighted events").c_str(), s.n_bins, s.lo, s.hi);
+            for (unsigned int b = 0; b < s.n_bins+2; b++) {
+                h->SetBinContent(b, cat.sumw[col.first_bin+b]);
+                h->SetBinError(b, std::sqrt(cat.sumw2[col.first_bin+b]));
+            }
+            h->SetEntries(cat.n);
+            h->Write();
+            delete h;
+        }
+    }
+    _file->Close();
+    delete _file;
+    _file = nullptr;
+}
+
+AsyncTreeEvtWriter::AsyncTreeEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const IOProfile& profile,
+                                       const FoldSpec& folds, const KinFitGrid& scan, const StoragePolicy& storage)
+    : _feat_names(feat_names), _profile(profile), _fold_spec(folds), _scan(scan), _storage(storage), _index(folds.n_folds) {
+    ROOT::EnableThreadSafety();
+    _merger.reset(new bufmerger::TBufferMerger(oname.c_str(), "recreate", profile.compression));
+    const unsigned int n_blocks = 4;
+    for (unsigned int i = 0; i < folds.n_folds; i++) {
+        _folds.emplace_back(new Fold(n_blocks));
+        for (unsigned int j = 0; j < n_blocks; j++) {
+            _folds[i]->free_blocks.push(std::unique_ptr<RecBlock>(new RecBlock(feat_names.size(), scan.size())));
+        }
+        _folds[i]->free_blocks.pop(_folds[i]->block);
+    }
+    for (unsigned int i = 0; i < _folds.size(); i++) _folds[i]->thread = std::thread(&AsyncTreeEvtWriter::_write_fold, this, i);
+}
+
+AsyncTreeEvtWriter::~AsyncTreeEvtWriter() {
+    try {
+        AsyncTreeEvtWriter::close();
+    } catch (const std::exception& e) {
+        std::cerr << "Error closing output: " << e.what() << "\n";
+    }
+}
+
+void AsyncTreeEvtWriter::_fail() {
+    /* Record first error and unblock all threads */
+
+    std::lock_guard<std::mutex> lock(_error_mutex);
+    if (!_error) _error = std::current_exception();
+    for (std::unique_ptr<Fold>& f : _folds) {
+        f->free_blocks.close();
+        f->todo_blocks.close();
+    }
+}
+
+void AsyncTreeEvtWriter::_write_fold(const unsigned int& fold) {
+    /* Fill the tree of a fold from the queued blocks, passing its contents to the merger each time it reaches AutoFlush size */
+
+    Fold& f = *_folds[fold];
+    try {
+        std::shared_ptr<bufmerger::TBufferMergerFile> file = _merger->GetFile();
+        RecBuffer rec(1, _feat_names.size(), _scan.size());
+        PackedColumns packed;
+        TTree* tree;
+        {
+            TDirectory::TContext ctx(file.get());
+            tree = new TTree(("data_"+std::to_string(fold)).c_str(), EvtWriter::get_tree_title(fold, _fold_spec).c_str());  // Owned by file
+        }
+        EvtWriter::prep_tree(tree, rec, packed, _feat_names, _profile, _scan, _storage);
+
+        std::unique_ptr<RecBlock> block;
+        while (f.todo_blocks.pop(block)) {
+            for (unsigned int i = 0; i < block->n; i++) {
+                rec.copy(0, block->recs, i);
+                packed.pack();
+                tree->Fill();
+            }
+            block->n = 0;
+            f.free_blocks.push(std::move(block));
+            bool full = _profile.auto_flush > 0 ? tree->GetEntries() >= _profile.auto_flush : tree->GetTotBytes() >= -_profile.auto_flush;
+            if (full) file->Write();  // Sends the compressed tree to the merger and resets it
+        }
+        file->Write();
+    } catch (...) {
+        AsyncTreeEvtWriter::_fail();
+    }
+}
+
+void AsyncTreeEvtWriter::fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n,
+                                    const unsigned int* folds) {
+    for (unsigned int i = 0; i < n; i++) {
+        Fold& f = *_folds[folds[i]];
+        f.block->recs.copy(f.block->n++, recs, first+i);
+        _index.add(folds[i], recs.meta(first+i).strat_key);
+        if (f.block->n < WRITE_BLOCK_SIZE) continue;
+        if (!f.todo_blocks.push(std::move(f.block)) || !f.free_blocks.pop(f.block)) {
+            std::lock_guard<std::mutex> lock(_error_mutex);
+            if (_error) std::rethrow_exception(_error);
+            throw std::runtime_error("Output writer stopped unexpectedly");
+        }
+    }
+}
+
+void AsyncTreeEvtWriter::close() {
+    /*
+    Queue partially filled blocks, wait for the fold threads, pass the strat index to the merger, then destroy the merger,
+    which writes the remaining data
+    */
+
+    if (!_merger) return;
+    for (std::unique_ptr<Fold>& f : _folds) {
+        if (f->block && f->block->n > 0) f->todo_blocks.push(std::move(f->block));
+        f->todo_blocks.close();
+    }
+    for (std::unique_ptr<Fold>& f : _folds) f->thread.join();
+    if (!_error) {
+        std::shared_ptr<bufmerger::TBufferMergerFile> file = _merger->GetFile();
+        {
+            TDirectory::TContext ctx(file.get());
+            _index.make_tree();  // Owned by file
+        }
+        file->Write();
+    }
+    _merger.reset();
+    if (_error) std::rethrow_exception(_error);
+}
+
+#ifdef EVT_WRITER_HAS_RNTUPLE
+NTupleEvtWriter::NTupleEvtWriter(const std::string& oname, const std::vector<std::string>& feat_names, const IOProfile& profile,
+                                 const FoldSpec& folds, const KinFitGrid& scan, const StoragePolicy& storage)
+    : _index(folds.n_folds), _scan(scan) {
+    /* Only the compression of the profile applies; RNTuple pages and clusters keep their default sizes */
+
+    auto get_bits = [&](const std::string& column) { return storage.get_float(column).bits; };
+    for (const std::string& f : feat_names) _feat_bits.push_back(get_bits(f));
+    _weight_bits    = get_bits("weight");
+    _kinfit_bits[0] = get_bits("kinfit_mass_ZZ");
+    _kinfit_bits[1] = get_bits("kinfit_chi2_ZZ");
+    _kinfit_bits[2] = get_bits("kinfit_mass_ZH");
+    _kinfit_bits[3] = get_bits("kinfit_chi2_ZH");
+    _scan_bits[0]   = get_bits("kinfit_scan_mass");
+    _scan_bits[1]   = get_bits("kinfit_scan_chi2");
+
+    _file.reset(TFile::Open(oname.c_str(), "recreate", "", profile.compression));
+    if (!_file || _file->IsZombie()) throw std::runtime_error("Unable to create " + oname);
+    rntuple::RNTupleWriteOptions options;
+    options.SetCompression(profile.compression);
+    _fields.resize(folds.n_folds);
+    for (unsigned int i = 0; i < _fields.size(); i++) {
+        _writers.push_back(rntuple::RNTupleWriter::Append(NTupleEvtWriter::_prep_model(_fields[i], feat_names),
+                                                          "data_"+std::to_string(i), *_file, options));
+    }
+}
+
+
+NTupleEvtWriter::~NTupleEvtWriter() {
+    NTupleEvtWriter::close();
+}
+
+std::unique_ptr<rntuple::RNTupleModel> NTupleEvtWriter::_prep_model(Fields& fields, const std::vector<std::string>& feat_names) {
+    /* Add fields to model, keeping pointers to their values */
+
+    std::unique_ptr<rntuple::RNTupleModel> model = rntuple::RNTupleModel::Create();
+    for (const std::string& f : feat_names) fields.feats.push_back(model->MakeField<float>(f));
+    fields.weight           = model->MakeField<float>("weight");
+    fields.sample           = model->MakeField<int>("sample");
+    fields.region           = model->MakeField<int>("region");
+    fields.jet_cat          = model->MakeField<int>("jet_cat");
+    fields.strat_key        = model->MakeField<unsigned int>("strat_key");
+    fields.evt              = model->MakeField<unsigned long long int>("evt");
+    fields.dataset          = model->MakeField<unsigned int>("dataset");
+    fields.kinfit_mass_ZZ   = model->MakeField<float>("kinfit_mass_ZZ");
+    fields.kinfit_chi2_ZZ   = model->MakeField<float>("kinfit_chi2_ZZ");
+    fields.kinfit_mass_ZH   = model->MakeField<float>("kinfit_mass_ZH");
+    fields.kinfit_chi2_ZH   = model->MakeField<float>("kinfit_chi2_ZH");
+    fields.tau1_gen_match   = model->MakeField<int>("tau1_gen_match");
+    fields.tau2_gen_match   = model->MakeField<int>("tau2_gen_match");
+    fields.b1_hadronFlavour = model->MakeField<int>("b1_hadronFlavour");
+    fields.b2_hadronFlavour = model->MakeField<int>("b2_hadronFlavour");
+    if (_scan.size() > 0) {
+        fields.scan_mass = model->MakeField<std::vector<float>>("kinfit_scan_mass");
+        fields.scan_chi2 = model->MakeField<std::vector<float>>("kinfit_scan_chi2");
+    }
+    return model;
+}
+
+void NTupleEvtWriter::fill_block(const RecBuffer& recs, const unsigned int& first, const unsigned int& n, const unsigned int* folds) {
+    for (unsigned int i = 0; i < n; i++) {
+        Fields& fields = _fields[folds[i]];
+        const float* feats = recs.feats(first+i);
+        const EvtMeta& meta = recs.meta(first+i);
+        for (unsigned int j = 0; j < fields.feats.size(); j++) *fields.feats[j] = truncate_mantissa(feats[j], _feat_bits[j]);
+        *fields.weight           = truncate_mantissa(meta.weight, _weight_bits);
+        *fields.sample           = meta.sample;
+        *fields.region           = meta.region;
+        *fields.jet_cat          = meta.jet_cat;
+        *fields.strat_key        = meta.strat_key;
+        *fields.evt              = meta.evt;
+        *fields.dataset          = meta.dataset_id;
+        *fields.kinfit_mass_ZZ   = truncate_mantissa(meta.kinfit_mass_ZZ, _kinfit_bits[0]);
+        *fields.kinfit_chi2_ZZ   = truncate_mantissa(meta.kinfit_chi2_ZZ, _kinfit_bits[1]);
+        *fields.kinfit_mass_ZH   = truncate_mantissa(meta.kinfit_mass_ZH, _kinfit_bits[2]);
+        *fields.kinfit_chi2_ZH   = truncate_mantissa(meta.kinfit_chi2_ZH, _kinfit_bits[3]);
+        *fields.tau1_gen_match   = meta.tau1_gen_match;
+        *fields.tau2_gen_match   = meta.tau2_gen_match;
+        *fields.b1_hadronFlavour = meta.b1_hadronFlavour;
+        *fields.b2_hadronFlavour = meta.b2_hadronFlavour;
+        if (_scan.size() > 0) {
+            fields.scan_mass->resize(_scan.size());
+            fields.scan_chi2->resize(_scan.size());
+            for (unsigned int j = 0; j < _scan.size(); j++) {
+                (*fields.scan_mass)[j] = truncate_mantissa(recs.scan_mass(first+i)[j], _scan_bits[0]);
+                (*fields.scan_chi2)[j] = truncate_mantissa(recs.scan_chi2(first+i)[j], _scan_bits[1]);
+            }
+        }
+        _writers[folds[i]]->Fill();
+        _index.add(folds[i], meta.strat_key);
+    }
+}
+
+void NTupleEvtWriter::close() {
+    /* Writers commit their data and anchors on destruction, before the strat index is added and the file is closed */
+
+    if (!_file) return;
+    _writers.clear();
+    {
+        TDirectory::TContext ctx(_file.get());
+        TTree* index = _index.make_tree();
+        index->Write();
+        delete index;
+        if (_scan.size() > 0) TNamed("kinfit_scan_grid", KinFitter::describe_grid(_scan).c_str()).Write();
+    }
+    _file->Close();
+    _file.reset();
+}
+#endif
@@ -0,0 +1,169 @@
+#include "cms_runII_data_proc/processing/interface/feat_deps.hh"
+
+std::vector<unsigned int> FeatDeps::probe(const unsigned int& n_feats, const FeatDeps::Evaluator& eval, std::vector<bool>& unprobed,
+                                          const unsigned int& n_trials) {
+    /*
+    Return the mask of input groups each of the n_feats features depends on. eval computes the features of an event; the trial
+    index lets it vary the channel and year. Events have every object present, since some features only use an object if
+    it exists, and the convergence of SVfit and the KinFit varies, so that features gated on them are caught. The signal
+    parameters are redrawn per trial, so that features only computed for some spins or couplings are caught too.
+    A feature which is never finite cannot show a change, so it is flagged in unprobed and given every group.
+    */
+
+    auto same = [](const float& a, const float& b) { return a == b || (std::isnan(a) && std::isnan(b)); };
+
+    TRandom3 rng(1);
+    std::vector<unsigned int> deps(n_feats, 0);
+    std::vector<float> ref(n_feats), vals(n_feats);
+    unprobed.assign(n_feats, true);
+    for (unsigned int t = 0; t < n_trials; t++) {
+        EvtInput base = {};
+        base.weight       = 1;
+        base.sample       = -1;
+        base.spin         = Spin((t/9)%3);
+        base.klambda      = rng.Uniform(-20, 20);
+        base.res_mass     = rng.Uniform(250, 1000);
+        base.cv           = rng.Uniform(-2, 2);
+        base.c2v          = rng.Uniform(-2, 4);
+        base.c3           = rng.Uniform(-10, 10);
+        base.is_boosted   = t%2 == 1;
+        base.has_b_pair   = true;
+        base.has_vbf_pair = t%4 != 3;
+        for (int g = 0; g < n_input_groups; g++) FeatDeps::_draw_group(base, InputGroup(g), rng);
+        eval(base, t, ref);
+        for (unsigned int i = 0; i < n_feats; i++) {
+            if (std::isfinite(ref[i])) unprobed[i] = false;
+        }
+
+        for (int g = 0; g < n_input_groups; g++) {
+            EvtInput evt = base;
+            FeatDeps::_draw_group(evt, InputGroup(g), rng);
+            eval(evt, t, vals);
+            for (unsigned int i = 0; i < n_feats; i++) {
+                if (!same(ref[i], vals[i])) deps[i] |= 1U << g;
+                if (std::isfinite(vals[i])) unprobed[i] = false;
+            }
+        }
+    }
+    for (unsigned int i = 0; i < n_feats; i++) {
+        if (unprobed[i]) deps[i] = ALL_INPUT_GROUPS;
+    }
+    return deps;
+}
+
+void FeatDeps::_draw_vector(float& pT, float& eta, float& phi, float& mass, const double& mean_pT, const double& max_mass,
+                            TRandom3& rng) {
+    pT   = 20+rng.Exp(mean_pT);
+    eta  = rng.Uniform(-2.4, 2.4);
+    phi  = rng.Uniform(-M_PI, M_PI);
+    mass = rng.Uniform(0.1, max_mass);
+}
+
+void FeatDeps::_draw_group(EvtInput& evt, const InputGroup& group, TRandom3& rng) {
+    /* Redraw every branch of the group with a plausible random value */
+
+    switch (group) {
+        case grp_hl_kinfit:
+            evt.kinfit_mass = rng.Uniform(250, 1000);
+            evt.kinfit_chi2 = rng.Rndm() < 0.25 ? -1 : rng.Exp(5);  // Negative = not converged
+            break;
+        case grp_mt2:
+            evt.mt2 = rng.Exp(80);
+            break;
+        case grp_csv:
+            evt.b_1_csv = rng.Rndm();
+            evt.b_2_csv = rng.Rndm();
+            break;
+        case grp_jet_tags:
+            for (float* v : {&evt.b_1_hhbtag, &evt.b_1_cvsl, &evt.b_1_cvsb, &evt.b_2_hhbtag, &evt.b_2_cvsl, &evt.b_2_cvsb,
+                             &evt.vbf_1_hhbtag, &evt.vbf_1_cvsl, &evt.vbf_1_cvsb, &evt.vbf_2_hhbtag, &evt.vbf_2_cvsl,
+                             &evt.vbf_2_cvsb}) *v = rng.Rndm();
+            break;
+        case grp_svfit:
+            FeatDeps::_draw_vector(evt.svfit_pT, evt.svfit_eta, evt.svfit_phi, evt.svfit_mass, 60, 250, rng);
+            if (rng.Rndm() < 0.25) evt.svfit_mass = -1;  // Not converged
+            break;
+        case grp_l_1:
+            FeatDeps::_draw_vector(evt.l_1_pT, evt.l_1_eta, evt.l_1_phi, evt.l_1_mass, 40, 1.7, rng);
+            break;
+        case grp_l_2:
+            FeatDeps::_draw_vector(evt.l_2_pT, evt.l_2_eta, evt.l_2_phi, evt.l_2_mass, 30, 1.7, rng);
+            break;
+        case grp_met:
+            evt.met_pT  = rng.Exp(40);
+            evt.met_phi = rng.Uniform(-M_PI, M_PI);
+            break;
+        case grp_met_cov:
+            evt.met_cov_00 = rng.Uniform(100, 800);
+            evt.met_cov_11 = rng.Uniform(100, 800);
+            evt.met_cov_01 = rng.Uniform(-0.3, 0.3)*std::sqrt(evt.met_cov_00*evt.met_cov_11);
+            break;
+        case grp_b_1:
+            FeatDeps::_draw_vector(evt.b_1_pT, evt.b_1_eta, evt.b_1_phi, evt.b_1_mass, 60, 20, rng);
+            break;
+        case grp_b_2:
+            FeatDeps::_draw_vector(evt.b_2_pT, evt.b_2_eta, evt.b_2_phi, evt.b_2_mass, 40, 20, rng);
+            break;
+        case grp_vbf_1:
+            FeatDeps::_draw_vector(evt.vbf_1_pT, evt.vbf_1_eta, evt.vbf_1_phi, evt.vbf_1_mass, 60, 20, rng);
+            break;
+        case grp_vbf_2:
+            FeatDeps::_draw_vector(evt.vbf_2_pT, evt.vbf_2_eta, evt.vbf_2_phi, evt.vbf_2_mass, 40, 20, rng);
+            break;
+        default:
+            throw std::invalid_argument("Invalid input group " + std::to_string(group));
+    }
+}
+
+std::vector<std::string> FeatDeps::get_kinfit_columns() {
+    /* Metadata columns computed by the ZZ/ZH KinFit stage */
+
+    return {"kinfit_mass_ZZ", "kinfit_chi2_ZZ", "kinfit_mass_ZH", "kinfit_chi2_ZH"};
+}
+
+bool FeatDeps::split_requested(const std::vector<std::string>& requested, std::vector<std::string>& feats) {
+    /* Copy the requested names which are EvtProc features into feats; returns whether any KinFit column was requested */
+
+    std::vector<std::string> kinfit = FeatDeps::get_kinfit_columns();
+    bool need_kinfit = false;
+    feats.clear();
+    for (const std::string& r : requested) {
+        if (std::find(kinfit.begin(), kinfit.end(), r) != kinfit.end()) {
+            need_kinfit = true;
+        } else {
+            feats.push_back(r);
+        }
+    }
+    return need_kinfit;
+}
+
+std::string FeatDeps::get_group_name(const InputGroup& group) {
+    switch (group) {
+        case grp_hl_kinfit: return "hh_kinfit";
+        case grp_mt2:       return "mt2";
+        case grp_csv:       return "csv";
+        case grp_jet_tags:  return "jet_tags";
+        case grp_svfit:     return "svfit";
+        case grp_l_1:       return "l_1";
+        case grp_l_2:       return "l_2";
+        case grp_met:       return "met";
+        case grp_met_cov:   return "met_cov";
+        case grp_b_1:       return "b_1";
+        case grp_b_2:       return "b_2";
+        case grp_vbf_1:     return "vbf_1";
+        case grp_vbf_2:     return "vbf_2";
+        default:            return "unknown";
+    }
+}
+
+std::string FeatDeps::describe(const unsigned int& groups) {
+    /* Comma-separated names of the groups in the mask */
+
+    std::string desc;
+    for (int g = 0; g < n_input_groups; g++) {
+        if (!(groups & 1U << g)) continue;
+        if (desc != "") desc += ", ";
+        desc += FeatDeps::get_group_name(InputGroup(g));
+    }
+    return desc == "" ? "none" : desc;
+}
@@ -1,310 +1,1187 @@
 #include "cms_runII_data_proc/processing/interface/file_looper.hh"
-#include "cms_runII_data_proc/processing/interface/kinfitter.hh"
-
-int use_kl = 1;
 
 
 FileLooper::FileLooper(bool return_all, std::vector<std::string> requested, bool use_deep_bjet_wps,
-                       bool inc_all_jets, bool inc_other_regions, bool inc_data, bool only_kl1, bool only_sm_vbf) {
-    _evt_proc = new EvtProc(return_all, requested, use_deep_bjet_wps);
+                       bool inc_all_jets, bool inc_other_regions, bool inc_data, bool only_kl1, bool only_sm_vbf,
+                       OutFormat out_format) {
+    _all = return_all;
+    _requested = requested;
+    _run_kinfit = FeatDeps::split_requested(requested, _proc_requested) || return_all;
+    _use_deep_csv = use_deep_bjet_wps;
+    _evt_proc = new EvtProc(return_all, _proc_requested, use_deep_bjet_wps);
     _feat_names = _evt_proc->get_feats();
     _n_feats = _feat_names.size();
+    _input_groups = ALL_INPUT_GROUPS;
+    _kin_objects = ALL_KIN_OBJECTS;
+    if (!_all) FileLooper::_set_input_groups();
     _inc_all_jets = inc_all_jets;
     _inc_other_regions = inc_other_regions;
     _inc_data = inc_data;
     _only_kl1 = only_kl1;
     _only_sm_vbf = only_sm_vbf;
+    _kinfit_cache = nullptr;
+    _out_format = out_format;
+    _io_profile = EvtWriter::get_profile("default");
+    _checkpoint_every = 0;
+    _metrics_interval = 10;
+    _fold_spec = {2, 0};
+    _shard = 0;
+    _n_shards = 1;
+    _range_first = 0;
+    _range_last = -1;
 }
 
 FileLooper::~FileLooper() {
     delete _evt_proc;
+    delete _kinfit_cache;
+}
+
+void FileLooper::set_io_profile(const std::string& profile) {
+    /* Set compression, basket size, and AutoFlush of outputs; either a preset name or algorithm:level:basket_size:auto_flush */
+
+    _io_profile = EvtWriter::get_profile(profile);
+}
+
+void FileLooper::set_storage(const std::string& policy) {
+    /* Set how output columns are stored; either a preset name or comma-separated pattern=type rules (see StoragePolicy) */
+
+    _storage = StoragePolicy(policy);
+    if (!_storage.is_full()) std::cout << "Output storage policy: " << _storage.get_spec() << "\n";
+}
+
+void FileLooper::set_hists(const std::string& spec) {
+    /*
+    Book the histograms written by histogram output, as comma-separated column:n_bins:lo:hi (see HistEvtWriter). Columns may
+    be computed features or metadata
+    */
+
+    _hist_specs = HistEvtWriter::parse_booking(spec);
+    if (_hist_specs.size() > 0) std::cout << "Booked " << _hist_specs.size() << " histograms per category\n";
+}
+
+EvtWriter* FileLooper::_create_writer(const std::string& oname) {
+    /* Writer of the output format, with the booked histograms for histogram output */
+
+    if (_out_format == out_hist) return new HistEvtWriter(oname, _feat_names, _hist_specs, _io_profile);
+    return EvtWriter::create(_out_format, oname, _feat_names, _io_profile, _fold_spec, _kinfit_scan, _storage);
+}
+
+void FileLooper::set_checkpoint(const long int& n_events) {
+    /*
+    Save a checkpoint of loop_file every n_events written events (never if n_events <= 0), and resume interrupted runs
+    from their last checkpoint. Requires tree output.
+    */
+
+    if (n_events > 0 && _out_format != out_tree) throw std::invalid_argument("Checkpoints are only supported for tree output");
+    _checkpoint_every = n_events > 0 ? n_events : 0;
+}
+
+void FileLooper::set_folds(const unsigned int& n_folds, const unsigned long long int& seed) {
+    /*
+    Split the output into n_folds trees, data_0 ... data_{n_folds-1}, by evt % n_folds, or by a hash of evt seeded with seed
+    if seed is non-zero. The default of 2 folds and seed 0 is the even/odd split.
+    */
+
+    if (n_folds < 1) throw std::invalid_argument("Number of folds must be at least 1");
+    _fold_spec = {n_folds, seed};
+}
+
+inline unsigned int FileLooper::_get_split(const unsigned long long int& evt) {
+    return _fold_spec.get_fold(evt);
 }
 
-bool FileLooper::loop_file(const std::string& in_dir, const std::string& out_dir, const std::string& channel, const std::string& year, const long int& n_events) {
+void FileLooper::set_metrics(const std::string& fname, const double& interval) {
+    /* Write per-stage timings and I/O totals of each loop as JSON to fname every interval seconds; disabled if fname is empty */
+
+    if (interval <= 0) throw std::invalid_argument("Metrics interval must be positive");
+    _metrics_fname = fname;
+    _metrics_interval = interval;
+}
+
+void FileLooper::set_shard(const unsigned int& shard, const unsigned int& n_shards) {
+    /*
+    Make loop_file process only shard {shard} of {n_shards} equal entry ranges of the input, writing it to get_shard_name.
+    Shards can run as separate processes, and their outputs are combined by merge_shards.
+    */
+
+    if (n_shards < 1 || shard >= n_shards) {
+        throw std::invalid_argument("Invalid shard " + std::to_string(shard) + " of " + std::to_string(n_shards));
+    }
+    _shard = shard;
+    _n_shards = n_shards;
+    _range_first = 0;
+    _range_last = -1;
+}
+
+void FileLooper::set_entry_range(const long int& first, const long int& last) {
+    /*
+    Make loop_file process only input entries [first, last) (to the end if last < 0), writing them to
+    {out_dir}/{year}_{channel}.entries_{first}_{last}.root. Resets any shard
+    */
+
+    if (first < 0 || (last >= 0 && last <= first)) {
+        throw std::invalid_argument("Invalid entry range " + std::to_string(first) + " - " + std::to_string(last));
+    }
+    _shard = 0;
+    _n_shards = 1;
+    _range_first = first;
+    _range_last = last;
+}
+
+std::string FileLooper::get_shard_name(const std::string& out_dir, const std::string& channel, const std::string& year,
+                                       const unsigned int& shard, const unsigned int& n_shards) {
+    /* Output name of a shard; a single shard is the whole file */
+
+    if (n_shards <= 1) return out_dir+"/"+year+"_"+channel+".root";
+    return out_dir+"/"+year+"_"+channel+".shard_"+std::to_string(shard)+"_of_"+std::to_string(n_shards)+".root";
+}
+
+void FileLooper::merge_shards(const std::string& out_dir, const std::string& channel, const std::string& year,
+                              const unsigned int& n_shards) {
+    /* Concatenate the outputs of all shards of a file into {out_dir}/{year}_{channel}.root, as if it had been run unsharded */
+
+    if (n_shards <= 1) return;
+    std::vector<std::string> parts;
+    for (unsigned int i = 0; i < n_shards; i++) {
+        parts.push_back(FileLooper::get_shard_name(out_dir, channel, year, i, n_shards));
+        if (gSystem->AccessPathName(parts.back().c_str())) throw std::runtime_error("Missing shard output " + parts.back());
+    }
+    FileLooper::_merge_parts(parts, out_dir+"/"+year+"_"+channel+".root");
+}
+
+void FileLooper::set_kinfit_scan(const std::string& spec) {
+    /*
+    Also fit every (mh1, mh2) hypothesis of the grid given by spec (see KinFitter::parse_grid) to each event, writing the
+    results as the kinfit_scan_mass and kinfit_scan_chi2 arrays. An empty spec turns the scan off
+    */
+
+    _kinfit_scan = spec == "" ? KinFitGrid() : KinFitter::parse_grid(spec);
+    if (_kinfit_scan.size() == 0) return;
+    _input_groups |= KINFIT_INPUT_GROUPS;
+    std::cout << "Scanning " << _kinfit_scan.size() << " KinFit hypotheses: " << KinFitter::describe_grid(_kinfit_scan) << "\n";
+}
+
+void FileLooper::set_kinfit_cache(const std::string& fname) {
+    /* Reuse ZZ/ZH KinFit results stored in {fname} from previous runs, and add new results to it at the end of each loop */
+
+    delete _kinfit_cache;
+    _kinfit_cache = new KinFitCache(fname);
+}
+
+bool FileLooper::loop_file(const std::string& in_dir, const std::string& out_dir, const std::string& channel, const std::string& year, const long int& n_events,
+                           const unsigned int& n_threads) {
     /*
     Loop though file {in_dir}/{year}_{channel}.root processing {n_events} (all events if n_events < 0).
     Processed events will be saved to one of two trees inside {out_dir}/{year}_{channel}_{tagger}.root:
     Even event IDs will be saved to data_0 and odd to data_1.
+    If n_threads > 1, events are read on one thread, processed by a pool of n_threads workers, and written in input order,
+    giving the same output as the serial loop.
+    If checkpoints are enabled, an interrupted run of the same file continues from its last checkpoint.
+    If a shard or entry range is set, only its entries are processed, into an output named after it.
+    The cutflow of the selection and the sums of weights per category are stored in the output (see Cutflow).
     */
 
     std::string fname = in_dir+"/"+year+"_"+channel+"_Central.root";
     std::cout << "Reading from file: " << fname << "\n";
     TFile* in_file = TFile::Open(fname.c_str());
-    TTreeReader reader(channel.c_str(), in_file);
-    TTreeReader aux_reader("aux", in_file);
+    TTree* in_tree = nullptr;
+    in_file->GetObject(channel.c_str(), in_tree);
+    if (in_tree == nullptr) throw std::invalid_argument("No tree " + channel + " in " + fname);
 
     // Enums
-    Channel e_channel = FileLooper::_get_channel(channel);
-    Year e_year = FileLooper::_get_year(year);
-    Spin spin(nonres);
-    float klambda, cv, c2v, c3;
+    EvtKernel kernel = FileLooper::_get_kernel(FileLooper::_get_channel(channel), FileLooper::_get_year(year));
 
     // Meta info
     std::cout << "Extracting auxiliary data...";
-
-    TTreeReaderValue<unsigned long long> rv_evt(reader, "evt");
-    TTreeReaderValue<float> rv_weight(reader, "weight");
-    TTreeReaderValue<UInt_t> rv_dataset_id(reader, "dataset");
-    TTreeReaderValue<UInt_t> rv_region_id(reader, "event_region");
     std::map<unsigned, std::string> id2dataset = FileLooper::build_dataset_id_map(in_file);
     std::map<unsigned, std::string> id2region = FileLooper::build_region_id_map(in_file);
+    SampleCatalog catalog(id2dataset, id2region);
     std::cout << " Extracted\n";
-    
-    float weight, res_mass;
-    int sample, region, jet_cat, n_vbf, class_id;
-    unsigned long long int strat_key, evt;
-    bool svfit_conv, hh_kinfit_conv;
-
-    // Gen Info
-    TTreeReaderValue<int> rv_tau1_gen_match(reader, "tau1_gen_match");
-    TTreeReaderValue<int> rv_tau2_gen_match(reader, "tau2_gen_match");
-    TTreeReaderValue<int> rv_b1_hadronFlavour(reader, "b1_hadronFlavour");
-    TTreeReaderValue<int> rv_b2_hadronFlavour(reader, "b2_hadronFlavour");
-    int tau1_gen_match, tau2_gen_match, b1_hadronFlavour, b2_hadronFlavour;
-
-    // HL feats
-    TTreeReaderValue<float> rv_kinfit_mass(reader, "kinFit_m");
-    TTreeReaderValue<float> rv_kinfit_chi2(reader, "kinFit_chi2");
-    TTreeReaderValue<float> rv_mt2(reader, "MT2");
-    float kinfit_mass, kinfit_chi2, mt2;
-
-    // ZZ & ZH KinFit;
-    std::pair<float,float> kinfit_ZZ, kinfit_ZH;
-    std::vector<float> kinINinfo;
-
-    // Tagging
-    TTreeReaderValue<float> rv_b_1_csv(reader, "b1_DeepFlavour");
-    TTreeReaderValue<float> rv_b_2_csv(reader, "b2_DeepFlavour");
-    TTreeReaderValue<bool> rv_is_boosted(reader, "is_boosted");
-    TTreeReaderValue<bool> rv_has_b_pair(reader, "has_b_pair");
-    TTreeReaderValue<bool> rv_has_vbf_pair(reader, "has_VBF_pair");
-    TTreeReaderValue<int> rv_num_btag_loose(reader, "num_btag_Loose");
-    TTreeReaderValue<int> rv_num_btag_medium(reader, "num_btag_Medium");
-    float b_1_csv, b_2_csv;
-    bool is_boosted, has_vbf_pair, has_b_pair;
-    int num_btag_loose, num_btag_medium;
-
-    // SVFit feats
-    TTreeReaderValue<float> rv_svfit_pT(reader, "SVfit_pt");
-    TTreeReaderValue<float> rv_svfit_eta(reader, "SVfit_eta");
-    TTreeReaderValue<float> rv_svfit_phi(reader, "SVfit_phi");
-    TTreeReaderValue<float> rv_svfit_mass(reader, "SVfit_m");
-    LorentzVectorPEP pep_svfit;
-    LorentzVector svfit;
-
-    // l1 feats
-    TTreeReaderValue<float> rv_l_1_pT(reader, "tau1_pt");
-    TTreeReaderValue<float> rv_l_1_eta(reader, "tau1_eta");
-    TTreeReaderValue<float> rv_l_1_phi(reader, "tau1_phi");
-    TTreeReaderValue<float> rv_l_1_mass(reader, "tau1_m");
-    float l_1_mass;
-    LorentzVectorPEP pep_l_1;
-    LorentzVector l_1;
-
-    // l2 feats
-    TTreeReaderValue<float> rv_l_2_pT(reader, "tau2_pt");
-    TTreeReaderValue<float> rv_l_2_eta(reader, "tau2_eta");
-    TTreeReaderValue<float> rv_l_2_phi(reader, "tau2_phi");
-    TTreeReaderValue<float> rv_l_2_mass(reader, "tau2_m");
-    LorentzVectorPEP pep_l_2;
-    LorentzVector l_2;
-
-    // MET feats
-    TTreeReaderValue<float> rv_met_pT(reader, "MET_pt");
-    TTreeReaderValue<float> rv_met_phi(reader, "MET_phi");
-    TTreeReaderValue<float> rv_met_cov_00(reader, "MET_cov_00");
-    TTreeReaderValue<float> rv_met_cov_01(reader, "MET_cov_01");
-    TTreeReaderValue<float> rv_met_cov_11(reader, "MET_cov_11");
-    LorentzVectorPEP pep_met;
-    LorentzVector met;
-
-    // b1 feats
-    TTreeReaderValue<float> rv_b_1_pT(reader, "b1_pt");
-    TTreeReaderValue<float> rv_b_1_eta(reader, "b1_eta");
-    TTreeReaderValue<float> rv_b_1_phi(reader, "b1_phi");
-    TTreeReaderValue<float> rv_b_1_mass(reader, "b1_m");
-    TTreeReaderValue<float> rv_b_1_hhbtag(reader, "b1_HHbtag");
-    TTreeReaderValue<float> rv_b_1_cvsl(reader, "b1_DeepFlavour_CvsL");
-    TTreeReaderValue<float> rv_b_1_cvsb(reader, "b1_DeepFlavour_CvsB");
-    float b_1_hhbtag, b_1_cvsl, b_1_cvsb;
-    LorentzVectorPEP pep_b_1;
-    LorentzVector b_1;
-
-    // b2 feats
-    TTreeReaderValue<float> rv_b_2_pT(reader, "b2_pt");
-    TTreeReaderValue<float> rv_b_2_eta(reader, "b2_eta");
-    TTreeReaderValue<float> rv_b_2_phi(reader, "b2_phi");
-    TTreeReaderValue<float> rv_b_2_mass(reader, "b2_m");
-    TTreeReaderValue<float> rv_b_2_hhbtag(reader, "b2_HHbtag");
-    TTreeReaderValue<float> rv_b_2_cvsl(reader, "b2_DeepFlavour_CvsL");
-    TTreeReaderValue<float> rv_b_2_cvsb(reader, "b2_DeepFlavour_CvsB");
-    float b_2_hhbtag, b_2_cvsl, b_2_cvsb;
-    LorentzVectorPEP pep_b_2;
-    LorentzVector b_2;
-
-    // vbf1 feats
-    TTreeReaderValue<float> rv_vbf_1_pT(reader, "VBF1_pt");
-    TTreeReaderValue<float> rv_vbf_1_eta(reader, "VBF1_eta");
-    TTreeReaderValue<float> rv_vbf_1_phi(reader, "VBF1_phi");
-    TTreeReaderValue<float> rv_vbf_1_mass(reader, "VBF1_m");
-    TTreeReaderValue<float> rv_vbf_1_hhbtag(reader, "VBF1_HHbtag");
-    TTreeReaderValue<float> rv_vbf_1_cvsl(reader, "VBF1_DeepFlavour_CvsL");
-    TTreeReaderValue<float> rv_vbf_1_cvsb(reader, "VBF1_DeepFlavour_CvsB");
-    float vbf_1_hhbtag, vbf_1_cvsl, vbf_1_cvsb;
-    LorentzVectorPEP pep_vbf_1;
-    LorentzVector vbf_1;
-
-    // vbf2 feats
-    TTreeReaderValue<float> rv_vbf_2_pT(reader, "VBF2_pt");
-    TTreeReaderValue<float> rv_vbf_2_eta(reader, "VBF2_eta");
-    TTreeReaderValue<float> rv_vbf_2_phi(reader, "VBF2_phi");
-    TTreeReaderValue<float> rv_vbf_2_mass(reader, "VBF2_m");
-    TTreeReaderValue<float> rv_vbf_2_hhbtag(reader, "VBF2_HHbtag");
-    TTreeReaderValue<float> rv_vbf_2_cvsl(reader, "VBF2_DeepFlavour_CvsL");
-    TTreeReaderValue<float> rv_vbf_2_cvsb(reader, "VBF2_DeepFlavour_CvsB");
-    float vbf_2_hhbtag, vbf_2_cvsl, vbf_2_cvsb;
-    LorentzVectorPEP pep_vbf_2;
-    LorentzVector vbf_2;
 
-    std::vector<std::unique_ptr<float>> feat_vals;
-    feat_vals.reserve(_n_feats);
-    for (unsigned int i = 0; i < _n_feats; i++) feat_vals.emplace_back(new float(0));
-    
-    // Outfiles
+    // Shard
+    long int range_first(_range_first), range_last(_range_last);
     std::string oname = out_dir+"/"+year+"_"+channel+".root";
+    if (_n_shards > 1) {
+        range_first = _shard*in_tree->GetEntries()/_n_shards;
+        range_last  = (_shard+1)*in_tree->GetEntries()/_n_shards;
+        oname = FileLooper::get_shard_name(out_dir, channel, year, _shard, _n_shards);
+    } else if (range_first > 0 || range_last >= 0) {
+        oname = out_dir+"/"+year+"_"+channel+".entries_"+std::to_string(range_first)+"_"+std::to_string(range_last)+".root";
+    }
+    if (oname != out_dir+"/"+year+"_"+channel+".root") {
+        std::cout << "Processing entries " << range_first << " to " << (range_last >= 0 ? range_last : in_tree->GetEntries()) << "\n";
+    }
+
+    // Checkpoint
+    std::string ckpt_name = oname+".ckpt";
+    LoopState state = {-1, std::vector<long long int>(_fold_spec.n_folds, 0)};
+    bool resumed = false;
+    if (_checkpoint_every > 0) {
+        if (EvtWriter::read_state(oname, state)) {  // Keep the interrupted output as the checkpoint to resume from
+            if (std::rename(oname.c_str(), ckpt_name.c_str()) != 0) throw std::runtime_error("Unable to move checkpoint " + oname);
+            resumed = true;
+        } else {
+            resumed = EvtWriter::read_state(ckpt_name, state);  // Interrupted again before the first new checkpoint
+        }
+    }
+    if (state.n_saved.size() != _fold_spec.n_folds) {
+        throw std::invalid_argument("Checkpoint has " + std::to_string(state.n_saved.size()) + " folds but " +
+                                    std::to_string(_fold_spec.n_folds) + " were requested");
+    }
+    long int n_resumed = std::accumulate(state.n_saved.begin(), state.n_saved.end(), 0L);
+    long int n_remaining = n_events > 0 ? n_events-n_resumed : n_events;
+    if (resumed) std::cout << "Resuming after entry " << state.last_entry << " with " << n_resumed << " events already saved\n";
+
+    // Metrics
+    LoopMetrics* metrics = nullptr;
+    if (_metrics_fname != "") {
+        metrics = new LoopMetrics(_metrics_fname, year+"_"+channel, _metrics_interval, TFile::GetFileBytesRead(),
+                                  TFile::GetFileBytesWritten());
+    }
+
+    // Selection pass, which also counts the entries processed before resuming into the cutflow
+    std::cout << "Selecting events...";
+    long int first = std::max(range_first, (long int)state.last_entry+1);
+    long int last = range_last;
+    if (n_events > 0 && n_remaining <= 0) last = first;  // Nothing left to select
+    Cutflow cutflow;
+    TEntryList* entry_list;
+    {
+        StageTimer timer(metrics != nullptr ? metrics->new_counters() : nullptr, stage_select_pass);
+        entry_list = FileLooper::_build_entry_list(in_tree, catalog, n_remaining, range_first, last, &cutflow, first);
+    }
+    std::cout << " " << entry_list->GetN() << " / " << in_tree->GetEntries() << " entries selected\n";
+
+    // Inputs
+    in_tree->SetEntryList(entry_list);  // Lets the read cache skip clusters with no selected entries
+    TTreeReader reader(in_tree, entry_list);
+    EvtReader evt_reader(reader, _input_groups);
+
+    // Outfiles
     std::cout << "Preparing output file: " << oname << " ...";
-    TFile* out_file  = new TFile(oname.c_str(), "recreate");
-    TTree* data_even = new TTree("data_0", "Even id data");
-    TTree* data_odd  = new TTree("data_1", "Odd id data");
-    FileLooper::_prep_file(data_even, feat_vals, &weight, &sample, &region, &jet_cat, &class_id, &strat_key,
-                           &kinfit_ZZ.first, &kinfit_ZZ.second, &kinfit_ZH.first, &kinfit_ZH.second,
-                           &tau1_gen_match, &tau2_gen_match, &b1_hadronFlavour, &b2_hadronFlavour);
-    FileLooper::_prep_file(data_odd,  feat_vals, &weight, &sample, &region, &jet_cat, &class_id, &strat_key,
-                           &kinfit_ZZ.first, &kinfit_ZZ.second, &kinfit_ZH.first, &kinfit_ZH.second,
-                           &tau1_gen_match, &tau2_gen_match, &b1_hadronFlavour, &b2_hadronFlavour);
+    EvtWriter* writer = FileLooper::_create_writer(oname);
+    if (resumed) writer->resume(ckpt_name, state);
+    LoopState* ckpt_state = _checkpoint_every > 0 ? &state : nullptr;
     std::cout << "\tprepared.\nBeginning loop.\n";
 
+    long int n_saved_events;
+    if (n_threads > 1) {
+        n_saved_events = FileLooper::_loop_threaded(reader, evt_reader, catalog, kernel, writer, n_remaining,
+                                                    n_threads, ckpt_state, metrics);
+    } else {
+        n_saved_events = FileLooper::_loop_serial(reader, evt_reader, catalog, kernel, writer, n_remaining,
+                                                  _evt_proc, _kinfit_stats, ckpt_state, metrics);
+    }
+    n_saved_events += n_resumed;
+
+    Logger::get().flush();
+    std::cout << "Loop complete, saving " << n_saved_events << " events.\n";
+    FileLooper::_report_bytes_read(in_file, in_tree);
+    cutflow.print_summary();
+    _kinfit_stats.print_summary();
+    _kinfit_stats.clear();
+    if (_kinfit_cache != nullptr) {
+        _kinfit_cache->print_summary();
+        _kinfit_cache->save();
+    }
+    writer->close();
+    delete writer;
+    FileLooper::_write_cutflow(oname, cutflow);
+    if (resumed) std::remove(ckpt_name.c_str());
+    if (metrics != nullptr) {
+        metrics->set_bytes(TFile::GetFileBytesRead(), TFile::GetFileBytesWritten());
+        metrics->finish();
+        delete metrics;
+    }
+    in_tree->SetEntryList(nullptr);
+    delete entry_list;
+    in_file->Close();
+    return true;
+}
+
+bool FileLooper::augment_file(const std::string& in_dir, const std::string& out_dir, const std::string& channel,
+                              const std::string& year, const std::string& tag, const unsigned int& n_threads) {
+    /*
+    Add the requested columns (features, KinFit columns, and the KinFit scan) to an existing output {out_dir}/{year}_{channel}.root
+    without rewriting it. The selection is rerun on the input, only the inputs the new columns need are read, and the columns
+    are written to {out_dir}/{year}_{channel}.{tag}.root as friend trees data_0 ... data_{k-1}, entry-aligned with the base
+    trees and indexed by (evt, dataset), e.g. base->AddFriend("{tag}=data_0", "{year}_{channel}.{tag}.root").
+    The base output must be a TTree output made from the same input with the same selection and folds, and hold the evt and
+    dataset columns; every event is checked against the (evt, dataset) of the base entry it is aligned with.
+    */
+
+    if (_all) throw std::invalid_argument("Augmenting an output needs a list of columns to add, rather than all features");
+    if (tag == "") throw std::invalid_argument("Augmented columns need a tag to name their file");
+    std::vector<std::string> meta_columns;
+    for (const std::string& c : FeatDeps::get_kinfit_columns()) {
+        if (std::find(_requested.begin(), _requested.end(), c) != _requested.end()) meta_columns.push_back(c);
+    }
+    if (_n_feats == 0 && meta_columns.size() == 0 && _kinfit_scan.size() == 0) throw std::invalid_argument("No columns to add");
+
+    // Base output
+    std::string base_name = out_dir+"/"+year+"_"+channel+".root";
+    std::cout << "Reading base output: " << base_name << "\n";
+    TFile* base_file = TFile::Open(base_name.c_str());
+    if (base_file == nullptr || base_file->IsZombie()) throw std::invalid_argument("Unable to open " + base_name);
+    OutFormat base_format = EvtWriter::detect_format(base_file);
+    if (base_format != out_tree) {
+        throw std::invalid_argument(base_name + " is " + (base_format == out_hist ? "a histogram" : "an RNTuple") +
+                                    " output; only TTree outputs (-w tree or tree_async) can be augmented");
+    }
+    std::vector<std::vector<EvtId>> base_ids(_fold_spec.n_folds);
+    long int n_base = 0;
+    for (unsigned int i = 0; i <= _fold_spec.n_folds; i++) {
+        TTree* base_tree = nullptr;
+        base_file->GetObject(("data_"+std::to_string(i)).c_str(), base_tree);
+        if (i == _fold_spec.n_folds) {
+            if (base_tree != nullptr) throw std::invalid_argument(base_name + " has more than " + std::to_string(i) + " folds");
+            break;
+        }
+        if (base_tree == nullptr || std::string(base_tree->GetTitle()) != EvtWriter::get_tree_title(i, _fold_spec)) {
+            throw std::invalid_argument(base_name + " was not written with the requested folds");
+        }
+        if (base_tree->GetBranch("evt") == nullptr || base_tree->GetBranch("dataset") == nullptr) {
+            throw std::invalid_argument(base_name + " has no evt and dataset columns to align to; it must be reprocessed");
+        }
+        unsigned long long int evt;
+        unsigned int dataset;
+        base_tree->SetBranchStatus("*", 0);  // Only the event ids are read back
+        base_tree->SetBranchStatus("evt", 1);
+        base_tree->SetBranchStatus("dataset", 1);
+        base_tree->SetBranchAddress("evt", &evt);
+        base_tree->SetBranchAddress("dataset", &dataset);
+        base_ids[i].reserve(base_tree->GetEntries());
+        for (long long int j = 0; j < base_tree->GetEntries(); j++) {
+            base_tree->GetEntry(j);
+            base_ids[i].emplace_back(evt, dataset);
+        }
+        n_base += base_ids[i].size();
+    }
+    base_file->Close();
+    delete base_file;
+    if (n_base == 0) throw std::invalid_argument(base_name + " holds no events");
+    std::cout << n_base << " events in " << _fold_spec.n_folds << " folds\n";
+
+    // Inputs
+    std::string fname = in_dir+"/"+year+"_"+channel+"_Central.root";
+    std::cout << "Reading from file: " << fname << "\n";
+    TFile* in_file = TFile::Open(fname.c_str());
+    TTree* in_tree = nullptr;
+    in_file->GetObject(channel.c_str(), in_tree);
+    if (in_tree == nullptr) throw std::invalid_argument("No tree " + channel + " in " + fname);
+    EvtKernel kernel = FileLooper::_get_kernel(FileLooper::_get_channel(channel), FileLooper::_get_year(year));
+    SampleCatalog catalog(FileLooper::build_dataset_id_map(in_file), FileLooper::build_region_id_map(in_file));
+
+    std::cout << "Selecting events...";
+    TEntryList* entry_list = FileLooper::_build_entry_list(in_tree, catalog, n_base);
+    std::cout << " " << entry_list->GetN() << " / " << in_tree->GetEntries() << " entries selected\n";
+    if (entry_list->GetN() < n_base) {
+        throw std::runtime_error("Input selects " + std::to_string(entry_list->GetN()) + " events, fewer than the " +
+                                 std::to_string(n_base) + " of " + base_name);
+    }
+    in_tree->SetEntryList(entry_list);
+    TTreeReader reader(in_tree, entry_list);
+    EvtReader evt_reader(reader, _input_groups);
+
+    // Friend trees
+    std::string oname = out_dir+"/"+year+"_"+channel+"."+tag+".root";
+    std::cout << "Preparing friend file: " << oname << " ...";
+    FriendTreeEvtWriter* writer = new FriendTreeEvtWriter(oname, _feat_names, meta_columns, _io_profile, _fold_spec,
+                                                          _kinfit_scan, _storage);
+    writer->set_base_ids(std::move(base_ids));
+    std::cout << "\tprepared.\nBeginning loop.\n";
+
+    long int n_saved_events;
+    if (n_threads > 1) {
+        n_saved_events = FileLooper::_loop_threaded(reader, evt_reader, catalog, kernel, writer, n_base, n_threads);
+    } else {
+        n_saved_events = FileLooper::_loop_serial(reader, evt_reader, catalog, kernel, writer, n_base, _evt_proc, _kinfit_stats);
+    }
+    if (n_saved_events != n_base) {
+        throw std::runtime_error("Augmented " + std::to_string(n_saved_events) + " events, but " + base_name + " holds " +
+                                 std::to_string(n_base));
+    }
+
+    Logger::get().flush();
+    std::cout << "Loop complete, adding " << _feat_names.size()+meta_columns.size()+(_kinfit_scan.size() > 0 ? 2 : 0)
+              << " columns to " << n_saved_events << " events.\n";
+    FileLooper::_report_bytes_read(in_file, in_tree);
+    _kinfit_stats.print_summary();
+    _kinfit_stats.clear();
+    if (_kinfit_cache != nullptr) {
+        _kinfit_cache->print_summary();
+        _kinfit_cache->save();
+    }
+    writer->close();
+    delete writer;
+    in_tree->SetEntryList(nullptr);
+    delete entry_list;
+    in_file->Close();
+    return true;
+}
+
+long int FileLooper::_loop_serial(TTreeReader& reader, EvtReader& evt_reader, const SampleCatalog& catalog, const EvtKernel& kernel,
+                                  EvtWriter* writer, const long int& n_events, EvtProc* evt_proc,
+                                  KinFitStats& kinfit_stats, LoopState* state, LoopMetrics* metrics, const bool& verbose) {
+    /*
+    Read, process, and write batches of accepted events on the calling thread. Progress is only printed if verbose.
+    If state is given, it is updated with each event and checkpoints are saved. If metrics is given, stages are timed.
+    */
+
+    StageCounters* counters = metrics != nullptr ? metrics->new_counters() : nullptr;
+    EvtBatch batch(EVT_BATCH_SIZE, _n_feats, _kinfit_scan.size());  // Fields of input groups which are not read stay zero
+    std::unique_ptr<KinBlock> block(new KinBlock());
+    KinFitter fitter;
+    std::vector<std::unique_ptr<float>> feat_vals;
+    feat_vals.reserve(_n_feats);
+    for (unsigned int i = 0; i < _n_feats; i++) feat_vals.emplace_back(new float(0));
+
     long int c_event(0), n_saved_events(0), n_tot_events(reader.GetEntries(true));
-    while (reader.Next()) {
-        c_event++;
-        if (c_event%1000 == 0) std::cout << c_event << " / " << n_tot_events << "\n";
-
-        // Load meta
-        weight = *rv_weight;
-        evt    = *rv_evt;
-        
-        FileLooper::_sample_lookup(id2dataset[*rv_dataset_id], sample, spin, klambda, res_mass, cv, c2v, c3);
-        class_id = FileLooper::_sample2class_lookup(sample);
-        
-        region = FileLooper::_region_lookup(id2region[*rv_region_id]);
-        
-        is_boosted = *rv_is_boosted;
-        has_vbf_pair = *rv_has_vbf_pair;
-        has_b_pair = *rv_has_b_pair;
-        num_btag_loose = *rv_num_btag_loose;
-        num_btag_medium = *rv_num_btag_medium;
-
-        jet_cat = FileLooper::_jet_cat_lookup(has_b_pair, has_vbf_pair, is_boosted, num_btag_loose, num_btag_medium);
-        
-        if (!FileLooper::_accept_evt(region, jet_cat, class_id, klambda, cv, c2v, c3)) continue;
-        n_saved_events++;
-
-        strat_key = FileLooper::_get_strat_key(sample, jet_cat, e_channel, e_year, region);
-
-        // Gen info
-        tau1_gen_match = *rv_tau1_gen_match;
-        tau2_gen_match = *rv_tau2_gen_match;
-        b1_hadronFlavour = *rv_b1_hadronFlavour;
-        b2_hadronFlavour = *rv_b2_hadronFlavour;
-
-        // Load HL feats
-        kinfit_mass   = *rv_kinfit_mass;
-        kinfit_chi2   = *rv_kinfit_chi2;
-        mt2           = *rv_mt2;
-        b_1_hhbtag    = *rv_b_1_hhbtag;
-        b_2_hhbtag    = *rv_b_2_hhbtag;
-        vbf_1_hhbtag  = *rv_vbf_1_hhbtag;
-        vbf_2_hhbtag  = *rv_vbf_2_hhbtag;
-        b_1_cvsl      = *rv_b_1_cvsl;
-        b_2_cvsl      = *rv_b_2_cvsl;
-        vbf_1_cvsl    = *rv_vbf_1_cvsl;
-        vbf_2_cvsl    = *rv_vbf_2_cvsl;
-        b_1_cvsb      = *rv_b_1_cvsb;
-        b_2_cvsb      = *rv_b_2_cvsb;
-        vbf_1_cvsb    = *rv_vbf_1_cvsb;
-        vbf_2_cvsb    = *rv_vbf_2_cvsb;
-
-        // Load tagging
-        b_1_csv     = *rv_b_1_csv;
-        b_2_csv     = *rv_b_2_csv;
-
-        // Load vectors
-        pep_svfit.SetCoordinates(*rv_svfit_pT, *rv_svfit_eta, *rv_svfit_phi, *rv_svfit_mass);
-        if (channel == "muTau") {  // Fix mass for light leptons
-            l_1_mass = MU_MASS;
-        } else if (channel == "eTau") {
-            l_1_mass = E_MASS;
-        } else {
-            l_1_mass = *rv_l_1_mass;
+    bool done(false);
+    while (!done) {
+        batch.n = 0;
+        while (batch.n < EVT_BATCH_SIZE) {
+            if (!reader.Next()) {
+                done = true;
+                break;
+            }
+            c_event++;
+            if (c_event%1000 == 0) {
+                if (verbose) LOG_MSG(log_info, c_event << " / " << n_tot_events);
+                if (metrics != nullptr) metrics->set_bytes(TFile::GetFileBytesRead(), TFile::GetFileBytesWritten());
+            }
+
+            EvtInput& evt = batch.inputs[batch.n];
+            evt.entry = reader.GetTree()->GetReadEntry();
+            if (!(this->*kernel.read_evt)(evt_reader, evt, catalog, counters)) continue;
+            batch.n++;
+            n_saved_events++;
+            if (n_events > 0 && n_saved_events >= n_events) {
+                if (verbose) LOG_MSG(log_info, "Exiting after " << n_saved_events << " events.");
+                done = true;
+                break;
+            }
         }
-        pep_l_1.SetCoordinates(*rv_l_1_pT, *rv_l_1_eta, *rv_l_1_phi, l_1_mass);
-        pep_l_2.SetCoordinates(*rv_l_2_pT, *rv_l_2_eta, *rv_l_2_phi, *rv_l_2_mass);
-        pep_met.SetCoordinates(*rv_met_pT, 0,           *rv_met_phi, 0);
-        pep_b_1.SetCoordinates(*rv_b_1_pT, *rv_b_1_eta, *rv_b_1_phi, *rv_b_1_mass);
-        pep_b_2.SetCoordinates(*rv_b_2_pT, *rv_b_2_eta, *rv_b_2_phi, *rv_b_2_mass);
-        pep_vbf_1.SetCoordinates(*rv_vbf_1_pT, *rv_vbf_1_eta, *rv_vbf_1_phi, *rv_vbf_1_mass);
-        pep_vbf_2.SetCoordinates(*rv_vbf_2_pT, *rv_vbf_2_eta, *rv_vbf_2_phi, *rv_vbf_2_mass);
-
-        svfit.SetCoordinates(pep_svfit.Px(), pep_svfit.Py(), pep_svfit.Pz(), pep_svfit.M());
-        l_1.SetCoordinates(pep_l_1.Px(),     pep_l_1.Py(),   pep_l_1.Pz(),   pep_l_1.M());
-        l_2.SetCoordinates(pep_l_2.Px(),     pep_l_2.Py(),   pep_l_2.Pz(),   pep_l_2.M());
-        met.SetCoordinates(pep_met.Px(),     pep_met.Py(),   0,              0);
-        b_1.SetCoordinates(pep_b_1.Px(),     pep_b_1.Py(),   pep_b_1.Pz(),   pep_b_1.M());
-        b_2.SetCoordinates(pep_b_2.Px(),     pep_b_2.Py(),   pep_b_2.Pz(),   pep_b_2.M());
-        vbf_1.SetCoordinates(pep_vbf_1.Px(), pep_vbf_1.Py(), pep_vbf_1.Pz(), pep_vbf_1.M());
-        vbf_2.SetCoordinates(pep_vbf_2.Px(), pep_vbf_2.Py(), pep_vbf_2.Pz(), pep_vbf_2.M());
-
-        // VBF
-        n_vbf = has_vbf_pair ? 2 : 0;
-
-        // Convergence
-        svfit_conv     = *rv_svfit_mass > 0;
-        hh_kinfit_conv = kinfit_chi2    > 0;
-
-        // KinFit for ZZ/ZH
-        // create a single object with all the needed info to give kinfit { 4 lep1 coords, 4 lep2 coords, 4 bjet1 coords, 4 bjet2 coords, 2 MET coors, 3 MET cov entries }
-        kinINinfo = { *rv_l_1_pT, *rv_l_1_eta, *rv_l_1_phi, l_1_mass, *rv_l_2_pT, *rv_l_2_eta, *rv_l_2_phi, *rv_l_2_mass ,*rv_b_1_pT, *rv_b_1_eta, *rv_b_1_phi, *rv_b_1_mass ,*rv_b_2_pT, *rv_b_2_eta, *rv_b_2_phi, *rv_b_2_mass ,*rv_met_pT, *rv_met_phi, *rv_met_cov_00, *rv_met_cov_01, *rv_met_cov_11 };
-        // compute KinFit 
-        KinFitter fitter(kinINinfo);
-        kinfit_ZZ = fitter.fit("ZZ");
-        kinfit_ZH = fitter.fit("ZH");
-        kinINinfo.clear();
-
-        _evt_proc->process_to_vec(feat_vals, b_1, b_2, l_1, l_2, met, svfit, vbf_1, vbf_2, kinfit_mass, kinfit_chi2, mt2, is_boosted, b_1_csv, b_2_csv,
-                                  e_channel, e_year, res_mass, spin, klambda, n_vbf, svfit_conv, hh_kinfit_conv, b_1_hhbtag, b_2_hhbtag, vbf_1_hhbtag,
-                                  vbf_2_hhbtag, b_1_cvsl, b_2_cvsl, vbf_1_cvsl, vbf_2_cvsl, b_1_cvsb, b_2_cvsb, vbf_1_cvsb, vbf_2_cvsb, cv, c2v, c3, true);
-
-        if (evt%2 == 0) {
-            data_even->Fill();
-        } else {
-            data_odd->Fill();
-        }        
-        if (n_events > 0 && n_saved_events >= n_events) {
-            std::cout << "Exiting after " << n_saved_events << " events.\n";
-            break;
+
+        (this->*kernel.process_batch)(batch, *block, fitter, evt_proc, feat_vals, kinfit_stats, counters);
+        FileLooper::_write_batch(writer, batch.records, batch.n, state, counters);
+    }
+    return n_saved_events;
+}
+
+long int FileLooper::_loop_threaded(TTreeReader& reader, EvtReader& evt_reader, const SampleCatalog& catalog, const EvtKernel& kernel,
+                                    EvtWriter* writer, const long int& n_events, const unsigned int& n_threads,
+                                    LoopState* state, LoopMetrics* metrics) {
+    /*
+    Three-stage pipeline: a reader thread applies the selection and fills batches of accepted events, n_threads workers
+    each with their own EvtProc process batches, and the calling thread writes batches back in the order they were read.
+    A fixed pool of batches is recycled between the stages, which bounds memory use.
+    */
+
+    ROOT::EnableThreadSafety();
+
+    const unsigned int n_batches = 4*n_threads;
+    WorkQueue<std::unique_ptr<EvtBatch>> free_batches(n_batches), todo_batches(n_batches), done_batches(n_batches);
+    for (unsigned int i = 0; i < n_batches; i++) {
+        free_batches.push(std::unique_ptr<EvtBatch>(new EvtBatch(EVT_BATCH_SIZE, _n_feats, _kinfit_scan.size())));
+    }
+
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto fail = [&]() {  // Record first error and unblock all stages
+        std::lock_guard<std::mutex> lock(error_mutex);
+        if (!error) error = std::current_exception();
+        free_batches.close();
+        todo_batches.close();
+        done_batches.close();
+    };
+
+    // Reader
+    std::thread reader_thread([&]() {
+        try {
+            StageCounters* counters = metrics != nullptr ? metrics->new_counters() : nullptr;
+            long int c_event(0), n_accepted(0), n_tot_events(reader.GetEntries(true));
+            unsigned long int seq(0);
+            bool done(false);
+            std::unique_ptr<EvtBatch> batch;
+            while (!done && free_batches.pop(batch)) {
+                batch->seq = seq++;
+                batch->n = 0;
+                while (batch->n < EVT_BATCH_SIZE) {
+                    if (!reader.Next()) {
+                        done = true;
+                        break;
+                    }
+                    c_event++;
+                    if (c_event%1000 == 0) {
+                        LOG_MSG(log_info, c_event << " / " << n_tot_events);
+                        if (metrics != nullptr) metrics->set_bytes(TFile::GetFileBytesRead(), TFile::GetFileBytesWritten());
+                    }
+
+                    EvtInput& evt = batch->inputs[batch->n];
+                    evt.entry = reader.GetTree()->GetReadEntry();
+                    if (!(this->*kernel.read_evt)(evt_reader, evt, catalog, counters)) continue;
+                    batch->n++;
+                    n_accepted++;
+                    if (n_events > 0 && n_accepted >= n_events) {
+                        LOG_MSG(log_info, "Exiting after " << n_accepted << " events.");
+                        done = true;
+                        break;
+                    }
+                }
+                if (!todo_batches.push(std::move(batch))) break;
+            }
+        } catch (...) {
+            fail();
+        }
+        todo_batches.close();
+    });
+
+    // Workers
+    std::atomic<unsigned int> n_running(n_threads);
+    std::mutex stats_mutex;
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < n_threads; i++) {
+        workers.emplace_back([&]() {
+            try {
+                EvtProc evt_proc(_all, _proc_requested, _use_deep_csv);
+                KinFitStats kinfit_stats;
+                StageCounters* counters = metrics != nullptr ? metrics->new_counters() : nullptr;
+                std::vector<std::unique_ptr<float>> feat_vals;
+                feat_vals.reserve(_n_feats);
+                for (unsigned int j = 0; j < _n_feats; j++) feat_vals.emplace_back(new float(0));
+
+                std::unique_ptr<KinBlock> block(new KinBlock());
+                KinFitter fitter;
+                std::unique_ptr<EvtBatch> batch;
+                while (todo_batches.pop(batch)) {
+                    (this->*kernel.process_batch)(*batch, *block, fitter, &evt_proc, feat_vals, kinfit_stats, counters);
+                    if (!done_batches.push(std::move(batch))) break;
+                }
+                std::lock_guard<std::mutex> lock(stats_mutex);
+                _kinfit_stats.merge(kinfit_stats);
+            } catch (...) {
+                fail();
+            }
+            if (--n_running == 0) done_batches.close();
+        });
+    }
+
+    // Ordered writer
+    long int n_saved_events(0);
+    try {
+        StageCounters* counters = metrics != nullptr ? metrics->new_counters() : nullptr;
+        unsigned long int next_seq(0);
+        std::map<unsigned long int, std::unique_ptr<EvtBatch>> pending;
+        std::unique_ptr<EvtBatch> batch;
+        while (done_batches.pop(batch)) {
+            pending[batch->seq] = std::move(batch);
+            while (!pending.empty() && pending.begin()->first == next_seq) {
+                EvtBatch& ready = *pending.begin()->second;
+                FileLooper::_write_batch(writer, ready.records, ready.n, state, counters);
+                n_saved_events += ready.n;
+                free_batches.push(std::move(pending.begin()->second));
+                pending.erase(pending.begin());
+                next_seq++;
+            }
+        }
+    } catch (...) {
+        fail();
+    }
+
+    reader_thread.join();
+    for (std::thread& w : workers) w.join();
+    if (error) std::rethrow_exception(error);
+    return n_saved_events;
+}
+
+bool FileLooper::loop_files(const std::string& in_dir, const std::string& out_dir, const std::vector<std::string>& channels,
+                            const std::vector<std::string>& years, const long int& n_events, const unsigned int& n_threads,
+                            const long int& chunk_size) {
+    /*
+    Process every {in_dir}/{year}_{channel}_Central.root in one process, giving the same outputs as calling loop_file on each.
+    Files are split into entry ranges of about chunk_size entries (if chunk_size <= 0, the total number of entries divided by
+    4*n_threads), so that large files do not dominate the run time. The chunks are processed by a shared pool of n_threads
+    workers, largest first, each worker building its EvtProc once. The outputs of the chunks of a file are then merged in
+    entry order. If n_events > 0, files are not split and at most n_events are saved per file. Checkpointing, shards, and
+    entry ranges apply to single files only. If a chunk fails, the other workers stop before their next chunk, and the
+    outputs of every chunk started are removed.
+    */
+
+    if (_checkpoint_every > 0 || _n_shards > 1 || _range_first > 0 || _range_last >= 0) {
+        throw std::invalid_argument("Checkpointing, shards, and entry ranges cannot be used when processing files as a batch");
+    }
+    ROOT::EnableThreadSafety();
+    auto start = std::chrono::steady_clock::now();
+    LoopMetrics* metrics = nullptr;
+    if (_metrics_fname != "") {
+        metrics = new LoopMetrics(_metrics_fname, "batch", _metrics_interval, TFile::GetFileBytesRead(), TFile::GetFileBytesWritten());
+    }
+
+    // Files
+    std::vector<LoopFile> files;
+    long int n_tot_entries(0);
+    for (const std::string& year : years) {
+        for (const std::string& channel : channels) {
+            LoopFile file;
+            file.year       = year;
+            file.channel    = channel;
+            file.fname      = in_dir+"/"+year+"_"+channel+"_Central.root";
+            file.oname      = out_dir+"/"+year+"_"+channel+".root";
+            file.n_selected = 0;
+            file.n_saved    = 0;
+            file.busy_time  = 0;
+            TFile* in_file = TFile::Open(file.fname.c_str());
+            if (in_file == nullptr || in_file->IsZombie()) throw std::invalid_argument("Unable to open " + file.fname);
+            TTree* in_tree = nullptr;
+            in_file->GetObject(channel.c_str(), in_tree);
+            if (in_tree == nullptr) throw std::invalid_argument("No tree " + channel + " in " + file.fname);
+            file.n_entries = in_tree->GetEntries();
+            in_file->Close();
+            delete in_file;
+            n_tot_entries += file.n_entries;
+            files.push_back(file);
+        }
+    }
+
+    // Chunks
+    long int target = chunk_size > 0 ? chunk_size : (n_tot_entries+4*n_threads-1)/(4*n_threads);
+    if (target < 1) target = 1;
+    std::vector<LoopChunk> chunks;
+    for (unsigned int f = 0; f < files.size(); f++) {
+        LoopFile& file = files[f];
+        unsigned int n_parts = n_events > 0 ? 1 : std::max(1L, (file.n_entries+target-1)/target);
+        for (unsigned int p = 0; p < n_parts; p++) {
+            LoopChunk chunk;
+            chunk.file_idx = f;
+            chunk.part     = p;
+            chunk.first    = p*file.n_entries/n_parts;
+            chunk.last     = (p+1)*file.n_entries/n_parts;
+            chunks.push_back(chunk);
+            file.parts.push_back(n_parts == 1 ? file.oname : file.oname+".part"+std::to_string(p));
+        }
+    }
+    std::stable_sort(chunks.begin(), chunks.end(), [](const LoopChunk& a, const LoopChunk& b) {
+        return a.last-a.first > b.last-b.first;
+    });
+    std::cout << "Processing " << files.size() << " files (" << n_tot_entries << " entries) as " << chunks.size()
+              << " chunks on " << n_threads << " threads\n";
+
+    // Workers
+    WorkQueue<unsigned int> todo(chunks.size());
+    for (unsigned int i = 0; i < chunks.size(); i++) todo.push(i);
+    todo.close();
+
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    std::vector<char> started(chunks.size(), 0);  // Each written only by the worker which popped the chunk
+    std::mutex file_mutex;
+    std::vector<std::thread> workers;
+    for (unsigned int i = 0; i < n_threads; i++) {
+        workers.emplace_back([&]() {
+            try {
+                EvtProc evt_proc(_all, _proc_requested, _use_deep_csv);
+                unsigned int c;
+                while (!failed && todo.pop(c)) {
+                    started[c] = 1;
+                    const LoopChunk& chunk = chunks[c];
+                    KinFitStats kinfit_stats;
+                    Cutflow cutflow;
+                    long int n_selected(0);
+                    auto chunk_start = std::chrono::steady_clock::now();
+                    long int n_saved = FileLooper::_loop_chunk(files[chunk.file_idx], chunk, &evt_proc, kinfit_stats, cutflow,
+                                                               n_selected, n_events, metrics);
+                    double dt = std::chrono::duration<double>(std::chrono::steady_clock::now()-chunk_start).count();
+
+                    std::lock_guard<std::mutex> lock(file_mutex);
+                    LoopFile& file = files[chunk.file_idx];
+                    file.n_selected += n_selected;
+                    file.n_saved    += n_saved;
+                    file.busy_time  += dt;
+                    file.kinfit_stats.merge(kinfit_stats);
+                    file.cutflow.merge(cutflow);
+                    LOG_MSG(log_info, "Finished " << file.year << "_" << file.channel << " part " << chunk.part+1 << " / "
+                                      << file.parts.size() << ": " << n_saved << " events saved in " << dt << " s");
+                }
+            } catch (...) {
+                std::lock_guard<std::mutex> lock(file_mutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        });
+    }
+    for (std::thread& w : workers) w.join();
+    if (metrics != nullptr) {
+        metrics->set_bytes(TFile::GetFileBytesRead(), TFile::GetFileBytesWritten());
+        metrics->finish();
+        delete metrics;
+    }
+    if (error) {
+        for (unsigned int c = 0; c < chunks.size(); c++) {
+            if (started[c]) std::remove(files[chunks[c].file_idx].parts[chunks[c].part].c_str());
         }
+        std::rethrow_exception(error);
+    }
+    Logger::get().flush();
+
+    // Merge and report
+    for (const LoopFile& file : files) {
+        if (file.parts.size() > 1) FileLooper::_merge_parts(file.parts, file.oname);
+    }
+    double wall_time = std::chrono::duration<double>(std::chrono::steady_clock::now()-start).count();
+    std::cout << "\nBatch complete in " << wall_time << " s (" << n_tot_entries/wall_time << " entries/s)\n";
+    std::cout << std::setw(16) << "file" << std::setw(12) << "entries" << std::setw(12) << "selected" << std::setw(12) << "saved"
+              << std::setw(8) << "parts" << std::setw(12) << "thread-s" << std::setw(16) << "entries/thr-s" << "\n";
+    for (const LoopFile& file : files) {
+        std::cout << std::setw(16) << file.year+"_"+file.channel << std::setw(12) << file.n_entries << std::setw(12) << file.n_selected
+                  << std::setw(12) << file.n_saved << std::setw(8) << file.parts.size() << std::setw(12) << file.busy_time
+                  << std::setw(16) << (file.busy_time > 0 ? file.n_entries/file.busy_time : 0) << "\n";
+    }
+    for (const LoopFile& file : files) {
+        std::cout << "\n" << file.year << "_" << file.channel << " ";
+        file.cutflow.print_summary();
+        file.kinfit_stats.print_summary();
+    }
+    if (_kinfit_cache != nullptr) {
+        _kinfit_cache->print_summary();
+        _kinfit_cache->save();
+    }
+    return true;
+}
+
+long int FileLooper::_loop_chunk(const LoopFile& file, const LoopChunk& chunk, EvtProc* evt_proc, KinFitStats& kinfit_stats,
+                                 Cutflow& cutflow, long int& n_selected, const long int& n_events, LoopMetrics* metrics) {
+    /*
+    Serially process one entry range of a file into the chunk's own output file, which also holds the chunk's cutflow.
+    Thread safe given a per-thread evt_proc
+    */
+
+    std::unique_ptr<TFile> in_file(TFile::Open(file.fname.c_str()));
+    if (in_file == nullptr || in_file->IsZombie()) throw std::invalid_argument("Unable to open " + file.fname);
+    TTree* in_tree = nullptr;
+    in_file->GetObject(file.channel.c_str(), in_tree);
+    if (in_tree == nullptr) throw std::invalid_argument("No tree " + file.channel + " in " + file.fname);
+    EvtKernel kernel = FileLooper::_get_kernel(FileLooper::_get_channel(file.channel), FileLooper::_get_year(file.year));
+    SampleCatalog catalog(FileLooper::build_dataset_id_map(in_file.get()), FileLooper::build_region_id_map(in_file.get()));
+
+    TEntryList* entry_list;
+    {
+        StageTimer timer(metrics != nullptr ? metrics->new_counters() : nullptr, stage_select_pass);
+        entry_list = FileLooper::_build_entry_list(in_tree, catalog, n_events, chunk.first, chunk.last, &cutflow);
     }
+    n_selected = entry_list->GetN();
+    in_tree->SetEntryList(entry_list);
+    TTreeReader reader(in_tree, entry_list);
+    EvtReader evt_reader(reader, _input_groups);
 
-    std::cout << "Loop complete, saving results.\n";
-    data_even->Write();
-    data_odd->Write();
-    delete data_even;
-    delete data_odd;
+    EvtWriter* writer = FileLooper::_create_writer(file.parts[chunk.part]);
+    long int n_saved_events = FileLooper::_loop_serial(reader, evt_reader, catalog, kernel, writer, n_events,
+                                                       evt_proc, kinfit_stats, nullptr, metrics, false);
+
+    writer->close();
+    delete writer;
+    FileLooper::_write_cutflow(file.parts[chunk.part], cutflow);
+    in_tree->SetEntryList(nullptr);
+    delete entry_list;
     in_file->Close();
+    return n_saved_events;
+}
+
+void FileLooper::_merge_parts(const std::vector<std::string>& parts, const std::string& oname) {
+    /*
+    Concatenate the chunk outputs of a file in entry order, copying compressed baskets without unpacking them.
+    The strat indices of the parts are offset and combined, and their cutflows summed, replacing the plain concatenation
+    done by the merger. Histogram outputs have no strat index, and their histograms are added by the merger. The format is
+    detected from the parts, which must all have the same one, rather than taken from the looper's settings.
+    */
+
+    std::cout << "Merging " << parts.size() << " parts into " << oname << "\n";
+    StratIndex index;
+    Cutflow cutflow;
+    bool hists = false;
+    for (unsigned int i = 0; i < parts.size(); i++) {
+        const std::string& p = parts[i];
+        TFile* part = TFile::Open(p.c_str());
+        if (part == nullptr || part->IsZombie()) throw std::runtime_error("Unable to read " + p);
+        bool part_hists = EvtWriter::detect_format(part) == out_hist;
+        if (i == 0) hists = part_hists;
+        if (part_hists != hists) throw std::runtime_error(p + " is not of the same output format as " + parts[0]);
+        if (!hists) index.append(StratIndex::read(part));
+        cutflow.merge(Cutflow::read(part));
+        part->Close();
+        delete part;
+    }
+    TFileMerger merger(false);
+    merger.SetFastMethod(true);
+    if (!merger.OutputFile(oname.c_str(), "recreate", _io_profile.compression)) throw std::runtime_error("Unable to create " + oname);
+    for (const std::string& p : parts) merger.AddFile(p.c_str(), false);
+    if (!merger.Merge()) throw std::runtime_error("Failed to merge parts into " + oname);
+
+    TFile* out_file = TFile::Open(oname.c_str(), "update");
+    if (out_file == nullptr || out_file->IsZombie()) throw std::runtime_error("Unable to update " + oname);
+    if (!hists) {
+        TDirectory::TContext ctx(out_file);
+        TTree* index_tree = index.make_tree();
+        index_tree->Write("", TObject::kOverwrite);
+        delete index_tree;
+    }
+    cutflow.write(out_file);
+    out_file->Close();
+    delete out_file;
+    for (const std::string& p : parts) std::remove(p.c_str());
+}
+
+void FileLooper::_write_cutflow(const std::string& oname, const Cutflow& cutflow) {
+    /* Add the cutflow and sumw trees to a closed output file */
+
+    TFile* out_file = TFile::Open(oname.c_str(), "update");
+    if (out_file == nullptr || out_file->IsZombie()) throw std::runtime_error("Unable to update " + oname);
+    cutflow.write(out_file);
     out_file->Close();
+    delete out_file;
+}
+
+void FileLooper::_write_batch(EvtWriter* writer, const RecBuffer& recs, const unsigned int& n, LoopState* state,
+                              StageCounters* counters) {
+    /*
+    Write the first n records of recs, each to the fold of its ID, as one block. If state is given, update it and save a
+    checkpoint every _checkpoint_every events, splitting the block at checkpoints so that the state matches what was written.
+    */
+
+    if (n == 0) return;  // Trailing empty batch
+    StageTimer timer(counters, stage_write, n);
+    std::vector<unsigned int> folds(n);
+    for (unsigned int i = 0; i < n; i++) folds[i] = FileLooper::_get_split(recs.meta(i).evt);
+    if (state == nullptr) {
+        writer->fill_block(recs, 0, n, folds.data());
+        return;
+    }
+    long int n_total = std::accumulate(state->n_saved.begin(), state->n_saved.end(), 0L);
+    unsigned int first = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        state->last_entry = recs.meta(i).entry;
+        state->n_saved[folds[i]]++;
+        bool ckpt = ++n_total%_checkpoint_every == 0;
+        if (!ckpt && i+1 < n) continue;
+        writer->fill_block(recs, first, i+1-first, &folds[first]);
+        first = i+1;
+        if (ckpt) writer->checkpoint(*state);
+    }
+}
+
+CutReason FileLooper::_select_evt(EvtInput& evt, const SampleCatalog& catalog) {
+    /* Derive sample, region, and jet category from the meta branches and return the first cut the event fails, if any */
+
+    const SampleInfo& info = catalog.get_sample(evt.dataset_id);
+    evt.sample   = info.sample_id;
+    evt.class_id = info.class_id;
+    evt.spin     = info.spin;
+    evt.klambda  = info.klambda;
+    evt.res_mass = info.res_mass;
+    evt.cv       = info.cv;
+    evt.c2v      = info.c2v;
+    evt.c3       = info.c3;
+    evt.region   = catalog.get_region(evt.region_id);
+    evt.jet_cat = FileLooper::jet_cat_lookup(evt.has_b_pair, evt.has_vbf_pair, evt.is_boosted, evt.num_btag_loose, evt.num_btag_medium);
+
+    return FileLooper::_accept_evt(evt.region, evt.jet_cat, evt.class_id, evt.klambda, evt.cv, evt.c2v, evt.c3);
+}
+
+TEntryList* FileLooper::_build_entry_list(TTree* tree, const SampleCatalog& catalog, const long int& n_events, const long int& first,
+                                          const long int& last, Cutflow* cutflow, const long int& enter_from) {
+    /*
+    First pass over entries [first, last) of the input tree (to the end if last < 0) with only the selection branches enabled,
+    returning the entries accepted by _accept_evt (at most n_events of them if n_events > 0).
+    Baskets of the kinematic branches are never touched by this pass.
+    If cutflow is given, every entry passed over is also counted in it, with its weight. Entries before enter_from are only
+    counted, e.g. those already processed by a resumed run.
+    */
+
+    EvtInput evt;
+    tree->SetBranchStatus("*", 0);
+    for (const std::string& b : EvtReader::get_meta_branches()) tree->SetBranchStatus(b.c_str(), 1);
+    evt.weight = 0;
+    if (cutflow != nullptr) {
+        tree->SetBranchStatus("weight", 1);
+        tree->SetBranchAddress("weight", &evt.weight);
+    }
+    tree->SetBranchAddress("dataset",         &evt.dataset_id);
+    tree->SetBranchAddress("event_region",    &evt.region_id);
+    tree->SetBranchAddress("has_b_pair",      &evt.has_b_pair);
+    tree->SetBranchAddress("has_VBF_pair",    &evt.has_vbf_pair);
+    tree->SetBranchAddress("is_boosted",      &evt.is_boosted);
+    tree->SetBranchAddress("num_btag_Loose",  &evt.num_btag_loose);
+    tree->SetBranchAddress("num_btag_Medium", &evt.num_btag_medium);
+
+    TEntryList* entry_list = new TEntryList("selected", "Entries passing selection", tree);
+    entry_list->SetDirectory(nullptr);
+    long int n_accepted(0), n_end(tree->GetEntries());
+    if (last >= 0 && last < n_end) n_end = last;
+    for (long int i = first; i < n_end; i++) {
+        tree->GetEntry(i);
+        CutReason reason = FileLooper::_select_evt(evt, catalog);
+        if (cutflow != nullptr) cutflow->add(reason, evt.weight, evt.sample, evt.region, evt.jet_cat, evt.class_id);
+        if (reason != cut_pass || i < enter_from) continue;
+        entry_list->Enter(i);
+        n_accepted++;
+        if (n_events > 0 && n_accepted >= n_events) break;
+    }
+
+    tree->ResetBranchAddresses();
+    FileLooper::_enable_branches(tree);
+    return entry_list;
+}
+
+void FileLooper::_set_input_groups() {
+    /*
+    Restrict reading and processing to the input groups the requested columns depend on: the groups the EvtProc features are
+    found to use by FeatDeps::probe, plus the KinFit inputs if any of the ZZ/ZH KinFit columns are requested. Features the
+    probe cannot resolve read every group, which is reported.
+    */
+
+    std::vector<std::unique_ptr<float>> feat_vals;
+    feat_vals.reserve(_n_feats);
+    for (unsigned int i = 0; i < _n_feats; i++) feat_vals.emplace_back(new float(0));
+    std::unique_ptr<KinBlock> block(new KinBlock());
+    std::vector<bool> unprobed;
+    std::vector<unsigned int> deps = FeatDeps::probe(_n_feats,
+        [&](const EvtInput& evt, const unsigned int& trial, std::vector<float>& feats) {
+            EvtKernel kernel = FileLooper::_get_kernel(Channel(trial%3), Year((trial/3)%3));
+            block->load(&evt, 1, Channel(trial%3));
+            block->convert();
+            (this->*kernel.compute_feats)(evt, *block, 0, _evt_proc, feat_vals);
+            for (unsigned int i = 0; i < _n_feats; i++) feats[i] = *feat_vals[i];
+        }, unprobed);
+
+    unsigned int groups = _run_kinfit ? KINFIT_INPUT_GROUPS : 0;
+    for (unsigned int i = 0; i < _n_feats; i++) {
+        groups |= deps[i];
+        if (unprobed[i]) {
+            LOG_MSG(log_info, "Feature " << _feat_names[i] << " is never finite on the probe events, reading all inputs for it");
+        } else {
+            LOG_MSG(log_debug, "Feature " << _feat_names[i] << " uses " << FeatDeps::describe(deps[i]));
+        }
+    }
+    _input_groups = groups;
+    const std::vector<std::pair<InputGroup, KinObject>> objects = {{grp_svfit, obj_svfit}, {grp_l_1, obj_l_1}, {grp_l_2, obj_l_2},
+                                                                   {grp_met, obj_met}, {grp_b_1, obj_b_1}, {grp_b_2, obj_b_2},
+                                                                   {grp_vbf_1, obj_vbf_1}, {grp_vbf_2, obj_vbf_2}};
+    _kin_objects = 0;
+    for (const auto& o : objects) {
+        if (_input_groups & 1U << o.first) _kin_objects |= 1U << o.second;
+    }
+    std::cout << "Reading " << EvtReader::get_branch_names(_input_groups).size() << " / " << EvtReader::get_branch_names().size()
+              << " input branches, groups: " << FeatDeps::describe(_input_groups) << "\n";
+    if (!_run_kinfit) std::cout << "No KinFit column requested, skipping the ZZ/ZH KinFit\n";
+}
+
+void FileLooper::_enable_branches(TTree* tree) {
+    /* Disable every branch of the tree except those bound by the reader for the input groups in use */
+
+    tree->SetBranchStatus("*", 0);
+    for (const std::string& b : EvtReader::get_branch_names(_input_groups)) tree->SetBranchStatus(b.c_str(), 1);
+}
+
+void FileLooper::_report_bytes_read(TFile* in_file, TTree* tree) {
+    /* Compare bytes read from the input file to the compressed size of all branches read by a single full pass */
+
+    long long int n_full(0);
+    for (const std::string& b : EvtReader::get_branch_names()) {
+        TBranch* branch = tree->GetBranch(b.c_str());
+        if (branch != nullptr) n_full += branch->GetZipBytes();
+    }
+    long long int n_read = in_file->GetBytesRead();
+    std::cout << "Read " << n_read/1e6 << " MB from input, compared to " << n_full/1e6 << " MB for a full pass";
+    if (n_full > 0) std::cout << " (" << 100.*(1-(double)n_read/n_full) << "% saved)";
+    std::cout << "\n";
+}
+
+template <Channel C, Year Y>
+bool FileLooper::_read_evt(EvtReader& evt_reader, EvtInput& evt, const SampleCatalog& catalog, StageCounters* counters) {
+    /* Load meta info for the current entry and, if the event passes the selection, the rest of its inputs */
+
+    {
+        StageTimer timer(counters, stage_read_meta);
+        evt_reader.read_meta(evt);
+    }
+    {
+        StageTimer timer(counters, stage_select);
+        if (FileLooper::_select_evt(evt, catalog) != cut_pass) return false;
+        evt.strat_key = StratKey::encode(evt.sample, evt.jet_cat, C, Y, evt.region);
+    }
+    StageTimer timer(counters, stage_read_feats);
+    evt_reader.read_feats(evt);
     return true;
 }
 
+template <Channel C, Year Y>
+void FileLooper::_process_batch(EvtBatch& batch, KinBlock& block, KinFitter& fitter, EvtProc* evt_proc,
+                                std::vector<std::unique_ptr<float>>& feat_vals, KinFitStats& kinfit_stats, StageCounters* counters) {
+    /*
+    Compute the output records of a batch of accepted events, converting the kinematics of the whole batch in one pass first.
+    Thread safe provided each thread has its own block, fitter, evt_proc, feat_vals, and kinfit_stats
+    */
+
+    {
+        StageTimer timer(counters, stage_convert, batch.n);
+        block.load<C>(batch.inputs.data(), batch.n);
+        block.convert(_kin_objects);
+    }
+    for (unsigned int i = 0; i < batch.n; i++) {
+        FileLooper::_process_evt<C, Y>(batch.inputs[i], block, fitter, i, batch.records, evt_proc, feat_vals, kinfit_stats, counters);
+    }
+}
+
+template <Channel C, Year Y>
+void FileLooper::_process_evt(const EvtInput& evt, const KinBlock& block, KinFitter& fitter, const unsigned int& i, RecBuffer& recs,
+                              EvtProc* evt_proc, std::vector<std::unique_ptr<float>>& feat_vals, KinFitStats& kinfit_stats,
+                              StageCounters* counters) {
+    /*
+    Compute record i of recs from event i of a batch whose kinematics block has been converted. fitter is loaded with the
+    event only if a KinFit stage runs, and reused for every event of the thread
+    */
+
+    EvtMeta& rec = recs.meta(i);
+
+    // Meta
+    rec.entry      = evt.entry;
+    rec.evt        = evt.evt;
+    rec.dataset_id = evt.dataset_id;
+    rec.weight     = evt.weight;
+    rec.sample     = evt.sample;
+    rec.region     = evt.region;
+    rec.jet_cat    = evt.jet_cat;
+    rec.class_id   = evt.class_id;
+    rec.strat_key  = evt.strat_key;
+
+    // Gen info
+    rec.tau1_gen_match   = evt.tau1_gen_match;
+    rec.tau2_gen_match   = evt.tau2_gen_match;
+    rec.b1_hadronFlavour = evt.b1_hadronFlavour;
+    rec.b2_hadronFlavour = evt.b2_hadronFlavour;
+
+    // create a single object with all the needed info to give kinfit { 4 lep1 coords, 4 lep2 coords, 4 bjet1 coords, 4 bjet2 coords, 2 MET coors, 3 MET cov entries }
+    KinFitInput kin_input = { evt.l_1_pT, evt.l_1_eta, evt.l_1_phi, FileLooper::_get_l_1_mass<C>(evt),
+                              evt.l_2_pT, evt.l_2_eta, evt.l_2_phi, evt.l_2_mass,
+                              evt.b_1_pT, evt.b_1_eta, evt.b_1_phi, evt.b_1_mass, evt.b_2_pT, evt.b_2_eta, evt.b_2_phi, evt.b_2_mass,
+                              evt.met_pT, evt.met_phi, evt.met_cov_00, evt.met_cov_01, evt.met_cov_11 };
+
+    // KinFit for ZZ/ZH
+    if (_run_kinfit) {
+        std::pair<float,float> kinfit_ZZ, kinfit_ZH;
+        {
+            StageTimer timer(counters, stage_kinfit);
+            FileLooper::_fit_kinfit(fitter, kin_input, evt.sample, kinfit_stats, kinfit_ZZ, kinfit_ZH);
+        }
+        rec.kinfit_mass_ZZ = kinfit_ZZ.first;
+        rec.kinfit_chi2_ZZ = kinfit_ZZ.second;
+        rec.kinfit_mass_ZH = kinfit_ZH.first;
+        rec.kinfit_chi2_ZH = kinfit_ZH.second;
+    } else {  // Not requested, keep the columns so the output schema does not change
+        rec.kinfit_mass_ZZ = std::numeric_limits<float>::quiet_NaN();
+        rec.kinfit_chi2_ZZ = std::numeric_limits<float>::quiet_NaN();
+        rec.kinfit_mass_ZH = std::numeric_limits<float>::quiet_NaN();
+        rec.kinfit_chi2_ZH = std::numeric_limits<float>::quiet_NaN();
+    }
+
+    // KinFit hypothesis scan
+    if (_kinfit_scan.size() > 0) {
+        StageTimer timer(counters, stage_kinfit);
+        std::vector<KinFitStatus> status(_kinfit_scan.size());
+        fitter.set_input(kin_input);  // Not reloaded by _fit_kinfit if its results came from the cache
+        fitter.scan(_kinfit_scan, recs.scan_mass(i), recs.scan_chi2(i), status.data());
+    }
+
+    StageTimer timer(counters, stage_process);
+    FileLooper::_compute_feats<C, Y>(evt, block, i, evt_proc, feat_vals);
+    float* feats = recs.feats(i);  // EvtProc's interface fixes feat_vals, so its values are gathered into the record here
+    for (unsigned int j = 0; j < _n_feats; j++) feats[j] = *feat_vals[j];
+}
+
+template <Channel C, Year Y>
+void FileLooper::_compute_feats(const EvtInput& evt, const KinBlock& block, const unsigned int& i, EvtProc* evt_proc,
+                                std::vector<std::unique_ptr<float>>& feat_vals) {
+    /* Run EvtProc on event i of a converted block. Objects which are not in use, e.g. unused VBF jets, are left empty */
+
+    LorentzVector svfit, l_1, l_2, met, b_1, b_2, vbf_1, vbf_2;
+    const std::vector<std::pair<KinObject, LorentzVector*>> objects = {{obj_svfit, &svfit}, {obj_l_1, &l_1}, {obj_l_2, &l_2},
+                                                                       {obj_met, &met}, {obj_b_1, &b_1}, {obj_b_2, &b_2},
+                                                                       {obj_vbf_1, &vbf_1}, {obj_vbf_2, &vbf_2}};
+    for (const auto& o : objects) {
+        if (_kin_objects & 1U << o.first) block.get(o.first, i, *o.second);
+    }
+
+    // VBF
+    int n_vbf = evt.has_vbf_pair ? 2 : 0;
+
+    // Convergence
+    bool svfit_conv     = evt.svfit_mass  > 0;
+    bool hh_kinfit_conv = evt.kinfit_chi2 > 0;
+
+    evt_proc->process_to_vec(feat_vals, b_1, b_2, l_1, l_2, met, svfit, vbf_1, vbf_2, evt.kinfit_mass, evt.kinfit_chi2, evt.mt2, evt.is_boosted,
+                             evt.b_1_csv, evt.b_2_csv, C, Y, evt.res_mass, evt.spin, evt.klambda, n_vbf, svfit_conv, hh_kinfit_conv,
+                             evt.b_1_hhbtag, evt.b_2_hhbtag, evt.vbf_1_hhbtag, evt.vbf_2_hhbtag, evt.b_1_cvsl, evt.b_2_cvsl, evt.vbf_1_cvsl,
+                             evt.vbf_2_cvsl, evt.b_1_cvsb, evt.b_2_cvsb, evt.vbf_1_cvsb, evt.vbf_2_cvsb, evt.cv, evt.c2v, evt.c3, true);
+}
+
+template <Channel C>
+FileLooper::EvtKernel FileLooper::_get_kernel(const Year& year) {
+    if (year == y16) return {&FileLooper::_read_evt<C, y16>, &FileLooper::_process_batch<C, y16>, &FileLooper::_compute_feats<C, y16>};
+    if (year == y17) return {&FileLooper::_read_evt<C, y17>, &FileLooper::_process_batch<C, y17>, &FileLooper::_compute_feats<C, y17>};
+    if (year == y18) return {&FileLooper::_read_evt<C, y18>, &FileLooper::_process_batch<C, y18>, &FileLooper::_compute_feats<C, y18>};
+    throw std::invalid_argument("Invalid year " + std::to_string(year));
+}
+
+FileLooper::EvtKernel FileLooper::_get_kernel(const Channel& channel, const Year& year) {
+    /* Select the instantiation of the per-event stages for the channel and year of a file */
+
+    if (channel == tauTau) return FileLooper::_get_kernel<tauTau>(year);
+    if (channel == muTau)  return FileLooper::_get_kernel<muTau>(year);
+    if (channel == eTau)   return FileLooper::_get_kernel<eTau>(year);
+    throw std::invalid_argument("Invalid channel " + std::to_string(channel));
+}
+
+void FileLooper::_fit_kinfit(KinFitter& fitter, const KinFitInput& input, const int& sample, KinFitStats& kinfit_stats,
+                             std::pair<float,float>& kinfit_ZZ, std::pair<float,float>& kinfit_ZH) {
+    /*
+    Compute the ZZ and ZH KinFits, taking results from the cache where possible and fitting the rest with the thread's
+    fitter, loaded with input. The outcome of every fitted hypothesis is counted in kinfit_stats under the event's sample.
+    */
+
+    std::pair<int,int> zz = KinFitter::get_hypo_masses("ZZ");
+    std::pair<int,int> zh = KinFitter::get_hypo_masses("ZH");
+    unsigned long long int key_ZZ(0), key_ZH(0);
+    bool need_ZZ(true), need_ZH(true);
+    if (_kinfit_cache != nullptr) {
+        key_ZZ = KinFitCache::get_key(input, zz.first, zz.second);
+        key_ZH = KinFitCache::get_key(input, zh.first, zh.second);
+        need_ZZ = !_kinfit_cache->get(key_ZZ, kinfit_ZZ);
+        need_ZH = !_kinfit_cache->get(key_ZH, kinfit_ZH);
+    }
+    if (!need_ZZ && !need_ZH) return;
+
+    std::vector<std::pair<int,int>> hypos;
+    if (need_ZZ) hypos.push_back(zz);
+    if (need_ZH) {  // Both mass orderings
+        hypos.push_back(zh);
+        hypos.push_back(std::pair<int,int>(zh.second, zh.first));
+    }
+    fitter.set_input(input);
+    std::vector<KinFitStatus> status;
+    std::vector<std::pair<float,float>> results = fitter.fit_hypos(hypos, status);
+    for (const KinFitStatus& s : status) kinfit_stats.add(sample, s);
+
+    unsigned int i = 0;
+    if (need_ZZ) {
+        kinfit_ZZ = results[i++];
+        if (_kinfit_cache != nullptr) _kinfit_cache->add(key_ZZ, kinfit_ZZ);
+    }
+    if (need_ZH) {
+        kinfit_ZH = KinFitter::pick_ordering(results[i], results[i+1]);
+        if (_kinfit_cache != nullptr) _kinfit_cache->add(key_ZH, kinfit_ZH);
+    }
+}
+
 std::map<unsigned, std::string> FileLooper::build_dataset_id_map(TFile* in_file) {
     TTreeReader aux_reader("aux", in_file);
     TTreeReaderValue<std::vector<std::string>> rv_dataset_names(aux_reader, "dataset_names");
@@ -337,27 +1214,6 @@ std::map<unsigned, std::string> FileLooper::build_region_id_map(TFile* in_file)
     return id2name;
 }
 
-void FileLooper::_prep_file(TTree* tree, const std::vector<std::unique_ptr<float>>& feat_vals, float* weight, int* sample, int* region, int* jet_cat,
-                            int* class_id, unsigned long long int* strat_key,
-                            float* kinfit_mass_ZZ, float* kinfit_chi2_ZZ, float* kinfit_mass_ZH, float* kinfit_chi2_ZH,
-                            int* tau1_gen_match, int* tau2_gen_match, int* b1_hadronFlavour, int* b2_hadronFlavour) {
-    /* Add branches to tree and set addresses for values */
-
-    for (unsigned int i = 0; i < _n_feats; i++) tree->Branch(_feat_names[i].c_str(), feat_vals[i].get());
-    tree->Branch("weight",      weight);
-    tree->Branch("sample",      sample);
-    tree->Branch("region",      region);
-    tree->Branch("jet_cat",     jet_cat);
-    tree->Branch("kinfit_mass_ZZ", kinfit_mass_ZZ);
-    tree->Branch("kinfit_chi2_ZZ", kinfit_chi2_ZZ);
-    tree->Branch("kinfit_mass_ZH", kinfit_mass_ZH);
-    tree->Branch("kinfit_chi2_ZH", kinfit_chi2_ZH);
-    tree->Branch("tau1_gen_match", tau1_gen_match);
-    tree->Branch("tau2_gen_match", tau2_gen_match);
-    tree->Branch("b1_hadronFlavour", b1_hadronFlavour);
-    tree->Branch("b2_hadronFlavour", b2_hadronFlavour);
-}
-
 Channel FileLooper::_get_channel(std::string channel) {
     /* COnvert channel to enum */
 
@@ -386,7 +1242,7 @@ Year FileLooper::_get_year(std::string year) {
     return Year(y16);
 }
 
-int FileLooper::_jet_cat_lookup(const bool has_b_pair, const bool has_vbf_pair, const bool is_boosted, const int num_btag_Loose, const int num_btag_Medium) {
+int FileLooper::jet_cat_lookup(const bool has_b_pair, const bool has_vbf_pair, const bool is_boosted, const int num_btag_Loose, const int num_btag_Medium) {
     if (!has_b_pair)  return -1;
     if (has_vbf_pair && num_btag_Loose >= 1) return 5;  // 2j1b+_VBFL, 2j1b+_VBF, 2j1b+_VBFT
     if (!has_vbf_pair && is_boosted && num_btag_Loose >= 2)   return 4;  // 2j2Lb+B_noVBF
@@ -396,220 +1252,17 @@ int FileLooper::_jet_cat_lookup(const bool has_b_pair, const bool has_vbf_pair,
     return 0;  // 2j 
 }
 
-int FileLooper::_region_lookup(const std::string& region) {
-    if (region == "OS_Isolated")      return 0;
-    if (region == "OS_AntiIsolated")  return 1;
-    if (region == "SS_Isolated")      return 2;
-    if (region == "SS_AntiIsolated")  return 3;
-    if (region == "SS_LooseIsolated") return 4;
-    throw std::invalid_argument("Unrecognised region: " + region);
-    return -1;
-}
+CutReason FileLooper::_accept_evt(const int& region, const int& jet_cat, const int& class_id, const float& klambda,
+                                  const float& cv, const float& c2v, const float& c3) {
+    /* First cut the event fails, or cut_pass if it is accepted */
 
-void FileLooper::_sample_lookup(std::string& sample, int& sample_id, Spin& spin, float& klambda, float& res_mass, float& cv, float& c2v, float& c3) {
-    // TODO Update this
-    
-    spin = nonres;
-    res_mass = 125;
-    klambda = use_kl;
-    cv = 1;
-    c2v = 1;
-    c3 = 1;
-    
-    if (sample.find("GluGluSignal") != std::string::npos) { 
-        if (sample.find("NonRes_klScan") != std::string::npos) {
-            sample_id = (sample.find("nlo") != std::string::npos) ? -26 : -12;
-            try {
-                klambda = std::stof(sample.substr(sample.find("_klScan_kl")+10));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("_klScan_kl")+10) << "\n";
-                assert(false);
-            }
-        } else if (sample.find("Radion") != std::string::npos) {
-            spin = radion;
-            try {
-                res_mass = std::stof(sample.substr(sample.find("_M")+2));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("_M")+2) << "\n";
-                assert(false);
-            }
-            if (res_mass <= 400) {
-                sample_id = -13;
-            } else if (res_mass <= 600) {
-                sample_id = -14;
-            } else {
-                sample_id = -15;
-            }
-        } else if (sample.find("Graviton") != std::string::npos) {
-            spin = graviton;
-            try {
-                res_mass = std::stof(sample.substr(sample.find("_M")+2));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("_M")+2) << "\n";
-                assert(false);
-            }
-            if (res_mass <= 400) {
-                sample_id = -16;
-            } else if (res_mass <= 600) {
-                sample_id = -17;
-            } else {
-                sample_id = -18;
-            }
-        } else {
-            sample_id = -999; 
-        }
-    } else if (sample.find("VBFSignal") != std::string::npos) {
-        if (sample.find("NonRes") != std::string::npos) {
-            sample_id = (sample.find("nlo") != std::string::npos) ? -27 : -19;
-            try {
-                cv = std::stof(sample.substr(sample.find("CV_")+3, sample.find("_C2V")));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("CV")+2, sample.find("_C2V")) << "\n";
-                assert(false);
-            }
-            try {
-                c2v = std::stof(sample.substr(sample.find("C2V_")+4, sample.find("_C3")));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("C2V_")+4, sample.find("_C3")) << "\n";
-                assert(false);
-            }
-            try {
-                c3 = std::stof(sample.substr(sample.find("C3_")+3));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("C3_")+3) << "\n";
-                assert(false);
-            }
-        } else if (sample.find("Radion") != std::string::npos) {
-            spin = radion;
-            try {
-                res_mass = std::stof(sample.substr(sample.find("_M")+2));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("_M")+2) << "\n";
-                assert(false);
-            }
-            if (res_mass <= 400) {
-                sample_id = -20;
-            } else if (res_mass <= 600) {
-                sample_id = -21;
-            } else {
-                sample_id = -22;
-            }
-        } else if (sample.find("Graviton") != std::string::npos) {
-            spin = graviton;
-            try {
-                res_mass = std::stof(sample.substr(sample.find("_M")+2));
-            } catch (...) {
-                std::cout << "Error in sample " << sample << " attempting to parse " << sample.substr(sample.find("_M")+2) << "\n";
-                assert(false);
-            }
-            if (res_mass <= 400) {
-                sample_id = -23;
-            } else if (res_mass <= 600) {
-                sample_id = -24;
-            } else {
-                sample_id = -25;
-            }
-        }
-    } else if (sample.find("Data") != std::string::npos) {
-        sample_id = 0;
-    } else if (sample.find("TT") != std::string::npos) {
-        sample_id = 1;
-    } else if (sample.find("ttH") != std::string::npos) {
-        sample_id = 2;
-    } else if (sample.find("DY") != std::string::npos) {
-        sample_id = 3;
-    } else if (sample.find("Wjets") != std::string::npos) {
-        sample_id = 4;
-    } else if (sample.find("GluGluH") != std::string::npos || sample.find("VBFH") != std::string::npos) {
-        sample_id = 5;
-    } else if (sample.find("ZHToTauTau_M125") != std::string::npos) {
-        sample_id = 6;
-    } else if (sample.find("ZH_HToBB_ZToLL_M125") != std::string::npos) {
-        sample_id = 7;
-    } else if (sample.find("ZH_HToBB_ZToQQ_M125") != std::string::npos) {
-        sample_id = 8;
-    } else if (sample.find("WminusH") != std::string::npos || sample.find("WplusH") != std::string::npos) {
-        sample_id = 9;
-    } else if (sample.find("WWW") != std::string::npos) {
-        sample_id = 10;
-    } else if (sample.find("WWZ") != std::string::npos) {
-        sample_id = 11;
-    } else if (sample.find("WZZ") != std::string::npos) {
-        sample_id = 12;
-    } else if (sample.find("ZZZ") != std::string::npos) {
-        sample_id = 13;
-    } else if (sample.find("EWK") != std::string::npos) {
-        sample_id = 14;
-    } else if (sample.find("WW") != std::string::npos) {
-        sample_id = 15;
-    } else if (sample.find("WZ") != std::string::npos) {
-        sample_id = 16;
-    } else if (sample.find("ZZTo2L2Nu") != std::string::npos) {
-        sample_id = 17;
-    } else if (sample.find("ZZTo2L2Q") != std::string::npos) {
-        sample_id = 18;
-    } else if (sample.find("ZZTo2Q2Nu") != std::string::npos) {
-        sample_id = 19;
-    } else if (sample.find("ZZTo4L") != std::string::npos) {
-        sample_id = 20;
-    } else if (sample.find("ZZTo4Q") != std::string::npos) {
-        sample_id = 21;
-    } else if (sample.find("ST") != std::string::npos) {
-        sample_id = 22;
-    } else{
-        throw std::invalid_argument("Unrecognised sample: " + sample);
-    }
-}
-
-int FileLooper::_sample2class_lookup(const int& sample) {
-    if (sample == -999)  return -999;  // Sample to reject
-    if (sample < 0)      return 1;     // Signal
-    if (sample == 0)     return -1;    // Collider data
-    return 0;                          // Background
-}
-
-bool FileLooper::_accept_evt(const int& region, const int& jet_cat, const int& class_id, const float& klambda,
-                             const float& cv, const float& c2v, const float& c3) {
-    if (_only_kl1 && klambda != use_kl) {
-        // std::cout << "Rejecting due to klambda = " << klambda << "\n";
-        return false; // Only consider klambda at SM point
-    }
-    if (!_inc_data && class_id == -1) {
-        // std::cout << "Rejecting due to class ID = " << class_id << "\n";
-        return false; // Don't include data and event is data
-    }
-    if (!_inc_other_regions && region != 0) {
-        // std::cout << "Rejecting due to region = " << region << "\n";
-        return false;  //Don't include other regions and event is not SS Iso
-    }
-    if (!_inc_all_jets && jet_cat == 0) {
-        // std::cout << "Rejecting due to jet_cat = " << jet_cat << "\n";
-        return false;  // Only use inference category jets and event is non-inference category
-    }
-    if (jet_cat < 0) {
-        // std::cout << "Rejecting due to jet_cat = " << jet_cat << "\n";
-        return false;  // Don't include experimental jet categories
-    }
-    if (_only_sm_vbf && (cv != 1 || c2v != 1 || c3 != 1)) {
-        // std::cout << "Rejecting due to cv = " << cv << " c2v = " << c2v << " c3 = " << c3 << "\n";
-        return false; // Only consider SM VBF
-    } if (class_id == -999) {
-        // std::cout << "Rejecting due to class ID = -999\n";
-        return false; // Reject sample
-    }
-    // std::cout << "Accepting\n";
-    return true;
+    if (_only_kl1 && klambda != use_kl) return cut_klambda;  // Only consider klambda at SM point
+    if (!_inc_data && class_id == -1) return cut_data;  // Don't include data and event is data
+    if (!_inc_other_regions && region != 0) return cut_region;  //Don't include other regions and event is not SS Iso
+    if (!_inc_all_jets && jet_cat == 0) return cut_jet_cat;  // Only use inference category jets and event is non-inference category
+    if (jet_cat < 0) return cut_exp_jet_cat;  // Don't include experimental jet categories
+    if (_only_sm_vbf && (cv != 1 || c2v != 1 || c3 != 1)) return cut_non_sm_vbf;  // Only consider SM VBF
+    if (class_id == -999) return cut_sample;  // Reject sample
+    return cut_pass;
 }
 
-unsigned long long int FileLooper::_get_strat_key(const int& sample, const int& jet_cat, const Channel& channel, const Year& year, const int& region) {
-    unsigned long long int strat_key = std::pow(2,  std::abs(sample))*
-                                       std::pow(3,  jet_cat)*
-                                       std::pow(5,  (float)channel)*
-                                       std::pow(7,  (float)year)*
-                                       std::pow(11, region);
-    if (strat_key == 0) {
-        std::cout << "sample " << sample << " jet_cat " << jet_cat << " channel " << channel << " year " << year << " region " << region << "\n";
-        throw std::overflow_error("Strat key overflow\n");  
-    }  
-    return strat_key;
-}
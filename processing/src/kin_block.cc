@@ -0,0 +1,87 @@
+#include "cms_runII_data_proc/processing/interface/kin_block.hh"
+
+KinBlock::KinBlock() : _n(0), _pt(), _eta(), _phi(), _m() {}
+
+KinBlock::~KinBlock() {}
+
+template <Channel C>
+void KinBlock::load(const EvtInput* evts, const unsigned int& n) {
+    /*
+    Gather the object coordinates of n <= KIN_BLOCK_SIZE events. The unused lanes are zeroed, since convert runs over the
+    full block and must not see stale or uninitialised values
+    */
+
+    if (n > KIN_BLOCK_SIZE) throw std::invalid_argument("KinBlock holds at most " + std::to_string(KIN_BLOCK_SIZE) + " events");
+    _n = n;
+    constexpr bool fix_l_1_mass = C != tauTau;
+    constexpr float l_1_mass = C == muTau ? MU_MASS : E_MASS;  // Fix mass for light leptons
+    for (unsigned int i = 0; i < n; i++) {
+        const EvtInput& e = evts[i];
+        _pt[obj_svfit][i] = e.svfit_pT; _eta[obj_svfit][i] = e.svfit_eta; _phi[obj_svfit][i] = e.svfit_phi; _m[obj_svfit][i] = e.svfit_mass;
+        _pt[obj_l_1][i]   = e.l_1_pT;   _eta[obj_l_1][i]   = e.l_1_eta;   _phi[obj_l_1][i]   = e.l_1_phi;
+        _m[obj_l_1][i]    = fix_l_1_mass ? l_1_mass : e.l_1_mass;
+        _pt[obj_l_2][i]   = e.l_2_pT;   _eta[obj_l_2][i]   = e.l_2_eta;   _phi[obj_l_2][i]   = e.l_2_phi;   _m[obj_l_2][i]   = e.l_2_mass;
+        _pt[obj_met][i]   = e.met_pT;   _eta[obj_met][i]   = 0;           _phi[obj_met][i]   = e.met_phi;   _m[obj_met][i]   = 0;
+        _pt[obj_b_1][i]   = e.b_1_pT;   _eta[obj_b_1][i]   = e.b_1_eta;   _phi[obj_b_1][i]   = e.b_1_phi;   _m[obj_b_1][i]   = e.b_1_mass;
+        _pt[obj_b_2][i]   = e.b_2_pT;   _eta[obj_b_2][i]   = e.b_2_eta;   _phi[obj_b_2][i]   = e.b_2_phi;   _m[obj_b_2][i]   = e.b_2_mass;
+        _pt[obj_vbf_1][i] = e.vbf_1_pT; _eta[obj_vbf_1][i] = e.vbf_1_eta; _phi[obj_vbf_1][i] = e.vbf_1_phi; _m[obj_vbf_1][i] = e.vbf_1_mass;
+        _pt[obj_vbf_2][i] = e.vbf_2_pT; _eta[obj_vbf_2][i] = e.vbf_2_eta; _phi[obj_vbf_2][i] = e.vbf_2_phi; _m[obj_vbf_2][i] = e.vbf_2_mass;
+    }
+    for (unsigned int o = 0; o < n_kin_objects; o++) {
+        std::fill(_pt[o]+n,  _pt[o]+KIN_BLOCK_SIZE,  0.f);
+        std::fill(_eta[o]+n, _eta[o]+KIN_BLOCK_SIZE, 0.f);
+        std::fill(_phi[o]+n, _phi[o]+KIN_BLOCK_SIZE, 0.f);
+        std::fill(_m[o]+n,   _m[o]+KIN_BLOCK_SIZE,   0.f);
+    }
+}
+
+template void KinBlock::load<tauTau>(const EvtInput* evts, const unsigned int& n);
+template void KinBlock::load<muTau>(const EvtInput* evts, const unsigned int& n);
+template void KinBlock::load<eTau>(const EvtInput* evts, const unsigned int& n);
+
+void KinBlock::load(const EvtInput* evts, const unsigned int& n, const Channel& channel) {
+    /* Load with a channel only known at run time */
+
+    if (channel == tauTau) return KinBlock::load<tauTau>(evts, n);
+    if (channel == muTau)  return KinBlock::load<muTau>(evts, n);
+    if (channel == eTau)   return KinBlock::load<eTau>(evts, n);
+    throw std::invalid_argument("Invalid channel " + std::to_string(channel));
+}
+
+void KinBlock::convert(const unsigned int& objects) {
+    /*
+    Convert the objects in the mask to (px, py, pz, m); the others are left as they are. Each loop runs over the full block
+    so that it has a fixed trip count. Coordinates outside the range of the vectorised functions, e.g. NaN or sentinel
+    values of absent objects, are masked in the vectorised pass and converted afterwards with libm
+    */
+
+    for (unsigned int o = 0; o < n_kin_objects; o++) {
+        if (!(objects & 1U << o)) continue;
+        const float* pt  = _pt[o];
+        const float* eta = _eta[o];
+        const float* phi = _phi[o];
+        float* px = _px[o];
+        float* py = _py[o];
+        float* pz = _pz[o];
+        int n_wide = 0;
+        #pragma omp simd aligned(pt, eta, phi, px, py, pz: 64) reduction(+: n_wide)
+        for (unsigned int i = 0; i < KIN_BLOCK_SIZE; i++) {
+            const bool phi_ok = std::abs(phi[i]) <= KIN_SINCOS_MAX;  // False for NaN
+            const bool eta_ok = std::abs(eta[i]) <= KIN_SINH_MAX;
+            float s, c;
+            kin_sincos(phi_ok ? phi[i] : 0.f, s, c);
+            px[i] = pt[i]*c;
+            py[i] = pt[i]*s;
+            pz[i] = pt[i]*kin_sinh(eta_ok ? eta[i] : 0.f);
+            n_wide += !(phi_ok && eta_ok);
+        }
+        if (n_wide == 0) continue;
+        for (unsigned int i = 0; i < KIN_BLOCK_SIZE; i++) {
+            if (!(std::abs(phi[i]) <= KIN_SINCOS_MAX)) {
+                px[i] = pt[i]*std::cos(phi[i]);
+                py[i] = pt[i]*std::sin(phi[i]);
+            }
+            if (!(std::abs(eta[i]) <= KIN_SINH_MAX)) pz[i] = pt[i]*std::sinh(eta[i]);
+        }
+    }
+}
@@ -0,0 +1,153 @@
+#include "cms_runII_data_proc/processing/interface/kinfit_cache.hh"
+
+KinFitCache::KinFitCache(const std::string& fname) : _fname(fname), _n_loaded(0), _n_hits(0), _n_misses(0) {
+    if (gSystem->AccessPathName(_fname.c_str())) {  // Returns true if file is not accessible
+        std::cout << "KinFit cache " << _fname << " not found, starting empty cache\n";
+        return;
+    }
+    _n_loaded = KinFitCache::_read(true);
+    if (_n_loaded > 0) std::cout << "Loaded " << _n_loaded << " KinFit results from " << _fname << "\n";
+}
+
+std::string KinFitCache::_get_title() {
+    return "KinFit results keyed by input hash, version " + KINFIT_CACHE_VERSION;
+}
+
+unsigned long int KinFitCache::_read(const bool& verbose) {
+    /*
+    Add the results of the sidecar which are not yet held, returning how many were added. A sidecar written by another
+    version of the fit is ignored, and later replaced by save()
+    */
+
+    TFile* in_file = TFile::Open(_fname.c_str());
+    if (in_file == nullptr || in_file->IsZombie()) throw std::runtime_error("Unable to read KinFit cache: " + _fname);
+    TTree* tree = nullptr;
+    in_file->GetObject("kinfit_cache", tree);
+    if (tree == nullptr) throw std::runtime_error("No kinfit_cache tree in " + _fname);
+    if (std::string(tree->GetTitle()) != KinFitCache::_get_title()) {
+        if (verbose) {
+            std::cout << "KinFit cache " << _fname << " (" << tree->GetTitle() << ") is not of version " << KINFIT_CACHE_VERSION
+                      << ", discarding it\n";
+        }
+        in_file->Close();
+        delete in_file;
+        return 0;
+    }
+
+    unsigned long long int key;
+    float mass, chi2;
+    tree->SetBranchAddress("key",  &key);
+    tree->SetBranchAddress("mass", &mass);
+    tree->SetBranchAddress("chi2", &chi2);
+    long int n_entries = tree->GetEntries();
+    unsigned long int n_added = 0;
+    _results.reserve(_results.size()+n_entries);
+    for (long int i = 0; i < n_entries; i++) {
+        tree->GetEntry(i);
+        if (_results.emplace(key, std::pair<float,float>(mass, chi2)).second) n_added++;
+    }
+    in_file->Close();
+    delete in_file;
+    return n_added;
+}
+
+KinFitCache::~KinFitCache() {}
+
+unsigned long long int KinFitCache::get_key(const KinFitInput& input, const int& mh1, const int& mh2) {
+    /* FNV-1a over the bit patterns of the inputs and hypothesis masses, followed by a splitmix64 finaliser */
+
+    unsigned long long int hash = 14695981039346656037ULL;
+    auto mix = [&hash](const unsigned char* bytes, size_t n) {
+        for (size_t i = 0; i < n; i++) {
+            hash ^= bytes[i];
+            hash *= 1099511628211ULL;
+        }
+    };
+    mix(reinterpret_cast<const unsigned char*>(&input), sizeof(KinFitInput));
+    mix(reinterpret_cast<const unsigned char*>(&mh1), sizeof(int));
+    mix(reinterpret_cast<const unsigned char*>(&mh2), sizeof(int));
+
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+    return hash;
+}
+
+bool KinFitCache::get(const unsigned long long int& key, std::pair<float,float>& result) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    auto it = _results.find(key);
+    if (it == _results.end()) {
+        _n_misses++;
+        return false;
+    }
+    _n_hits++;
+    result = it->second;
+    return true;
+}
+
+void KinFitCache::add(const unsigned long long int& key, const std::pair<float,float>& result) {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _results[key] = result;
+}
+
+void KinFitCache::save() {
+    /*
+    Write all results to a temporary file which then replaces the sidecar, so an interrupted save keeps the old cache.
+    Holds an exclusive lock on {fname}.lock meanwhile, and first merges in any results saved by other processes since loading
+    */
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (_results.size() == _n_loaded) return;  // Nothing new
+
+    std::string lock_name = _fname + ".lock";
+    int lock_fd = open(lock_name.c_str(), O_CREAT | O_RDWR, 0644);
+    if (lock_fd < 0 || flock(lock_fd, LOCK_EX) != 0) throw std::runtime_error("Unable to lock KinFit cache: " + lock_name);
+    try {
+        if (!gSystem->AccessPathName(_fname.c_str())) KinFitCache::_read(false);
+        KinFitCache::_write();
+    } catch (...) {
+        flock(lock_fd, LOCK_UN);
+        close(lock_fd);
+        throw;
+    }
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    _n_loaded = _results.size();
+    std::cout << "Saved " << _n_loaded << " KinFit results to " << _fname << "\n";
+}
+
+void KinFitCache::_write() {
+    /* Replace the sidecar with all results held, via a temporary file unique to the process */
+
+    std::string tmp_name = _fname + ".tmp" + std::to_string(getpid());
+    TFile* out_file = new TFile(tmp_name.c_str(), "recreate");
+    TTree* tree = new TTree("kinfit_cache", KinFitCache::_get_title().c_str());
+    unsigned long long int key;
+    float mass, chi2;
+    tree->Branch("key",  &key);
+    tree->Branch("mass", &mass);
+    tree->Branch("chi2", &chi2);
+    for (const auto& r : _results) {
+        key  = r.first;
+        mass = r.second.first;
+        chi2 = r.second.second;
+        tree->Fill();
+    }
+    tree->Write();
+    delete tree;
+    out_file->Close();
+    delete out_file;
+    if (std::rename(tmp_name.c_str(), _fname.c_str()) != 0) {
+        std::remove(tmp_name.c_str());
+        throw std::runtime_error("Unable to move KinFit cache to " + _fname);
+    }
+}
+
+void KinFitCache::print_summary() {
+    unsigned long int n_lookups = _n_hits + _n_misses;
+    std::cout << "KinFit cache: " << _n_hits << " hits, " << _n_misses << " misses";
+    if (n_lookups > 0) std::cout << " (" << 100.*_n_hits/n_lookups << "% hit rate)";
+    std::cout << "\n";
+}
@@ -0,0 +1,43 @@
+#include "cms_runII_data_proc/processing/interface/kinfit_stats.hh"
+
+KinFitStats::KinFitStats() {}
+
+KinFitStats::~KinFitStats() {}
+
+void KinFitStats::add(const int& sample, const KinFitStatus& status) {
+    _counts[sample][status]++;  // New rows are value-initialised to zero
+}
+
+void KinFitStats::merge(const KinFitStats& other) {
+    for (const auto& c : other._counts) {
+        std::array<unsigned long int, n_kinfit_status>& counts = _counts[c.first];
+        for (unsigned int s = 0; s < n_kinfit_status; s++) counts[s] += c.second[s];
+    }
+}
+
+void KinFitStats::clear() {
+    _counts.clear();
+}
+
+void KinFitStats::print_summary() const {
+    /* Table of fit outcomes with one row per sample ID */
+
+    if (_counts.empty()) return;
+    std::cout << "KinFit outcomes per sample:\n";
+    std::cout << std::setw(8) << "sample";
+    for (unsigned int s = 0; s < n_kinfit_status; s++) std::cout << std::setw(18) << KinFitter::get_status_name(KinFitStatus(s));
+    std::cout << "\n";
+    std::array<unsigned long int, n_kinfit_status> totals;
+    totals.fill(0);
+    for (const auto& c : _counts) {
+        std::cout << std::setw(8) << c.first;
+        for (unsigned int s = 0; s < n_kinfit_status; s++) {
+            std::cout << std::setw(18) << c.second[s];
+            totals[s] += c.second[s];
+        }
+        std::cout << "\n";
+    }
+    std::cout << std::setw(8) << "total";
+    for (unsigned int s = 0; s < n_kinfit_status; s++) std::cout << std::setw(18) << totals[s];
+    std::cout << "\n";
+}
@@ -5,6 +5,10 @@
 #include "../../../HHKinFit2/HHKinFit2/interface/exceptions/HHLimitSettingException.h"
 #include "cms_runII_data_proc/processing/interface/kinfitter.hh"
 
+KinFitter::KinFitter() {
+    // empty fitter, to be loaded per event with set_input
+}
+
 KinFitter::KinFitter(std::vector<float> kinINinfo) {
     tlv_l1.SetPtEtaPhiM(kinINinfo[0], kinINinfo[1], kinINinfo[2],kinINinfo[3]);
     tlv_l2.SetPtEtaPhiM(kinINinfo[4], kinINinfo[5], kinINinfo[6],kinINinfo[7]);
@@ -17,100 +21,107 @@ KinFitter::KinFitter(std::vector<float> kinINinfo) {
     metcov(1,1) = static_cast<double>(kinINinfo[20]);
 }
 
+KinFitter::KinFitter(const KinFitInput& input) {
+    set_input(input);
+}
+
+void KinFitter::set_input(const KinFitInput& input) {
+    // load a new event, allowing one fitter to be reused over many events
+    tlv_l1.SetPtEtaPhiM(input.l_1_pT, input.l_1_eta, input.l_1_phi, input.l_1_mass);
+    tlv_l2.SetPtEtaPhiM(input.l_2_pT, input.l_2_eta, input.l_2_phi, input.l_2_mass);
+    tlv_b1.SetPtEtaPhiM(input.b_1_pT, input.b_1_eta, input.b_1_phi, input.b_1_mass);
+    tlv_b2.SetPtEtaPhiM(input.b_2_pT, input.b_2_eta, input.b_2_phi, input.b_2_mass);
+    ptmiss.SetMagPhi(input.met_pT, input.met_phi);
+    metcov(0,0) = static_cast<double>(input.met_cov_00);
+    metcov(1,0) = static_cast<double>(input.met_cov_01);
+    metcov(0,1) = static_cast<double>(input.met_cov_01);
+    metcov(1,1) = static_cast<double>(input.met_cov_11);
+}
+
 KinFitter::~KinFitter() {}
 
+KinFitStatus KinFitter::_prevalidate(int mh1_hp, int mh2_hp) {
+    // cheap checks for inputs on which the fit is certain to fail, so that the minimiser and its exceptions can be skipped
+    KinFitStatus status = _prevalidate_input();
+    if (status != kinfit_ok) return status;
+
+    // fitted tau energies can only increase from their visible values, so the tau-pair mass cannot fall below the visible mass.
+    // the taus may be constrained to either hypothesis mass, so only the larger of the two is certain to be unreachable
+    if ((tlv_l1+tlv_l2).M() > std::max(mh1_hp, mh2_hp)) return kinfit_vis_mass;
+
+    return kinfit_ok;
+}
+
+KinFitStatus KinFitter::_prevalidate_input() {
+    // the hypothesis-independent part of _prevalidate
+    double vals[] = {tlv_l1.Pt(), tlv_l1.E(), tlv_l2.Pt(), tlv_l2.E(), tlv_b1.Pt(), tlv_b1.E(), tlv_b2.Pt(), tlv_b2.E(),
+                     ptmiss.Px(), ptmiss.Py(), metcov(0,0), metcov(0,1), metcov(1,1)};
+    for (const double& v : vals) {
+        if (!std::isfinite(v)) return kinfit_bad_input;
+    }
+
+    // the MET covariance is inverted by the fit, so must be positive definite
+    if (metcov(0,0) <= 0 || metcov(0,0)*metcov(1,1) - metcov(0,1)*metcov(1,0) <= 0) return kinfit_degenerate_cov;
+
+    return kinfit_ok;
+}
+
+std::string KinFitter::_describe() const {
+    // fit inputs on one line, for diagnostics of failed fits
+    std::ostringstream ss;
+    const std::pair<const char*, const TLorentzVector*> objs[] = {{"tau1", &tlv_l1}, {"tau2", &tlv_l2}, {"b1", &tlv_b1}, {"b2", &tlv_b2}};
+    for (const auto& o : objs) {
+        ss << o.first << " (E,Px,Py,Pz,M) " << o.second->E() << "," << o.second->Px() << "," << o.second->Py() << ","
+           << o.second->Pz() << "," << o.second->M() << "; ";
+    }
+    ss << "MET (Px,Py) " << ptmiss.Px() << "," << ptmiss.Py() << "; METCOV " << metcov(0,0) << "," << metcov(0,1) << ","
+       << metcov(1,0) << "," << metcov(1,1);
+    return ss.str();
+}
+
+std::string KinFitter::get_status_name(const KinFitStatus& status) {
+    switch (status) {
+        case kinfit_ok:                    return "ok";
+        case kinfit_bad_input:             return "bad_input";
+        case kinfit_degenerate_cov:        return "degenerate_cov";
+        case kinfit_vis_mass:              return "vis_mass";
+        case kinfit_inv_mass_exc:          return "inv_mass_exc";
+        case kinfit_energy_range_exc:      return "e_range_exc";
+        case kinfit_energy_constraint_exc: return "e_constraint_exc";
+        default:                           return "unknown";
+    }
+}
+
 std::pair<float,float> KinFitter::_fit(int mh1_hp, int mh2_hp) {
+    KinFitStatus status;
+    return _fit(mh1_hp, mh2_hp, status);
+}
+
+std::pair<float,float> KinFitter::_fit(int mh1_hp, int mh2_hp, KinFitStatus& status) {
+    status = _prevalidate(mh1_hp, mh2_hp);
+    if (status != kinfit_ok) return std::pair<float,float>(std::nanf("1"), std::nanf("1"));
+
     HHKinFit2::HHKinFitMasterHeavyHiggs KinFit = HHKinFit2::HHKinFitMasterHeavyHiggs(tlv_b1, tlv_b2, tlv_l1, tlv_l2, ptmiss, metcov);
     KinFit.addHypo(mh1_hp, mh2_hp);
 
     float HHKmass = -999;
     float HHKChi2 = -999;
-    bool DEBUG = false;
 
     bool wrongHHK=false;
     try { KinFit.fit(); }
     catch (HHKinFit2::HHInvMConstraintException const& e) {
-        std::cout<<"THIS FIT DID NOT CONVERGE: INV MASS CONSTRAIN EXCEPTION (mh1_hp = " << mh1_hp << " , mh2_hp = " << mh2_hp << ")" << std::endl;
-        if (DEBUG) {            
-            std::cout<<"INVME Tau1"<<std::endl;
-            std::cout<<"INVME (E,Px,Py,Pz,M) "<< tlv_l1.E() <<","<< tlv_l1.Px() <<","<< tlv_l1.Py() <<","<< tlv_l1.Pz() <<","<< tlv_l1.M() << std::endl;
-            std::cout<<"INVME Tau2"<<std::endl;
-            std::cout<<"INVME (E,Px,Py,Pz,M) "<< tlv_l2.E() <<","<< tlv_l2.Px() <<","<< tlv_l2.Py() <<","<< tlv_l2.Pz() <<","<< tlv_l2.M() << std::endl;
-            std::cout<<"INVME B1"<<std::endl;
-            std::cout<<"INVME (E,Px,Py,Pz,M) "<< tlv_b1.E() <<","<< tlv_b1.Px() <<","<< tlv_b1.Py() <<","<< tlv_b1.Pz() <<","<< tlv_b1.M() << std::endl;
-            std::cout<<"INVME B2"<<std::endl;
-            std::cout<<"INVME (E,Px,Py,Pz,M) "<< tlv_b2.E() <<","<< tlv_b2.Px() <<","<< tlv_b2.Py() <<","<< tlv_b2.Pz() <<","<< tlv_b2.M() << std::endl;
-            std::cout<<"INVME MET"<<std::endl;
-            std::cout<<"INVME (E,Px,Py,Pz,M) "<<","<< ptmiss.Px() <<","<< ptmiss.Py() << std::endl;
-            std::cout<<"INVME METCOV "<<std::endl;
-            std::cout<<"INVME "<< metcov (0,0) <<"  "<< metcov (0,1) << std::endl;
-            std::cout<<"INVME "<< metcov (1,0) <<"  "<< metcov (1,1) << std::endl;
-            std::cout<<"INVME tau1, tau2, b1, b2"<<std::endl;
-            std::cout<<"INVME ";
-            tlv_l1.Print();
-            std::cout<<"INVME ";
-            tlv_l2.Print();
-            std::cout<<"INVME ";
-            tlv_b1.Print();
-            std::cout<<"INVME ";
-            tlv_b2.Print();
-        }
+        status = kinfit_inv_mass_exc;
+        LOG_LIMITED(log_debug, 10, "INVME " << _describe());
         wrongHHK=true;
     }
     catch (HHKinFit2::HHEnergyRangeException const& e) {
-        std::cout<<"THIS FIT DID NOT CONVERGE: INV MASS CONSTRAIN EXCEPTION (mh1_hp = " << mh1_hp << " , mh2_hp = " << mh2_hp << ")" << std::endl;
-        if (DEBUG) {
-            std::cout<<"ERANGE Tau1"<<std::endl;
-            std::cout<<"ERANGE (E,Px,Py,Pz,M) "<< tlv_l1.E() <<","<< tlv_l1.Px() <<","<< tlv_l1.Py() <<","<< tlv_l1.Pz() <<","<< tlv_l1.M() << std::endl;
-            std::cout<<"ERANGE Tau2"<<std::endl;
-            std::cout<<"ERANGE (E,Px,Py,Pz,M) "<< tlv_l2.E() <<","<< tlv_l2.Px() <<","<< tlv_l2.Py() <<","<< tlv_l2.Pz() <<","<< tlv_l2.M() << std::endl;
-            std::cout<<"ERANGE B1"<<std::endl;
-            std::cout<<"ERANGE (E,Px,Py,Pz,M) "<< tlv_b1.E() <<","<< tlv_b1.Px() <<","<< tlv_b1.Py() <<","<< tlv_b1.Pz() <<","<< tlv_b1.M() << std::endl;
-            std::cout<<"ERANGE B2"<<std::endl;
-            std::cout<<"ERANGE (E,Px,Py,Pz,M) "<< tlv_b2.E() <<","<< tlv_b2.Px() <<","<< tlv_b2.Py() <<","<< tlv_b2.Pz() <<","<< tlv_b2.M() << std::endl;
-            std::cout<<"ERANGE MET"<<std::endl;
-            std::cout<<"ERANGE (E,Px,Py,Pz,M) "<<","<< ptmiss.Px() <<","<< ptmiss.Py() <<std::endl;
-            std::cout<<"ERANGE METCOV "<<std::endl;
-            std::cout<<"ERANGE "<< metcov (0,0) <<"  "<< metcov (0,1) << std::endl;
-            std::cout<<"ERANGE "<< metcov (1,0) <<"  "<< metcov (1,1) << std::endl;
-            std::cout<<"ERANGE tau1, tau2, b1, b2"<<std::endl;
-            std::cout<<"ERANGE ";
-            tlv_l1.Print();
-            std::cout<<"ERANGE ";
-            tlv_l2.Print();
-            std::cout<<"ERANGE ";
-            tlv_b1.Print();
-            std::cout<<"ERANGE ";
-            tlv_b2.Print();
-        }
+        status = kinfit_energy_range_exc;
+        LOG_LIMITED(log_debug, 10, "ERANGE " << _describe());
         wrongHHK=true;
     }
     catch (HHKinFit2::HHEnergyConstraintException const& e) {
-        std::cout<<"THIS FIT DID NOT CONVERGE: ENERGY CONSTRAIN EXCEPTION (mh1_hp = " << mh1_hp << " , mh2_hp = " << mh2_hp << ")" << std::endl;
-        if (DEBUG) {
-            std::cout<<"ECON Tau1"<<std::endl;
-            std::cout<<"ECON (E,Px,Py,Pz,M) "<< tlv_l1.E() <<","<< tlv_l1.Px() <<","<< tlv_l1.Py() <<","<< tlv_l1.Pz() <<","<< tlv_l1.M() << std::endl;
-            std::cout<<"ECON Tau2"<<std::endl;
-            std::cout<<"ECON (E,Px,Py,Pz,M) "<< tlv_l2.E() <<","<< tlv_l2.Px() <<","<< tlv_l2.Py() <<","<< tlv_l2.Pz() <<","<< tlv_l2.M() << std::endl;
-            std::cout<<"ECON B1"<<std::endl;
-            std::cout<<"ECON (E,Px,Py,Pz,M) "<< tlv_b1.E() <<","<< tlv_b1.Px() <<","<< tlv_b1.Py() <<","<< tlv_b1.Pz() <<","<< tlv_b1.M() << std::endl;
-            std::cout<<"ECON B2"<<std::endl;
-            std::cout<<"ECON (E,Px,Py,Pz,M) "<< tlv_b2.E() <<","<< tlv_b2.Px() <<","<< tlv_b2.Py() <<","<< tlv_b2.Pz() <<","<< tlv_b2.M() << std::endl;
-            std::cout<<"ECON MET"<<std::endl;
-            std::cout<<"ECON (E,Px,Py,Pz,M) "<<","<< ptmiss.Px() <<","<< ptmiss.Py() <<std::endl;
-            std::cout<<"ECON METCOV "<<std::endl;
-            std::cout<<"ECON "<< metcov (0,0) <<"  "<< metcov (0,1) << std::endl;
-            std::cout<<"ECON "<< metcov (1,0) <<"  "<< metcov (1,1) << std::endl;
-            std::cout<<"ECON tau1, tau2, b1, b2"<<std::endl;
-            std::cout<<"ECON ";
-            tlv_l1.Print();
-            std::cout<<"ECON ";
-            tlv_l2.Print();
-            std::cout<<"ECON ";
-            tlv_b1.Print();
-            std::cout<<"ECON ";
-            tlv_b2.Print();
-        }
+        status = kinfit_energy_constraint_exc;
+        LOG_LIMITED(log_debug, 10, "ECON " << _describe());
         wrongHHK=true;
     }
     if(!wrongHHK) {
@@ -126,19 +137,18 @@ std::pair<float,float> KinFitter::_fit(int mh1_hp, int mh2_hp) {
     return local_result;
 }
 
-std::pair<float,float> KinFitter::fit(std::string sgnHp) {
-    int mh1_hp = H_MASS;
-    int mh2_hp = H_MASS;
+std::pair<int,int> KinFitter::get_hypo_masses(const std::string& sgnHp) {
+    /* Convert signal hypothesis to the pair of masses to fit; anything other than ZZ or ZH is taken as HH */
 
-    if (sgnHp == "ZZ") {
-        mh1_hp = Z_MASS;
-        mh2_hp = Z_MASS;
-    }
+    if (sgnHp == "ZZ") return std::pair<int,int>(Z_MASS, Z_MASS);
+    if (sgnHp == "ZH") return std::pair<int,int>(Z_MASS, H_MASS);
+    return std::pair<int,int>(H_MASS, H_MASS);
+}
 
-    else if (sgnHp == "ZH") {
-        mh1_hp = Z_MASS;
-        mh2_hp = H_MASS;
-    }
+std::pair<float,float> KinFitter::fit(std::string sgnHp) {
+    std::pair<int,int> masses = KinFitter::get_hypo_masses(sgnHp);
+    int mh1_hp = masses.first;
+    int mh2_hp = masses.second;
 
     std::pair<float,float> result = std::pair(-999,-999);
 
@@ -148,20 +158,179 @@ std::pair<float,float> KinFitter::fit(std::string sgnHp) {
     else {
         std::pair<float,float> right_fit = _fit(mh1_hp, mh2_hp);
         std::pair<float,float> left_fit  = _fit(mh2_hp, mh1_hp);
+        result = pick_ordering(right_fit, left_fit);
+    }
 
-        if (right_fit.second != std::nanf("1") && left_fit.second != std::nanf("1")) {
-            if (right_fit.second < left_fit.second) { result = right_fit; }
-            else { result = left_fit; }
-        }
-        else if (right_fit.second != std::nanf("1") || left_fit.second != std::nanf("1")) {
-            if (right_fit.second != std::nanf("1")) { result = right_fit; }
-            else { result = left_fit; }
+    return result;
+}
+
+std::pair<float,float> KinFitter::pick_ordering(const std::pair<float,float>& right_fit, const std::pair<float,float>& left_fit) {
+    // choose between the two mass orderings of an asymmetric hypothesis
+    std::pair<float,float> result = std::pair(-999,-999);
+
+    if (right_fit.second != std::nanf("1") && left_fit.second != std::nanf("1")) {
+        if (right_fit.second < left_fit.second) { result = right_fit; }
+        else { result = left_fit; }
+    }
+    else if (right_fit.second != std::nanf("1") || left_fit.second != std::nanf("1")) {
+        if (right_fit.second != std::nanf("1")) { result = right_fit; }
+        else { result = left_fit; }
+    }
+    else {
+        LOG_LIMITED(log_warning, 1, "Neither mass ordering of the fit converged!!");
+        result = std::pair(std::nanf("1"),std::nanf("1"));
+    }
+
+    return result;
+}
+
+std::vector<std::pair<float,float>> KinFitter::fit_hypos(const std::vector<std::pair<int,int>>& hypos) {
+    std::vector<KinFitStatus> status;
+    return fit_hypos(hypos, status);
+}
+
+std::vector<std::pair<float,float>> KinFitter::fit_hypos(const std::vector<std::pair<int,int>>& hypos, std::vector<KinFitStatus>& status) {
+    // fit all (mh1, mh2) hypotheses with a single HHKinFitMasterHeavyHiggs, returning (mass, chi2) and the fit status per hypothesis
+    std::vector<std::pair<float,float>> results(hypos.size(), std::pair<float,float>(std::nanf("1"), std::nanf("1")));
+    status.assign(hypos.size(), kinfit_ok);
+
+    std::vector<unsigned int> to_fit;
+    for (unsigned int i = 0; i < hypos.size(); i++) {
+        status[i] = _prevalidate(hypos[i].first, hypos[i].second);
+        if (status[i] == kinfit_ok) to_fit.push_back(i);
+    }
+    if (to_fit.empty()) return results;
+
+    HHKinFit2::HHKinFitMasterHeavyHiggs KinFit = HHKinFit2::HHKinFitMasterHeavyHiggs(tlv_b1, tlv_b2, tlv_l1, tlv_l2, ptmiss, metcov);
+    for (const unsigned int& i : to_fit) KinFit.addHypo(hypos[i].first, hypos[i].second);
+
+    // the master stops at the first hypothesis which throws, in which case each hypothesis is refitted on its own to isolate the failure
+    bool failed = false;
+    try { KinFit.fit(); }
+    catch (HHKinFit2::HHInvMConstraintException const& e)    { failed = true; }
+    catch (HHKinFit2::HHEnergyRangeException const& e)       { failed = true; }
+    catch (HHKinFit2::HHEnergyConstraintException const& e)  { failed = true; }
+
+    for (const unsigned int& i : to_fit) {
+        if (failed) {
+            results[i] = _fit(hypos[i].first, hypos[i].second, status[i]);
         }
         else {
-            std::cout << "Neither the  mh1_hp,mh2_hp=" << mh1_hp << "," << mh2_hp << " fit nor the mh1_hp,mh2_hp=" << mh2_hp << "," << mh1_hp << " fit converged!!" << std::endl;
-            result = std::pair(std::nanf("1"),std::nanf("1"));
+            results[i] = std::pair<float,float>(KinFit.getMH(hypos[i].first, hypos[i].second), KinFit.getChi2(hypos[i].first, hypos[i].second));
         }
     }
+    return results;
+}
 
-    return result;
+void KinFitter::scan(const KinFitGrid& grid, float* mass, float* chi2, KinFitStatus* status) {
+    // fit every hypothesis of the grid to the current event, writing mass, chi2, and status in grid order.
+    // the input checks, visible mass, and fitter setup are computed once per event rather than once per hypothesis, and hypotheses
+    // below the visible tau-pair mass are skipped. HHKinFit2 offers no way to seed its minimiser, so neighbouring hypotheses are
+    // instead fitted together: a run of them shares one master, and if one throws the run is bisected, so that a failing hypothesis
+    // costs a few refits of its neighbours rather than one fit per hypothesis of the grid
+    KinFitStatus input_status = _prevalidate_input();
+    double vis_mass = input_status == kinfit_ok ? (tlv_l1+tlv_l2).M() : 0;
+    std::vector<unsigned int> to_fit;
+    to_fit.reserve(grid.size());
+    for (unsigned int i = 0; i < grid.size(); i++) {
+        std::pair<int,int> hypo = grid.get(i);
+        mass[i] = std::nanf("1");
+        chi2[i] = std::nanf("1");
+        status[i] = input_status;
+        if (status[i] == kinfit_ok && vis_mass > std::max(hypo.first, hypo.second)) status[i] = kinfit_vis_mass;
+        if (status[i] == kinfit_ok) to_fit.push_back(i);
+    }
+    _scan_run(grid, to_fit, 0, to_fit.size(), mass, chi2, status);
+}
+
+void KinFitter::_scan_run(const KinFitGrid& grid, const std::vector<unsigned int>& hypos, const unsigned int& first, const unsigned int& last,
+                          float* mass, float* chi2, KinFitStatus* status) {
+    // fit grid hypotheses hypos[first, last) with one master, bisecting the run if any of them throws
+    if (first >= last) return;
+    if (last-first == 1) {  // single fit, which also records why it failed
+        std::pair<int,int> hypo = grid.get(hypos[first]);
+        std::pair<float,float> result = _fit(hypo.first, hypo.second, status[hypos[first]]);
+        mass[hypos[first]] = result.first;
+        chi2[hypos[first]] = result.second;
+        return;
+    }
+
+    HHKinFit2::HHKinFitMasterHeavyHiggs KinFit = HHKinFit2::HHKinFitMasterHeavyHiggs(tlv_b1, tlv_b2, tlv_l1, tlv_l2, ptmiss, metcov);
+    for (unsigned int i = first; i < last; i++) {
+        std::pair<int,int> hypo = grid.get(hypos[i]);
+        KinFit.addHypo(hypo.first, hypo.second);
+    }
+    bool failed = false;
+    try { KinFit.fit(); }
+    catch (HHKinFit2::HHInvMConstraintException const& e)    { failed = true; }
+    catch (HHKinFit2::HHEnergyRangeException const& e)       { failed = true; }
+    catch (HHKinFit2::HHEnergyConstraintException const& e)  { failed = true; }
+    if (failed) {
+        unsigned int mid = (first+last)/2;
+        _scan_run(grid, hypos, first, mid, mass, chi2, status);
+        _scan_run(grid, hypos, mid, last, mass, chi2, status);
+        return;
+    }
+    for (unsigned int i = first; i < last; i++) {
+        std::pair<int,int> hypo = grid.get(hypos[i]);
+        mass[hypos[i]] = KinFit.getMH(hypo.first, hypo.second);
+        chi2[hypos[i]] = KinFit.getChi2(hypo.first, hypo.second);
+    }
+}
+
+KinFitGrid KinFitter::parse_grid(const std::string& spec) {
+    // parse a scan grid given as {mh1 masses},{mh2 masses}, each either a single mass or first:last:step in GeV, e.g. 80:200:10,125
+    KinFitGrid grid;
+    std::stringstream ss(spec);
+    std::string axis;
+    std::vector<std::vector<int>*> axes = {&grid.mh1, &grid.mh2};
+    unsigned int n_axes = 0;
+    while (std::getline(ss, axis, ',')) {
+        if (n_axes >= axes.size()) throw std::invalid_argument("KinFit grid " + spec + " has more than two axes");
+        std::vector<int> vals;
+        std::stringstream as(axis);
+        std::string v;
+        while (std::getline(as, v, ':')) vals.push_back(std::stoi(v));
+        if (vals.size() == 1) {
+            axes[n_axes]->push_back(vals[0]);
+        } else if (vals.size() == 3 && vals[2] > 0 && vals[1] >= vals[0]) {
+            for (int m = vals[0]; m <= vals[1]; m += vals[2]) axes[n_axes]->push_back(m);
+        } else {
+            throw std::invalid_argument("Invalid KinFit grid axis " + axis + ", expected mass or first:last:step");
+        }
+        if (axes[n_axes]->front() <= 0) throw std::invalid_argument("KinFit hypothesis masses must be positive");
+        n_axes++;
+    }
+    if (n_axes != 2) throw std::invalid_argument("KinFit grid " + spec + " must give mh1 and mh2 masses");
+    return grid;
+}
+
+std::string KinFitter::describe_grid(const KinFitGrid& grid) {
+    // list the masses of both axes, e.g. "mh1=80,90 mh2=125", for storing with the scan results
+    std::ostringstream ss;
+    ss << "mh1=";
+    for (unsigned int i = 0; i < grid.mh1.size(); i++) ss << (i > 0 ? "," : "") << grid.mh1[i];
+    ss << " mh2=";
+    for (unsigned int i = 0; i < grid.mh2.size(); i++) ss << (i > 0 ? "," : "") << grid.mh2[i];
+    return ss.str();
+}
+
+KinFitBlock KinFitter::fit_block(const std::vector<KinFitInput>& inputs, const std::vector<std::pair<int,int>>& hypos) {
+    // fit a block of events, reusing one fitter, and return the results as structure-of-arrays
+    KinFitBlock block;
+    block.n_evts  = inputs.size();
+    block.n_hypos = hypos.size();
+    block.mass.resize(block.n_evts*block.n_hypos);
+    block.chi2.resize(block.n_evts*block.n_hypos);
+
+    KinFitter fitter(inputs.empty() ? KinFitInput() : inputs[0]);
+    for (unsigned int i = 0; i < block.n_evts; i++) {
+        fitter.set_input(inputs[i]);
+        std::vector<std::pair<float,float>> results = fitter.fit_hypos(hypos);
+        for (unsigned int h = 0; h < block.n_hypos; h++) {
+            block.mass[h*block.n_evts + i] = results[h].first;
+            block.chi2[h*block.n_evts + i] = results[h].second;
+        }
+    }
+    return block;
 }
@@ -0,0 +1,101 @@
+#include "cms_runII_data_proc/processing/interface/logger.hh"
+
+static_assert((LOG_BUFFER_SIZE & (LOG_BUFFER_SIZE-1)) == 0, "LOG_BUFFER_SIZE must be a power of two");
+
+Logger::Logger() : _head(0), _n_written(0), _n_dropped(0), _tail(0), _level(log_info), _stop(false) {
+    for (unsigned long long int i = 0; i < LOG_BUFFER_SIZE; i++) _slots[i].seq.store(i, std::memory_order_relaxed);
+    _thread = std::thread(&Logger::_run, this);
+}
+
+Logger::~Logger() {
+    _stop.store(true, std::memory_order_release);
+    _thread.join();
+}
+
+Logger& Logger::get() {
+    static Logger logger;
+    return logger;
+}
+
+void Logger::set_level(const LogLevel& level) {
+    _level.store(level, std::memory_order_relaxed);
+}
+
+void Logger::log(const LogLevel& level, const std::string& msg) {
+    /* Claim a slot by advancing the head; each slot's sequence number tells whether the consumer has released it yet */
+
+    unsigned long long int pos = _head.load(std::memory_order_relaxed);
+    LogSlot* slot;
+    while (true) {
+        slot = &_slots[pos & (LOG_BUFFER_SIZE-1)];
+        long long int diff = (long long int)slot->seq.load(std::memory_order_acquire) - (long long int)pos;
+        if (diff == 0) {
+            if (_head.compare_exchange_weak(pos, pos+1, std::memory_order_relaxed)) break;
+        } else if (diff < 0) {  // Full
+            _n_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = _head.load(std::memory_order_relaxed);
+        }
+    }
+    slot->level = level;
+    size_t n = std::min(msg.size(), (size_t)LOG_MSG_SIZE-1);
+    std::memcpy(slot->msg, msg.data(), n);
+    slot->msg[n] = '\0';
+    slot->seq.store(pos+1, std::memory_order_release);
+}
+
+bool Logger::_drain() {
+    /* Write out every published message; returns whether anything was written */
+
+    bool wrote = false;
+    while (true) {
+        LogSlot& slot = _slots[_tail & (LOG_BUFFER_SIZE-1)];
+        if (slot.seq.load(std::memory_order_acquire) != _tail+1) break;
+        if (slot.level != log_info) std::cout << "[" << Logger::get_level_name(slot.level) << "] ";
+        std::cout << slot.msg << "\n";
+        slot.seq.store(_tail+LOG_BUFFER_SIZE, std::memory_order_release);
+        _tail++;
+        _n_written.fetch_add(1, std::memory_order_release);
+        wrote = true;
+    }
+    unsigned long long int n_dropped = _n_dropped.exchange(0, std::memory_order_relaxed);
+    if (n_dropped > 0) {
+        std::cout << "[" << Logger::get_level_name(log_warning) << "] Log buffer full, dropped " << n_dropped << " messages\n";
+        wrote = true;
+    }
+    if (wrote) std::cout << std::flush;
+    return wrote;
+}
+
+void Logger::_run() {
+    while (!_stop.load(std::memory_order_acquire)) {
+        if (!Logger::_drain()) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    Logger::_drain();
+}
+
+void Logger::flush() {
+    /* Wait until every message logged so far has been written. Meant for use outside the event loop, e.g. before a summary */
+
+    unsigned long long int target = _head.load(std::memory_order_acquire);
+    while (_n_written.load(std::memory_order_acquire) < target) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+}
+
+LogLevel Logger::get_level(const std::string& level) {
+    for (int l = 0; l < n_log_levels; l++) {
+        if (level == Logger::get_level_name(LogLevel(l))) return LogLevel(l);
+    }
+    throw std::invalid_argument("Invalid log level: options are debug, info, warning, error");
+    return log_info;
+}
+
+std::string Logger::get_level_name(const LogLevel& level) {
+    switch (level) {
+        case log_debug:   return "debug";
+        case log_info:    return "info";
+        case log_warning: return "warning";
+        case log_error:   return "error";
+        default:          return "unknown";
+    }
+}
@@ -0,0 +1,126 @@
+#include "cms_runII_data_proc/processing/interface/loop_metrics.hh"
+
+LoopMetrics::LoopMetrics(const std::string& fname, const std::string& label, const double& interval,
+                         const long long int& bytes_read, const long long int& bytes_written)
+    : _fname(fname), _label(label), _interval(interval), _bytes_read(0), _bytes_written(0),
+      _bytes_read_0(bytes_read), _bytes_written_0(bytes_written), _stop(false) {
+    _start = std::chrono::steady_clock::now();
+    _thread = std::thread(&LoopMetrics::_run, this);
+}
+
+LoopMetrics::~LoopMetrics() {
+    LoopMetrics::finish();
+}
+
+StageCounters* LoopMetrics::new_counters() {
+    /* Counters for one thread; owned by the metrics so that they outlive the thread */
+
+    std::lock_guard<std::mutex> lock(_mutex);
+    _counters.emplace_back(new StageCounters());
+    return _counters.back().get();
+}
+
+void LoopMetrics::set_bytes(const long long int& bytes_read, const long long int& bytes_written) {
+    /* Update I/O totals from running totals such as TFile::GetFileBytesRead/Written */
+
+    _bytes_read.store(bytes_read-_bytes_read_0, std::memory_order_relaxed);
+    _bytes_written.store(bytes_written-_bytes_written_0, std::memory_order_relaxed);
+}
+
+void LoopMetrics::_run() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (!_stop) {
+        if (_cv.wait_for(lock, std::chrono::duration<double>(_interval), [this]() { return _stop; })) break;
+        lock.unlock();
+        LoopMetrics::_write(false);
+        lock.lock();
+    }
+}
+
+void LoopMetrics::finish() {
+    /* Stop the background thread, write the final metrics, and print a summary */
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_stop) return;
+        _stop = true;
+    }
+    _cv.notify_all();
+    _thread.join();
+    LoopMetrics::_write(true);
+    std::cout << "Loop metrics written to " << _fname << ":\n" << LoopMetrics::_to_json(true) << "\n";
+}
+
+std::string LoopMetrics::get_stage_name(const LoopStage& stage) {
+    switch (stage) {
+        case stage_select_pass: return "select_pass";
+        case stage_read_meta:   return "read_meta";
+        case stage_select:      return "select";
+        case stage_read_feats:  return "read_feats";
+        case stage_convert:     return "convert";
+        case stage_kinfit:      return "kinfit";
+        case stage_process:     return "process";
+        case stage_write:       return "write";
+        default:                return "unknown";
+    }
+}
+
+std::string LoopMetrics::_to_json(const bool& final) {
+    std::array<unsigned long long int, n_loop_stages> ns, calls, records;
+    ns.fill(0);
+    calls.fill(0);
+    records.fill(0);
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (const std::unique_ptr<StageCounters>& c : _counters) {
+            for (unsigned int s = 0; s < n_loop_stages; s++) {
+                ns[s]    += c->ns[s].load(std::memory_order_relaxed);
+                calls[s]   += c->calls[s].load(std::memory_order_relaxed);
+                records[s] += c->records[s].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now()-_start).count();
+    long long int bytes_read = _bytes_read.load(std::memory_order_relaxed), bytes_written = _bytes_written.load(std::memory_order_relaxed);
+
+    std::ostringstream json;
+    json << std::setprecision(6);
+    json << "{\n";
+    json << "  \"label\": \"" << _label << "\",\n";
+    json << "  \"final\": " << (final ? "true" : "false") << ",\n";
+    json << "  \"elapsed_s\": " << elapsed << ",\n";
+    json << "  \"events_read\": " << records[stage_read_meta] << ",\n";
+    json << "  \"events_saved\": " << records[stage_write] << ",\n";
+    json << "  \"events_read_per_s\": " << (elapsed > 0 ? records[stage_read_meta]/elapsed : 0) << ",\n";
+    json << "  \"events_saved_per_s\": " << (elapsed > 0 ? records[stage_write]/elapsed : 0) << ",\n";
+    json << "  \"bytes_read\": " << bytes_read << ",\n";
+    json << "  \"bytes_written\": " << bytes_written << ",\n";
+    json << "  \"read_MB_per_s\": " << (elapsed > 0 ? bytes_read/1e6/elapsed : 0) << ",\n";
+    json << "  \"write_MB_per_s\": " << (elapsed > 0 ? bytes_written/1e6/elapsed : 0) << ",\n";
+    json << "  \"stages\": {\n";
+    for (unsigned int s = 0; s < n_loop_stages; s++) {
+        double t = ns[s]/1e9;
+        json << "    \"" << LoopMetrics::get_stage_name(LoopStage(s)) << "\": {\"calls\": " << calls[s] << ", \"records\": " << records[s]
+             << ", \"time_s\": " << t
+             << ", \"us_per_call\": " << (calls[s] > 0 ? 1e6*t/calls[s] : 0) << ", \"calls_per_s\": " << (t > 0 ? calls[s]/t : 0) << "}"
+             << (s+1 < n_loop_stages ? "," : "") << "\n";
+    }
+    json << "  }\n";
+    json << "}";
+    return json.str();
+}
+
+void LoopMetrics::_write(const bool& final) {
+    /* Replace the metrics file via a temporary file, so that readers never see a partial file */
+
+    std::string tmp_name = _fname + ".tmp";
+    {
+        std::ofstream out(tmp_name);
+        if (!out) {  // Never fatal, as this also runs on the metrics thread
+            std::cerr << "Unable to write metrics to " << tmp_name << "\n";
+            return;
+        }
+        out << LoopMetrics::_to_json(final) << "\n";
+    }
+    std::rename(tmp_name.c_str(), _fname.c_str());
+}
@@ -0,0 +1,168 @@
+#include "cms_runII_data_proc/processing/interface/sample_catalog.hh"
+
+int use_kl = 1;
+
+const std::vector<SampleRule>& SampleCatalog::get_rules() {
+    /* Ordered table of dataset-name rules. More specific rules must come before more general ones. */
+
+    static const std::vector<SampleRule> rules = {
+        // Signal
+        {{"GluGluSignal", "NonRes_klScan", "nlo"}, -26, nonres,   kl_param,           {}},
+        {{"GluGluSignal", "NonRes_klScan"},        -12, nonres,   kl_param,           {}},
+        {{"GluGluSignal", "Radion"},                 0, radion,   res_mass_param,     {-13, -14, -15}},
+        {{"GluGluSignal", "Graviton"},               0, graviton, res_mass_param,     {-16, -17, -18}},
+        {{"GluGluSignal"},                        -999, nonres,   no_param,           {}},
+        {{"VBFSignal", "NonRes", "nlo"},           -27, nonres,   vbf_coupling_param, {}},
+        {{"VBFSignal", "NonRes"},                  -19, nonres,   vbf_coupling_param, {}},
+        {{"VBFSignal", "Radion"},                    0, radion,   res_mass_param,     {-20, -21, -22}},
+        {{"VBFSignal", "Graviton"},                  0, graviton, res_mass_param,     {-23, -24, -25}},
+        {{"VBFSignal"},                           -999, nonres,   no_param,           {}},
+        // Data
+        {{"Data"},                  0, nonres, no_param, {}},
+        // Background
+        {{"TT"},                    1, nonres, no_param, {}},
+        {{"ttH"},                   2, nonres, no_param, {}},
+        {{"DY"},                    3, nonres, no_param, {}},
+        {{"Wjets"},                 4, nonres, no_param, {}},
+        {{"GluGluH"},               5, nonres, no_param, {}},
+        {{"VBFH"},                  5, nonres, no_param, {}},
+        {{"ZHToTauTau_M125"},       6, nonres, no_param, {}},
+        {{"ZH_HToBB_ZToLL_M125"},   7, nonres, no_param, {}},
+        {{"ZH_HToBB_ZToQQ_M125"},   8, nonres, no_param, {}},
+        {{"WminusH"},               9, nonres, no_param, {}},
+        {{"WplusH"},                9, nonres, no_param, {}},
+        {{"WWW"},                  10, nonres, no_param, {}},
+        {{"WWZ"},                  11, nonres, no_param, {}},
+        {{"WZZ"},                  12, nonres, no_param, {}},
+        {{"ZZZ"},                  13, nonres, no_param, {}},
+        {{"EWK"},                  14, nonres, no_param, {}},
+        {{"WW"},                   15, nonres, no_param, {}},
+        {{"WZ"},                   16, nonres, no_param, {}},
+        {{"ZZTo2L2Nu"},            17, nonres, no_param, {}},
+        {{"ZZTo2L2Q"},             18, nonres, no_param, {}},
+        {{"ZZTo2Q2Nu"},            19, nonres, no_param, {}},
+        {{"ZZTo4L"},               20, nonres, no_param, {}},
+        {{"ZZTo4Q"},               21, nonres, no_param, {}},
+        {{"ST"},                   22, nonres, no_param, {}},
+    };
+    return rules;
+}
+
+SampleCatalog::SampleCatalog() {}
+
+SampleCatalog::SampleCatalog(const std::map<unsigned, std::string>& id2dataset, const std::map<unsigned, std::string>& id2region) {
+    _samples.reserve(id2dataset.size());
+    for (const auto& d : id2dataset) {
+        _dataset_idx[d.first] = _samples.size();
+        _samples.push_back(SampleCatalog::resolve_sample(d.second));
+    }
+
+    _regions.reserve(id2region.size());
+    for (const auto& r : id2region) {
+        _region_idx[r.first] = _regions.size();
+        try {
+            _regions.push_back(SampleCatalog::resolve_region(r.second));
+            _region_errors.push_back("");
+        } catch (const std::invalid_argument& e) {
+            _regions.push_back(-1);
+            _region_errors.push_back(e.what());
+        }
+    }
+}
+
+SampleCatalog::~SampleCatalog() {}
+
+const SampleInfo& SampleCatalog::get_sample(const unsigned& dataset_id) const {
+    auto it = _dataset_idx.find(dataset_id);
+    if (it == _dataset_idx.end()) throw std::invalid_argument("Unrecognised dataset hash: " + std::to_string(dataset_id));
+    const SampleInfo& info = _samples[it->second];
+    if (!info.error.empty()) throw std::invalid_argument(info.error);
+    return info;
+}
+
+int SampleCatalog::get_region(const unsigned& region_id) const {
+    auto it = _region_idx.find(region_id);
+    if (it == _region_idx.end()) throw std::invalid_argument("Unrecognised region hash: " + std::to_string(region_id));
+    if (!_region_errors[it->second].empty()) throw std::invalid_argument(_region_errors[it->second]);
+    return _regions[it->second];
+}
+
+SampleInfo SampleCatalog::resolve_sample(const std::string& sample) {
+    /* Apply the first matching rule to the dataset name, parsing any signal parameters it contains */
+
+    SampleInfo info;
+    info.spin = nonres;
+    info.res_mass = 125;
+    info.klambda = use_kl;
+    info.cv = 1;
+    info.c2v = 1;
+    info.c3 = 1;
+    info.sample_id = -999;
+    info.class_id = -999;
+
+    const SampleRule* match = nullptr;
+    for (const SampleRule& rule : SampleCatalog::get_rules()) {
+        bool ok = true;
+        for (const std::string& r : rule.required) {
+            if (sample.find(r) == std::string::npos) {
+                ok = false;
+                break;
+            }
+        }
+        if (ok) {
+            match = &rule;
+            break;
+        }
+    }
+    if (match == nullptr) {
+        info.error = "Unrecognised sample: " + sample;
+        return info;
+    }
+
+    info.sample_id = match->sample_id;
+    info.spin = match->spin;
+    auto parse = [&sample, &info](const std::string& tag) {  // Parse the number following tag in the name
+        std::string val = sample.substr(sample.find(tag)+tag.size());
+        try {
+            return std::stof(val);
+        } catch (...) {
+            if (info.error.empty()) info.error = "Error in sample " + sample + " attempting to parse " + val;
+            return 0.f;
+        }
+    };
+    if (match->param == kl_param) {
+        info.klambda = parse("_klScan_kl");
+    } else if (match->param == res_mass_param) {
+        info.res_mass = parse("_M");
+        if (info.res_mass <= 400) {
+            info.sample_id = match->mass_bin_ids[0];
+        } else if (info.res_mass <= 600) {
+            info.sample_id = match->mass_bin_ids[1];
+        } else {
+            info.sample_id = match->mass_bin_ids[2];
+        }
+    } else if (match->param == vbf_coupling_param) {
+        info.cv  = parse("CV_");
+        info.c2v = parse("C2V_");
+        info.c3  = parse("C3_");
+    }
+    info.class_id = SampleCatalog::get_class_id(info.sample_id);
+    return info;
+}
+
+int SampleCatalog::resolve_region(const std::string& region) {
+    if (region == "OS_Isolated")      return 0;
+    if (region == "OS_AntiIsolated")  return 1;
+    if (region == "SS_Isolated")      return 2;
+    if (region == "SS_AntiIsolated")  return 3;
+    if (region == "SS_LooseIsolated") return 4;
+    throw std::invalid_argument("Unrecognised region: " + region);
+    return -1;
+}
+
+int SampleCatalog::get_class_id(const int& sample) {
+    if (sample == -999)  return -999;  // Sample to reject
+    if (sample < 0)      return 1;     // Signal
+    if (sample == 0)     return -1;    // Collider data
+    return 0;                          // Background
+}
@@ -0,0 +1,125 @@
+#include "cms_runII_data_proc/processing/interface/storage_policy.hh"
+
+StoragePolicy::StoragePolicy(const std::string& spec) {
+    /* Parse a preset name or comma-separated pattern=type rules, e.g. *=trunc:12,weight=f32,sample=i8 */
+
+    const std::map<std::string, std::string>& presets = StoragePolicy::get_presets();
+    _spec = presets.count(spec) ? presets.at(spec) : spec;
+
+    std::stringstream ss(_spec);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item == "") continue;
+        size_t eq = item.find('=');
+        if (eq == std::string::npos || eq == 0) throw std::invalid_argument("Invalid storage rule " + item + ": expected pattern=type");
+        Rule rule;
+        rule.pattern = item.substr(0, eq);
+        std::string type = item.substr(eq+1);
+        rule.storage.bits = 23;
+        try {
+            if (type == "f32") {
+                rule.storage.type = col_f32;
+            } else if (type.rfind("trunc:", 0) == 0) {
+                rule.storage.type = col_trunc;
+                rule.storage.bits = std::stoul(type.substr(6));
+            } else if (type.rfind("f16:", 0) == 0) {
+                rule.storage.type = col_f16;
+                rule.storage.bits = std::stoul(type.substr(4));
+            } else if (type == "i32") {
+                rule.storage.type = col_i32;
+            } else if (type == "i16") {
+                rule.storage.type = col_i16;
+            } else if (type == "i8") {
+                rule.storage.type = col_i8;
+            } else {
+                throw std::invalid_argument(type);
+            }
+        } catch (const std::logic_error& e) {
+            throw std::invalid_argument("Invalid storage type " + type + ": options are f32, trunc:N, f16:N, i32, i16, i8");
+        }
+        if (rule.storage.bits < 1 || rule.storage.bits > 23) {
+            throw std::invalid_argument("Invalid storage type " + type + ": mantissa bits must be 1-23");
+        }
+        _rules.push_back(rule);
+    }
+}
+
+ColumnStorage StoragePolicy::_get(const std::string& column, const bool& is_float) const {
+    /* Storage of a float or integer column: the last rule of its kind which matches it, else full width */
+
+    ColumnStorage storage = {is_float ? col_f32 : col_i32, 23};
+    for (const Rule& r : _rules) {
+        if (fnmatch(r.pattern.c_str(), column.c_str(), 0) != 0) continue;
+        bool float_rule = r.storage.type == col_f32 || r.storage.type == col_trunc || r.storage.type == col_f16;
+        if (float_rule == is_float) {
+            storage = r.storage;
+        } else if (r.pattern == column) {
+            throw std::invalid_argument("Storage rule " + r.pattern + " has the wrong kind of type for a" +
+                                        (is_float ? " float" : "n integer") + " column");
+        }
+    }
+    return storage;
+}
+
+std::string StoragePolicy::get_leaflist(const std::string& column, const ColumnStorage& storage, const unsigned int& size) {
+    /* TTree leaf list of a column, an array of size values if size > 0 */
+
+    std::string leaf = size > 0 ? column+"["+std::to_string(size)+"]" : column;
+    switch (storage.type) {
+        case col_f32:
+        case col_trunc: return leaf+"/F";
+        case col_f16:   return leaf+"/f[0,0,"+std::to_string(storage.bits)+"]";
+        case col_i32:   return leaf+"/I";
+        case col_i16:   return leaf+"/S";
+        case col_i8:    return leaf+"/B";
+        default:        throw std::invalid_argument("Invalid column type " + std::to_string(storage.type));
+    }
+}
+
+const std::map<std::string, std::string>& StoragePolicy::get_presets() {
+    /*
+    Named policies. Sample, jet category, and region always fit 8 bits, since the strat key encodes them in 8, 4, and 4 bits.
+    The event weight is kept at full precision
+    */
+
+    static const std::map<std::string, std::string> presets = {
+        {"full",    ""},
+        {"compact", "*=trunc:16,weight=f32,sample=i8,region=i8,jet_cat=i8,*_gen_match=i8,*_hadronFlavour=i8"},
+        {"half",    "*=f16:10,weight=f32,sample=i8,region=i8,jet_cat=i8,*_gen_match=i8,*_hadronFlavour=i8"},
+    };
+    return presets;
+}
+
+const std::vector<std::string>& StoragePolicy::get_int_columns() {
+    /* Integer metadata columns which may be narrowed */
+
+    static const std::vector<std::string> columns = {"sample", "region", "jet_cat", "tau1_gen_match", "tau2_gen_match",
+                                                     "b1_hadronFlavour", "b2_hadronFlavour"};
+    return columns;
+}
+
+void* PackedColumns::add_narrow(const int* val, const ColumnType& type, const std::string& name) {
+    /* Narrow the integer at val into a field of type, returning the field's address for its branch */
+
+    _narrow.push_back({val, type, name, 0, 0});
+    Narrow& n = _narrow.back();
+    return type == col_i8 ? static_cast<void*>(&n.i8) : static_cast<void*>(&n.i16);
+}
+
+void PackedColumns::pack() {
+    /* Round the truncated floats and copy the narrowed integers, throwing if an integer does not fit its type */
+
+    for (const Trunc& t : _trunc) {
+        for (unsigned int i = 0; i < t.n; i++) t.vals[i] = truncate_mantissa(t.vals[i], t.bits);
+    }
+    for (Narrow& n : _narrow) {
+        const int v = *n.val;
+        if (n.type == col_i8) {
+            if (v < INT8_MIN || v > INT8_MAX) throw std::out_of_range("Value " + std::to_string(v) + " of " + n.name + " does not fit i8");
+            n.i8 = v;
+        } else {
+            if (v < INT16_MIN || v > INT16_MAX) throw std::out_of_range("Value " + std::to_string(v) + " of " + n.name + " does not fit i16");
+            n.i16 = v;
+        }
+    }
+}
@@ -0,0 +1,104 @@
+#include "cms_runII_data_proc/processing/interface/strat_key.hh"
+
+StratIndex::StratIndex(const unsigned int& n_folds) : _n_filled(n_folds, 0), _folds(n_folds) {}
+
+StratIndex::~StratIndex() {}
+
+void StratIndex::_add_range(const unsigned int& fold, const unsigned int& key, const long long int& first, const long long int& n) {
+    Ranges& r = _folds[fold][key];
+    r.n_entries += n;
+    if (!r.first.empty() && r.first.back()+r.n.back() == first) {
+        r.n.back() += n;
+    } else {
+        r.first.push_back(first);
+        r.n.push_back(n);
+    }
+}
+
+void StratIndex::append(const StratIndex& other) {
+    /* Add the index of a file whose entries follow this one's, e.g. when concatenating chunk outputs */
+
+    if (other._folds.size() > _folds.size()) {
+        _folds.resize(other._folds.size());
+        _n_filled.resize(other._folds.size(), 0);
+    }
+    for (unsigned int f = 0; f < other._folds.size(); f++) {
+        for (const auto& k : other._folds[f]) {
+            for (unsigned int i = 0; i < k.second.first.size(); i++) {
+                StratIndex::_add_range(f, k.first, _n_filled[f]+k.second.first[i], k.second.n[i]);
+            }
+        }
+        _n_filled[f] += other._n_filled[f];
+    }
+}
+
+TTree* StratIndex::make_tree() const {
+    /* Create the strat_index tree in the current directory; the caller writes it */
+
+    TTree* tree = new TTree("strat_index", "Entry ranges per stratum and fold");
+    unsigned int fold, strat_key;
+    int sample, jet_cat, channel, year, region;
+    long long int n_entries;
+    std::vector<long long int> range_first, range_n;
+    tree->Branch("fold",        &fold);
+    tree->Branch("strat_key",   &strat_key);
+    tree->Branch("sample",      &sample);
+    tree->Branch("jet_cat",     &jet_cat);
+    tree->Branch("channel",     &channel);
+    tree->Branch("year",        &year);
+    tree->Branch("region",      &region);
+    tree->Branch("n_entries",   &n_entries);
+    tree->Branch("range_first", &range_first);
+    tree->Branch("range_n",     &range_n);
+    for (fold = 0; fold < _folds.size(); fold++) {
+        for (const auto& k : _folds[fold]) {
+            StratKey key = StratKey::decode(k.first);
+            strat_key   = k.first;
+            sample      = key.sample;
+            jet_cat     = key.jet_cat;
+            channel     = key.channel;
+            year        = key.year;
+            region      = key.region;
+            n_entries   = k.second.n_entries;
+            range_first = k.second.first;
+            range_n     = k.second.n;
+            tree->Fill();
+        }
+    }
+    tree->ResetBranchAddresses();
+    return tree;
+}
+
+StratIndex StratIndex::read(TDirectory* dir) {
+    /* Load the strat_index tree of dir */
+
+    TTree* tree = nullptr;
+    dir->GetObject("strat_index", tree);
+    if (tree == nullptr) throw std::runtime_error("No strat_index tree in " + std::string(dir->GetName()));
+    unsigned int fold, strat_key;
+    long long int n_entries;
+    std::vector<long long int> *range_first(nullptr), *range_n(nullptr);
+    tree->SetBranchAddress("fold",        &fold);
+    tree->SetBranchAddress("strat_key",   &strat_key);
+    tree->SetBranchAddress("n_entries",   &n_entries);
+    tree->SetBranchAddress("range_first", &range_first);
+    tree->SetBranchAddress("range_n",     &range_n);
+
+    StratIndex index;
+    for (long long int i = 0; i < tree->GetEntries(); i++) {
+        tree->GetEntry(i);
+        if (fold >= index._folds.size()) {
+            index._folds.resize(fold+1);
+            index._n_filled.resize(fold+1, 0);
+        }
+        Ranges& r = index._folds[fold][strat_key];
+        r.n_entries = n_entries;
+        r.first = *range_first;
+        r.n = *range_n;
+        index._n_filled[fold] += n_entries;
+    }
+    delete tree;
+    delete range_first;
+    delete range_n;
+    return index;
+}
@@ -0,0 +1,253 @@
+#include "cms_runII_data_proc/processing/interface/synth_input.hh"
+
+SynthInput::SynthInput(const SynthConfig& config) : _config(config), _rng(config.seed) {
+    if (_config.samples.size() == 0) throw std::invalid_argument("SynthInput: sample mix is empty");
+    if (_config.regions.size() == 0) throw std::invalid_argument("SynthInput: region mix is empty");
+}
+
+SynthInput::~SynthInput() {}
+
+SynthConfig SynthInput::get_default_config() {
+    /* Sample mix loosely following the composition of the selected anaTuples, with a few of each signal type */
+
+    SynthConfig config;
+    config.samples = {{"TT",  0.35}, {"DY", 0.25}, {"Wjets", 0.06}, {"ST", 0.04}, {"WW", 0.01}, {"WZ", 0.01},
+                      {"ZZTo2L2Q", 0.01}, {"ttH", 0.01}, {"GluGluH", 0.01}, {"EWK", 0.01}, {"Data", 0.16},
+                      {"GluGluSignal_NonRes_klScan_kl1", 0.03}, {"GluGluSignal_NonRes_klScan_kl5", 0.01},
+                      {"GluGluSignal_Radion_M500", 0.01}, {"GluGluSignal_Graviton_M800", 0.01},
+                      {"VBFSignal_NonRes_CV_1_C2V_1_C3_1", 0.01}, {"VBFSignal_NonRes_CV_1_C2V_2_C3_1", 0.01}};
+    config.regions = {{"OS_Isolated", 0.6}, {"OS_AntiIsolated", 0.15}, {"SS_Isolated", 0.15}, {"SS_AntiIsolated", 0.05},
+                      {"SS_LooseIsolated", 0.05}};
+    config.kinematics = {{"tau_pt",  35},     // Mean pT above threshold of the leptons (GeV)
+                         {"b_pt",    55},     // Mean pT above threshold of the b-jets (GeV)
+                         {"vbf_pt",  60},     // Mean pT above threshold of the VBF jets (GeV)
+                         {"met_pt",  45},     // Mean MET (GeV)
+                         {"b_pair",  0.9},    // Fraction of events with a b-jet pair
+                         {"vbf_pair", 0.2},   // Fraction of b-jet pair events with a VBF pair
+                         {"boosted", 0.08},   // Fraction of b-jet pair events which are boosted
+                         {"btag",    0.5},    // Exponent of the DeepFlavour score, lower = more b-like
+                         {"svfit_scale", 1.3},  // SVfit mass relative to the visible di-tau mass
+                         {"kinfit_fail", 0.03}};  // Fraction of events with a failed stored KinFit
+    config.seed = 1;
+    return config;
+}
+
+std::vector<std::pair<std::string, double>> SynthInput::parse_mix(const std::string& mix) {
+    /* Parse a comma-separated list of name:abundance pairs; the abundance defaults to 1 */
+
+    std::vector<std::pair<std::string, double>> parsed;
+    std::stringstream ss(mix);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        size_t pos = item.find(':');
+        std::string name = item.substr(0, pos);
+        double frac = pos == std::string::npos ? 1 : std::stod(item.substr(pos+1));
+        if (frac < 0) throw std::invalid_argument("Negative abundance for " + name);
+        parsed.push_back(std::make_pair(name, frac));
+    }
+    if (parsed.size() == 0) throw std::invalid_argument("Empty mix: " + mix);
+    return parsed;
+}
+
+void SynthInput::parse_kinematics(const std::string& settings, SynthConfig& config) {
+    /* Override kinematic settings from a comma-separated list of key=value pairs */
+
+    std::stringstream ss(settings);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        if (item.empty()) continue;
+        size_t pos = item.find('=');
+        if (pos == std::string::npos) throw std::invalid_argument("Kinematic setting must be key=value: " + item);
+        std::string key = item.substr(0, pos);
+        if (config.kinematics.count(key) == 0) {
+            std::string keys;
+            for (const auto& k : config.kinematics) keys += " " + k.first;
+            throw std::invalid_argument("Unrecognised kinematic setting " + key + ", options are:" + keys);
+        }
+        config.kinematics[key] = std::stod(item.substr(pos+1));
+    }
+}
+
+unsigned SynthInput::get_hash(const std::string& name) {
+    /* 32-bit FNV-1a of the name, standing in for the hashes written by the anaTuple production */
+
+    unsigned hash = 2166136261U;
+    for (const char& c : name) {
+        hash ^= (unsigned char)c;
+        hash *= 16777619U;
+    }
+    return hash;
+}
+
+unsigned int SynthInput::_pick(const std::vector<std::pair<std::string, double>>& mix) {
+    double sum = 0;
+    for (const auto& m : mix) sum += m.second;
+    double r = _rng.Uniform(sum);
+    for (unsigned int i = 0; i < mix.size(); i++) {
+        r -= mix[i].second;
+        if (r < 0) return i;
+    }
+    return mix.size()-1;
+}
+
+SynthInput::LorentzVectorPEP SynthInput::_draw_object(const float& pt_min, const float& pt_mean, const float& eta_max,
+                                                      const float& mass, const float& mass_width) {
+    float m = mass_width > 0 ? std::max(0.f, (float)_rng.Gaus(mass, mass_width)) : mass;
+    return LorentzVectorPEP(pt_min+_rng.Exp(pt_mean), _rng.Uniform(-eta_max, eta_max), _rng.Uniform(-M_PI, M_PI), m);
+}
+
+void SynthInput::write(const std::string& fname, const std::string& channel, const long int& n_events) {
+    /* Write n_events to fname, in a tree named after the channel, plus the aux tree */
+
+    float l1_min, l1_eta, l1_mass, l1_width;
+    if (channel == "tauTau") {
+        l1_min = 40; l1_eta = 2.1; l1_mass = 1.0;   l1_width = 0.3;
+    } else if (channel == "muTau") {
+        l1_min = 23; l1_eta = 2.1; l1_mass = 0.106; l1_width = 0;
+    } else if (channel == "eTau") {
+        l1_min = 33; l1_eta = 2.1; l1_mass = 0.0005; l1_width = 0;
+    } else {
+        throw std::invalid_argument("Invalid channel: options are tauTau, muTau, eTau");
+    }
+    const float l2_min = channel == "tauTau" ? 40 : 20;
+    std::map<std::string, double>& kin = _config.kinematics;
+
+    // Aux info
+    std::vector<std::string> dataset_names, region_names;
+    std::vector<unsigned> dataset_hashes, region_hashes;
+    std::vector<bool> is_data;
+    std::map<unsigned, std::string> seen;
+    for (const auto& mix : {&_config.samples, &_config.regions}) {
+        for (const auto& m : *mix) {
+            unsigned hash = SynthInput::get_hash(m.first);
+            if (seen.count(hash) && seen[hash] != m.first) {
+                throw std::runtime_error("Hash collision between " + seen[hash] + " and " + m.first);
+            }
+            seen[hash] = m.first;
+            if (mix == &_config.samples) {
+                dataset_names.push_back(m.first);
+                dataset_hashes.push_back(hash);
+                is_data.push_back(m.first.find("Data") != std::string::npos);
+            } else {
+                region_names.push_back(m.first);
+                region_hashes.push_back(hash);
+            }
+        }
+    }
+
+    TFile* out_file = new TFile(fname.c_str(), "recreate");
+    TTree* tree = new TTree(channel.c_str(), channel.c_str());
+
+    // Non-float branches, in the types bound by EvtReader
+    unsigned long long evt;
+    UInt_t dataset, event_region;
+    int tau1_gen_match, tau2_gen_match, b1_hadronFlavour, b2_hadronFlavour, num_btag_Loose, num_btag_Medium;
+    bool is_boosted, has_b_pair, has_VBF_pair;
+    tree->Branch("evt",              &evt);
+    tree->Branch("dataset",          &dataset);
+    tree->Branch("event_region",     &event_region);
+    tree->Branch("tau1_gen_match",   &tau1_gen_match);
+    tree->Branch("tau2_gen_match",   &tau2_gen_match);
+    tree->Branch("b1_hadronFlavour", &b1_hadronFlavour);
+    tree->Branch("b2_hadronFlavour", &b2_hadronFlavour);
+    tree->Branch("num_btag_Loose",   &num_btag_Loose);
+    tree->Branch("num_btag_Medium",  &num_btag_Medium);
+    tree->Branch("is_boosted",       &is_boosted);
+    tree->Branch("has_b_pair",       &has_b_pair);
+    tree->Branch("has_VBF_pair",     &has_VBF_pair);
+
+    // Everything else is a float
+    std::map<std::string, float> vals;  // Node addresses are stable
+    for (const std::string& b : EvtReader::get_branch_names()) {
+        if (tree->GetBranch(b.c_str()) != nullptr) continue;
+        tree->Branch(b.c_str(), &vals[b]);
+    }
+    auto set_p4 = [&vals](const std::string& prefix, const LorentzVectorPEP& p4) {
+        vals[prefix+"_pt"]  = p4.Pt();
+        vals[prefix+"_eta"] = p4.Eta();
+        vals[prefix+"_phi"] = p4.Phi();
+        vals[prefix+"_m"]   = p4.M();
+    };
+    auto set_tags = [&vals, this](const std::string& prefix) {
+        vals[prefix+"_HHbtag"]              = _rng.Rndm();
+        vals[prefix+"_DeepFlavour_CvsL"]    = _rng.Rndm();
+        vals[prefix+"_DeepFlavour_CvsB"]    = _rng.Rndm();
+    };
+
+    for (long int i = 0; i < n_events; i++) {
+        evt = 2*i + _rng.Integer(2);  // Unique, with a random fold
+        unsigned int s = SynthInput::_pick(_config.samples);
+        dataset = dataset_hashes[s];
+        event_region = region_hashes[SynthInput::_pick(_config.regions)];
+        vals["weight"] = is_data[s] ? 1 : _rng.Gaus(1, 0.25);
+
+        // Gen info
+        auto gen_match = [this]() { return _rng.Rndm() < 0.6 ? 5 : (int)_rng.Integer(6)+1; };
+        auto flavour   = [this]() { double r = _rng.Rndm(); return r < 0.6 ? 5 : (r < 0.7 ? 4 : 0); };
+        tau1_gen_match   = is_data[s] ? 0 : gen_match();
+        tau2_gen_match   = is_data[s] ? 0 : gen_match();
+        b1_hadronFlavour = is_data[s] ? 0 : flavour();
+        b2_hadronFlavour = is_data[s] ? 0 : flavour();
+
+        // Leptons & MET
+        LorentzVectorPEP l1 = SynthInput::_draw_object(l1_min, kin["tau_pt"], l1_eta, l1_mass, l1_width);
+        LorentzVectorPEP l2 = SynthInput::_draw_object(l2_min, kin["tau_pt"], 2.3, 1.0, 0.3);
+        set_p4("tau1", l1);
+        set_p4("tau2", l2);
+        vals["MET_pt"]  = _rng.Exp(kin["met_pt"]);
+        vals["MET_phi"] = _rng.Uniform(-M_PI, M_PI);
+        vals["MET_cov_00"] = _rng.Uniform(100, 800);
+        vals["MET_cov_11"] = _rng.Uniform(100, 800);
+        vals["MET_cov_01"] = _rng.Uniform(-0.3, 0.3)*std::sqrt(vals["MET_cov_00"]*vals["MET_cov_11"]);  // Positive definite
+
+        // Jets
+        has_b_pair   = _rng.Rndm() < kin["b_pair"];
+        has_VBF_pair = has_b_pair && _rng.Rndm() < kin["vbf_pair"];
+        is_boosted   = has_b_pair && _rng.Rndm() < kin["boosted"];
+        LorentzVectorPEP b1 = SynthInput::_draw_object(20, kin["b_pt"], 2.4, 10, 3);
+        LorentzVectorPEP b2 = SynthInput::_draw_object(20, kin["b_pt"], 2.4, 10, 3);
+        set_p4("b1", b1);
+        set_p4("b2", b2);
+        set_p4("VBF1", SynthInput::_draw_object(30, kin["vbf_pt"], 4.7, 8, 3));
+        set_p4("VBF2", SynthInput::_draw_object(30, kin["vbf_pt"], 4.7, 8, 3));
+        for (const char* j : {"b1", "b2", "VBF1", "VBF2"}) set_tags(j);
+        vals["b1_DeepFlavour"] = std::pow(_rng.Rndm(), kin["btag"]);
+        vals["b2_DeepFlavour"] = std::pow(_rng.Rndm(), kin["btag"]);
+        num_btag_Loose = num_btag_Medium = 0;
+        if (has_b_pair) {
+            for (const char* j : {"b1_DeepFlavour", "b2_DeepFlavour"}) {  // 2018 DeepFlavour loose & medium WPs
+                if (vals[j] > 0.0494) num_btag_Loose++;
+                if (vals[j] > 0.2770) num_btag_Medium++;
+            }
+        }
+
+        // HL feats
+        LorentzVectorPEP vis = l1+l2;
+        set_p4("SVfit", LorentzVectorPEP(vis.Pt(), vis.Eta(), vis.Phi(), vis.M()*_rng.Gaus(kin["svfit_scale"], 0.1)));
+        if (_rng.Rndm() < kin["kinfit_fail"]) {
+            vals["kinFit_m"]    = -1;
+            vals["kinFit_chi2"] = -1;
+        } else {
+            vals["kinFit_m"]    = (vis+b1+b2).M()*_rng.Gaus(1.1, 0.05);
+            vals["kinFit_chi2"] = _rng.Exp(5);
+        }
+        vals["MT2"] = _rng.Exp(80);
+        tree->Fill();
+    }
+    tree->Write();
+
+    TTree* aux = new TTree("aux", "aux");
+    aux->Branch("dataset_names",  &dataset_names);
+    aux->Branch("dataset_hashes", &dataset_hashes);
+    aux->Branch("region_names",   &region_names);
+    aux->Branch("region_hashes",  &region_hashes);
+    aux->Fill();
+    aux->Write();
+
+    delete tree;
+    delete aux;
+    out_file->Close();
+    delete out_file;
+    std::cout << "Wrote " << n_events << " synthetic " << channel << " events to " << fname << "\n";
+}